@@ -26,6 +26,25 @@
 #include <switch.h>
 #include <switch_apr.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <poll.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "shimaore_framing.h"
+#include "shimaore_features.h"
+#include "shimaore_lossless.h"
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/udp.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#endif
 
 /* Prototypes */
 SWITCH_MODULE_LOAD_FUNCTION(mod_shimaore_load);
@@ -36,36 +55,663 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_shimaore_shutdown);
  */
 SWITCH_MODULE_DEFINITION(mod_shimaore, mod_shimaore_load, mod_shimaore_shutdown, NULL);
 
+/* USDT probes (provider `shimaore`), see bpftrace/. With systemtap's <sys/sdt.h> each probe is a
+ * single nop until a tracer attaches; without it, or with SHIMAORE_NO_USDT, they compile to nothing.
+ * Arguments are evaluated even when nobody listens, so keep them to fields already at hand.
+ */
+#if !defined(SHIMAORE_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SHIMAORE_USDT 1
+#endif
+#endif
+
+#ifdef SHIMAORE_USDT
+#define SHIMAORE_PROBE3(name, a, b, c) DTRACE_PROBE3(shimaore, name, a, b, c)
+#define SHIMAORE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(shimaore, name, a, b, c, d)
+#else
+#define SHIMAORE_PROBE3(name, a, b, c) do { } while (0)
+#define SHIMAORE_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
 typedef enum {
     /* Raw audio over UDP, native system byte order */
     SHIMAORE_FRAMING_PLAIN,
     /* L16 (network byte order) audio inside RTP framing */
     SHIMAORE_FRAMING_RTP_L16,
+    /* Log-mel feature frames inside RTP framing (see shimaore_features.h) */
+    SHIMAORE_FRAMING_FEATURES,
+    /* Losslessly compressed L16 inside RTP framing (see shimaore_lossless.h) */
+    SHIMAORE_FRAMING_LOSSLESS,
 } shimaore_framing_t;
 
+typedef enum {
+    SHIMAORE_RTCP_OFF,
+    /* Sender reports on the RTP socket, for consumers doing rtcp-mux (RFC 5761) */
+    SHIMAORE_RTCP_MUX,
+    /* Sender reports to the destination's port + 1 */
+    SHIMAORE_RTCP_PORT,
+} shimaore_rtcp_t;
+
+typedef enum {
+    SHIMAORE_FEC_OFF,
+    /* Each bunch carries the previous one too (RFC 2198) */
+    SHIMAORE_FEC_RED,
+    /* A parity packet after each group of `fec_group` bunches */
+    SHIMAORE_FEC_PARITY,
+} shimaore_fec_t;
+
+typedef enum {
+    /* Rendezvous hashing on the session UUID: a given call always lands on the same consumer */
+    SHIMAORE_BALANCE_HASH,
+    /* Pick the healthy consumer currently serving the fewest taps */
+    SHIMAORE_BALANCE_LEAST,
+} shimaore_balance_t;
+
+/* A consumer instance (ip:port). Destinations are shared by all taps and live
+ * as long as the module, so that health learned by one tap benefits the others.
+ */
+typedef struct shimaore_destination_s {
+    char *name;
+    uint32_t hash;
+    switch_sockaddr_t *addr;
+    /* Same host, port + 1 */
+    switch_sockaddr_t *rtcp_addr;
+    /* `addr` for the tick engine's sendmmsg */
+    struct sockaddr_in sockaddr;
+
+    /* Number of taps currently streaming to this destination */
+    switch_atomic_t active_taps;
+    /* Send errors since the last successful send, all taps included */
+    switch_atomic_t consecutive_errors;
+    /* Held down (not selected) until this time; written racily, a stale read only delays failover by one packet */
+    volatile switch_time_t down_until;
+} shimaore_destination_t;
+
+enum {
+    SHIMAORE_DESTINATION_MAXIMUM = 16,
+    /* Consecutive send errors (e.g. ECONNREFUSED from ICMP port unreachable) before a destination is held down */
+    SHIMAORE_DESTINATION_ERROR_THRESHOLD = 5,
+};
+
+/* How long a failed destination is kept out of the selection */
+#define SHIMAORE_DESTINATION_HOLDDOWN (5 * 1000000)
+
+/* Room kept in front of each bunch for the packet headers */
+enum {
+    SHIMAORE_HEADROOM = 64
+};
+
+/*** Slab ***/
+
+/* Module-wide size classes for tap buffers: 512 B to 64 KB, carved out of 2 MB arenas
+ * (hugepage-backed when `slab-hugepages` is set). Buffers are recycled, never given back.
+ */
+enum {
+    SHIMAORE_SLAB_MINIMUM_SHIFT = 9,
+    SHIMAORE_SLAB_CLASSES = 8,
+    SHIMAORE_SLAB_ARENA_SIZE = 2 * 1024 * 1024,
+};
+
+typedef struct shimaore_slab_object_s {
+    struct shimaore_slab_object_s *next;
+} shimaore_slab_object_t;
+
+typedef struct shimaore_slab_arena_s {
+    void *base;
+    struct shimaore_slab_arena_s *next;
+} shimaore_slab_arena_t;
+
+typedef struct {
+    switch_mutex_t *mutex;
+    shimaore_slab_object_t *free;
+    /* Unused tail of the class's current arena */
+    uint8_t *fresh;
+    uint8_t *fresh_end;
+    uint32_t in_use;
+    uint32_t free_count;
+    uint32_t arenas;
+} shimaore_slab_class_t;
+
+/* Default source port when neither `local_port` nor a port range is configured */
+#define SHIMAORE_DEFAULT_LOCAL_PORT 5876
+
+/* The part of a tap's setup that `update` may change while the tap runs.
+ * A configuration is immutable once published: `update` builds a new one and swaps the
+ * pointer, and the media thread picks it up (lock-free) at its next frame. Each one is a single
+ * slab object holding its own strings; the one an update replaced is freed by the next update,
+ * once the media thread has moved on (see shimaore_unicast_update), or with the tap.
+ */
+typedef struct shimaore_config_s {
+    shimaore_destination_t *destinations[SHIMAORE_DESTINATION_MAXIMUM];
+    uint32_t destination_count;
+    shimaore_balance_t balance;
+    /* Last `remote_ip`/`remote_port` pair, so that `update` may change only one of them.
+     * NULL and 0 for a tap sent to `remote=`.
+     */
+    const char *remote_ip;
+    int remote_port;
+
+    uint32_t buncher_maximum;
+
+    /* Private signalling */
+    uint8_t *meta;
+    uint16_t meta_length;
+
+    /* Size of the slab object, strings included */
+    uint32_t allocated;
+} shimaore_config_t;
+
+/*** Latency ***/
+
+/* Where a bunch's time goes, from the read of its first frame to the wire */
+typedef enum {
+    /* First frame read -> bunch complete: time spent waiting for the other frames */
+    SHIMAORE_LATENCY_BUFFERED,
+    /* Bunch complete -> send syscall: framing and byte swapping */
+    SHIMAORE_LATENCY_PREPARE,
+    /* Duration of the send syscall */
+    SHIMAORE_LATENCY_SYSCALL,
+    /* Send syscall returned -> kernel TX software timestamp (`latency=kernel`) */
+    SHIMAORE_LATENCY_KERNEL,
+    SHIMAORE_LATENCY_STAGES
+} shimaore_latency_stage_t;
+
+typedef enum {
+    SHIMAORE_LATENCY_OFF,
+    SHIMAORE_LATENCY_ON,
+    /* Also kernel TX timestamps */
+    SHIMAORE_LATENCY_WITH_KERNEL,
+} shimaore_latency_mode_t;
+
+/* Log-linear histograms (HDR style): 8 sub-buckets per power of two, i.e. 12.5% precision,
+ * of microsecond values up to 2^26 (about 67 seconds).
+ */
+enum {
+    SHIMAORE_HISTOGRAM_SUB_BITS = 3,
+    SHIMAORE_HISTOGRAM_MAXIMUM_BITS = 26,
+    SHIMAORE_HISTOGRAM_BUCKETS = (SHIMAORE_HISTOGRAM_MAXIMUM_BITS - SHIMAORE_HISTOGRAM_SUB_BITS + 1) << SHIMAORE_HISTOGRAM_SUB_BITS,
+    /* Sends awaiting their kernel timestamp */
+    SHIMAORE_LATENCY_TX_PENDING = 16,
+};
+
+/* Allocated from the slab for taps started with `latency=on|kernel`. Written by the media thread
+ * only; the API reads it racily.
+ */
+typedef struct shimaore_latency_s {
+    uint32_t counts[SHIMAORE_LATENCY_STAGES][SHIMAORE_HISTOGRAM_BUCKETS];
+    uint32_t maximum[SHIMAORE_LATENCY_STAGES];
+
+    /* Monotonic time of the current bunch's first frame read, and of the last bunch's send */
+    switch_time_t bunch_read;
+    switch_time_t bunch_complete;
+    switch_time_t send_before;
+
+    /* SO_TIMESTAMPING: the kernel numbers every send on the socket (SOF_TIMESTAMPING_OPT_ID) */
+    switch_bool_t kernel;
+    uint32_t tx_id;
+    struct {
+        uint32_t id;
+        /* Realtime clock, as are kernel timestamps */
+        switch_time_t sent;
+    } tx[SHIMAORE_LATENCY_TX_PENDING];
+} shimaore_latency_t;
+
+/*** Levels ***/
+
+/* `levels=on|<id>`: RMS, peak and clipping of every bunch, measured by the media thread before
+ * framing, sent in the header extension with `levels=<id>`, and summed up per second for
+ * `status`. The per-second values are written by the media thread and read racily by the API.
+ */
+typedef struct shimaore_levels_s {
+    switch_bool_t enabled;
+    /* Current bunch, in -dBov (SHIMAORE_LEVEL_SILENCE and below as SHIMAORE_LEVEL_SILENCE) */
+    uint8_t rms;
+    uint8_t peak;
+    uint16_t clipped;
+
+    /* Second in progress */
+    uint64_t energy;
+    uint64_t samples;
+    uint32_t peak_sample;
+    uint32_t clipped_samples;
+
+    /* Last complete second */
+    uint8_t second_rms;
+    uint8_t second_peak;
+    uint32_t second_clipped;
+    uint64_t clipped_total;
+} shimaore_levels_t;
+
+/* MSG_ZEROCOPY (`zerocopy-threshold`): the kernel keeps a bunch sent zero-copy pinned until its
+ * completion shows up on the socket's error queue, so the tap hands the sent buffer over to this
+ * pool and continues with an idle one. Allocated from the slab; media thread only.
+ */
+enum {
+    SHIMAORE_ZEROCOPY_BUFFERS = 8,
+    /* How long a closing tap waits for its last completions */
+    SHIMAORE_ZEROCOPY_CLOSE_WAIT_MS = 50,
+};
+
+typedef struct shimaore_zerocopy_s {
+    struct {
+        /* Slab object, headroom included; NULL for an empty entry */
+        uint8_t *object;
+        uint32_t capacity;
+        /* Id of the zero-copy send still using it */
+        uint32_t id;
+        switch_bool_t busy;
+    } buffers[SHIMAORE_ZEROCOPY_BUFFERS];
+    uint32_t pending;
+    /* The kernel copied anyway (e.g. loopback): pinning pages only adds cost, stop */
+    switch_bool_t disabled;
+
+    /* Statistics */
+    uint64_t sent;
+    uint64_t copied;
+    uint64_t fallbacks;
+} shimaore_zerocopy_t;
+
+/* `nack=on|<bunches>`: the tap keeps its last bunches as they went out (RTP header included,
+ * encoded) in a ring indexed by sequence number, and sends again those that consumers report
+ * lost (see shimaore_nack_write). NACKs arrive on the tap's own socket, which only accepts
+ * packets from its destination; one thread watches the sockets of all such taps
+ * (shimaore_nack_thread). The ring is written by whichever thread sends the tap's bunches and
+ * read by the NACK thread, under a spin lock. Allocated from the slab, entries too.
+ */
+enum {
+    SHIMAORE_NACK_HISTORY_DEFAULT = 64,
+    SHIMAORE_NACK_HISTORY_MAXIMUM = 1024,
+    SHIMAORE_NACK_EVENTS = 64,
+};
+
+typedef struct shimaore_history_entry_s {
+    /* Slab object, NULL for an entry never used */
+    uint8_t *data;
+    uint32_t capacity;
+    uint32_t length;
+    uint16_t sequence_number;
+} shimaore_history_entry_t;
+
+typedef struct shimaore_history_s {
+    volatile uint8_t lock;
+    uint32_t size;
+
+    /* Statistics, NACK thread only */
+    uint64_t requested;
+    uint64_t retransmitted;
+    uint64_t unavailable;
+
+    shimaore_history_entry_t entries[];
+} shimaore_history_t;
+
+/* `fec=`: what the bunches already sent are needed for. Parity packets protect bunches as sent
+ * (encoded, RTP header included) up to SHIMAORE_FEC_PACKET_MAXIMUM bytes; they are built by
+ * whichever thread sends the tap's bunches, under a spin lock, and sent without it from a second
+ * buffer, queued behind the last bunch of their group. Redundant blocks are added by the encoding
+ * thread only. Allocated from the slab.
+ */
+enum {
+    SHIMAORE_FEC_PACKET_MAXIMUM = 8192,
+};
+
+typedef struct shimaore_fec_state_s {
+    volatile uint8_t lock;
+    /* What the state was allocated for: the tap's `fec` may be turned off later */
+    shimaore_fec_t fec;
+    /* Of each buffer */
+    uint32_t capacity;
+    /* The one being built; for parity, the other one too, NULL while its packet is being sent */
+    uint8_t *data;
+    uint8_t *spare;
+
+    /* Parity: the group from `first`, members seen in `mask`, XOR of their lengths and bytes */
+    uint16_t first;
+    uint16_t mask;
+    uint16_t length_xor;
+    /* Longest member, i.e. bytes of `data` in use */
+    uint32_t length;
+    uint32_t timestamp;
+
+    /* Redundancy: the previous bunch's payload, `length` bytes of `data` (0 when too long to attach) */
+    uint16_t sequence_number;
+    uint8_t payload_type;
+
+    /* Statistics */
+    uint64_t parity_sent;
+    uint64_t groups_incomplete;
+    uint64_t redundant;
+
+    uint8_t buffers[];
+} shimaore_fec_state_t;
+
+struct shimaore_unicast_context_s;
+
+/* Per-framing behaviour, chosen once when the tap starts */
+typedef struct shimaore_framing_ops_s {
+    const char *name;
+    /* Send the `len` bytes at the start of the bunch buffer */
+    switch_status_t (*send_bunch)(struct shimaore_unicast_context_s *context, uint32_t len);
+    switch_status_t (*send_start)(struct shimaore_unicast_context_s *context);
+    switch_status_t (*send_stop)(struct shimaore_unicast_context_s *context);
+    /* Whether the metadata is repeated every SHIMAORE_META_RESEND_INTERVAL bunches */
+    switch_bool_t resend_meta;
+    /* NULL, or the transformation of a bunch's audio (`length` bytes after a `header_length`
+     * header at `packet`) into the payload actually sent, written at `to`; returns its length, or
+     * 0 to send the packet as it stands (the encoder may have rewritten it in place).
+     * Runs on the send engine thread when there is one, so the media thread does not pay for it.
+     */
+    uint32_t (*encode)(struct shimaore_unicast_context_s *context, uint8_t *packet, uint32_t header_length,
+                       uint32_t length, uint8_t *to, uint32_t capacity);
+} shimaore_framing_ops_t;
+
 typedef struct shimaore_unicast_context_s {
+    /* Contexts are recycled through a module-wide free list along with their pool and, when it
+     * came from the port allocator, their bound socket. Fields before `uuid` survive recycling.
+     */
+    switch_memory_pool_t *pool;
+    struct shimaore_unicast_context_s *next_free;
     switch_socket_t *socket;
+    switch_os_socket_t fd;
+    /* Source port taken from the port allocator, kept while the context is pooled; 0 for a fixed `local_port` */
+    switch_port_t allocated_port;
+    char local_ip[64];
+    /* Only created for `rtcp=port` */
+    switch_socket_t *rtcp_socket;
+    /* The socket's count of MSG_ZEROCOPY sends, which completions refer to */
+    uint32_t zerocopy_id;
+
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+
+    /* The media bug holds one reference, each packet queued on the send engine another, the
+     * NACK thread one while it watches the socket; the context is released when the last one
+     * goes (see shimaore_context_put).
+     */
+    uint32_t refs;
+    /* Results of queued sends not yet seen by the media thread */
+    uint32_t async_successes;
+    uint32_t async_failures;
+    /* Set by shimaore_transmit when the packet was queued rather than sent */
+    switch_bool_t send_pending;
+
+    /* Latest configuration published by the API, and the one the media thread currently applies */
+    shimaore_config_t *published_config;
+    shimaore_config_t *config;
+    /* Replaced by the last update, possibly still in use by the media thread */
+    shimaore_config_t *retired_config;
+    /* Set while an `update` builds the next configuration: one at a time per tap */
+    volatile uint8_t updating;
+
+    /* Member of the configuration's destination group currently in use (sticky until it fails) */
+    shimaore_destination_t *destination;
+    uint32_t uuid_hash;
+
+    /* Set by the `pause` / `resume` API; `was_paused` is the media thread's view of it */
+    volatile uint32_t paused;
+    switch_bool_t was_paused;
+    /* Size of one read frame, used to keep the RTP timestamp running while paused */
+    uint32_t frame_bytes;
+
+    /* Pre-roll: an armed tap records its read audio into this ring before (and while) streaming,
+     * so that `start ... preroll_ms=` can deliver the audio that preceded the start.
+     * Positions are absolute byte counts; the ring holds the last `preroll_size` bytes.
+     */
+    uint8_t *preroll_ring;
+    uint32_t preroll_size;
+    uint32_t preroll_bytes_per_ms;
+    uint64_t preroll_written;
+    uint64_t preroll_read;
+    uint32_t preroll_ms;
+    switch_bool_t preroll_catching_up;
 
     uint32_t buncher_position;
     uint32_t buncher_frame_count;
-    uint32_t buncher_maximum;
-    /* recommended buffer size is 8192, way below the default 64k MTU on Linux loopback interface */
-    uint8_t buncher_buffer[2*SWITCH_RECOMMENDED_BUFFER_SIZE];
+    /* Slab buffer sized from the read codec and frames_per_packet, preceded by SHIMAORE_HEADROOM
+     * bytes where packet headers are written, so that a bunch is sent without being copied.
+     */
+    uint8_t *buncher_buffer;
+    uint32_t buncher_capacity;
 
     shimaore_framing_t framing;
+    const shimaore_framing_ops_t *framing_ops;
     uint32_t rtp_ssrc; /* provided by app */
     uint16_t rtp_sequence_number;/* initial value SHOULD be random */
     uint32_t rtp_timestamp; /* initial value SHOULD be random */
+    shimaore_rtp_template_t rtp_template;
+    /* `framing=features`: filterbank tables and the window carried across bunches; only used by
+     * whoever encodes the tap's bunches (the send engine thread, or the media thread without one)
+     */
+    shimaore_features_t *features;
+    /* Wall clock time the first sample of the current bunch was captured */
+    switch_time_t bunch_capture_time;
+    /* RTP timestamp units (bytes) per second */
+    uint32_t timestamp_rate;
+    /* Interleaved in the audio */
+    uint32_t channels;
 
-    /* Statistics */
+    /* NULL unless started with `latency=` */
+    shimaore_latency_t *latency;
+    shimaore_levels_t levels;
+    /* NULL unless `zerocopy-threshold` is set and the socket supports it */
+    shimaore_zerocopy_t *zerocopy;
+    /* NULL unless started with `nack=`; the NACK thread watches the socket while `nack_listening`
+     * (both under globals.nack_mutex), and drops its reference once the tap is on `nack_closed`
+     */
+    shimaore_history_t *history;
+    switch_bool_t nack_listening;
+    struct shimaore_unicast_context_s *nack_next;
+    shimaore_fec_t fec;
+    /* `fec=parity:<k>`: bunches per group, and bunches of the current group so far (media thread) */
+    uint32_t fec_group;
+    uint32_t fec_count;
+    /* NULL unless started with `fec=` */
+    shimaore_fec_state_t *fec_state;
+    /* Encoded payloads when sending without the send engine, sized for the largest bunch */
+    uint8_t *encode_scratch;
+    uint32_t encode_scratch_capacity;
+    switch_bool_t encode_scratch_warned;
+    /* Send engine shard, NULL to send directly; only used by the media thread once set */
+    struct shimaore_engine_s *engine;
+    /* `send-engine-shard=cpu`: moved to the media thread's shard already */
+    switch_bool_t engine_pinned;
+
+    /* Sender reports are built by the module's report thread (see shimaore_rtcp_thread) from a
+     * wall clock / RTP timestamp pair published by the media thread after each bunch, under a
+     * sequence count so that the pair is read consistently.
+     */
+    shimaore_rtcp_t rtcp;
+    uint32_t rtcp_clock_sequence;
+    switch_time_t rtcp_clock_time;
+    uint32_t rtcp_clock_timestamp;
+    /* Set by the media thread before its last bunch and stop packet; reports in progress are
+     * counted in `rtcp_reporting`, which the media thread waits out (see shimaore_context_close).
+     */
+    volatile uint32_t closing;
+    volatile uint32_t rtcp_reporting;
+
+    /* Statistics; the last two are also updated by the send engine, atomically */
     uint64_t sent_attempted;
     uint64_t sent_successful;
-
-    /* Private signalling */
-    uint8_t meta[SWITCH_RECOMMENDED_BUFFER_SIZE];
-    uint16_t meta_length;
+    /* Payload octets successfully sent */
+    uint64_t sent_octets;
 } shimaore_context_t;
 
+/*** Send engine ***/
+
+/* With a send engine, media threads copy each packet into a slot of a buffer pool and queue it
+ * (lock-free, multiple producers) to the engine thread, which sends it and accounts for the
+ * result in the tap's counters. Media threads never enter the kernel for audio.
+ * - `send-engine=io_uring`: the thread owns a ring and turns queued slots into WRITE_FIXED
+ *   submissions (the pool is a registered buffer) on the taps' connected sockets;
+ * - `send-engine=tick`: the thread wakes up on every `flush-tick-ms` boundary of the wall clock
+ *   and sends everything queued since, in sendmmsg and UDP GSO batches; so bunches from all taps
+ *   leave together, with a cadence receivers can rely on. With `tick-shared-socket`, bunches of
+ *   framed taps without RTCP, NACK, parity or a port from `local-port-range` leave from the
+ *   thread's own socket, and share its batches; all others from the tap's socket.
+ * Whenever a slot is not available (pool exhausted, packet too large, engine not running), the
+ * packet is sent directly as before; except bunches whose framing encodes them (features, lossless), which
+ * the engine thread encodes in order, and which are then dropped rather than sent out of turn.
+ */
+typedef struct shimaore_engine_slot_s {
+    /* Queue link */
+    struct shimaore_engine_slot_s *next;
+    struct shimaore_unicast_context_s *context;
+    uint8_t *data;
+    uint32_t length;
+    /* Audio octets to account on success; 0 for signalling */
+    uint32_t payload;
+    uint32_t index;
+    /* Tick engine: destination for the shared socket, NULL to send on the tap's own */
+    const struct sockaddr_in *address;
+} shimaore_engine_slot_t;
+
+typedef enum {
+    SHIMAORE_ENGINE_DIRECT,
+    SHIMAORE_ENGINE_IO_URING,
+    SHIMAORE_ENGINE_TICK,
+} shimaore_engine_mode_t;
+
+static const char *shimaore_engine_names[] = { "direct", "io_uring", "tick" };
+
+/* Room for one UDP_SEGMENT control message */
+typedef uint8_t shimaore_engine_control_t[CMSG_SPACE(sizeof(uint16_t))];
+
+typedef struct shimaore_engine_s {
+    shimaore_engine_mode_t mode;
+    switch_bool_t sqpoll;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t tick_ms;
+    switch_bool_t tick_shared;
+    /* Shard number, and the core its thread is pinned to (-1: not pinned) */
+    uint32_t index;
+    int cpu;
+
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+#endif
+    switch_bool_t ring_ready;
+
+    /* Tick engine: the shared socket and the batch being built */
+    int tick_fd;
+    switch_bool_t gso;
+    shimaore_engine_slot_t **tick_batch;
+    struct iovec *tick_iov;
+    struct mmsghdr *tick_messages;
+    shimaore_engine_control_t *tick_control;
+
+    /* One slot's worth, where framings with an encoder build their payload */
+    uint8_t *scratch;
+
+    switch_thread_t *thread;
+    volatile switch_bool_t running;
+
+    uint8_t *memory;
+    shimaore_engine_slot_t *slots;
+    /* Free slots: Treiber stack of indices, tagged against ABA (tag << 32 | index + 1) */
+    uint64_t free_head;
+    uint32_t *free_next;
+
+    /* Intrusive MPSC queue (Vyukov): producers swap `head`, the engine thread pops at `tail` */
+    shimaore_engine_slot_t *head;
+    shimaore_engine_slot_t *tail;
+    shimaore_engine_slot_t stub;
+
+    /* Statistics */
+    uint64_t queued;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t fallbacks;
+    /* Bunches to encode that found no slot: encoders may keep state, so they are not sent directly */
+    uint64_t dropped;
+    uint32_t inflight;
+    uint64_t ticks;
+    uint64_t tick_syscalls;
+    uint64_t tick_gso;
+    /* Load: taps assigned to the shard, time spent sending since it started */
+    uint32_t taps;
+    switch_time_t started;
+    uint64_t busy_us;
+} shimaore_engine_t;
+
+enum {
+    SHIMAORE_ENGINE_DEFAULT_SLOTS = 4096,
+    /* 10 frames of 20 ms at 16 kHz, plus headers */
+    SHIMAORE_ENGINE_DEFAULT_SLOT_SIZE = 8192,
+    SHIMAORE_ENGINE_RING_ENTRIES = 1024,
+    /* How long the engine thread naps when there is nothing to do */
+    SHIMAORE_ENGINE_IDLE_US = 500,
+    SHIMAORE_ENGINE_DEFAULT_TICK_MS = 20,
+    /* Packets per sendmmsg */
+    SHIMAORE_ENGINE_TICK_BATCH = 1024,
+    /* UDP GSO: segments must fit a 1500-byte MTU, within one 64 KB datagram, 64 at most (UDP_MAX_SEGMENTS) */
+    SHIMAORE_ENGINE_GSO_SEGMENT_MAXIMUM = 1472,
+    SHIMAORE_ENGINE_GSO_MAXIMUM = 65507,
+    SHIMAORE_ENGINE_GSO_SEGMENTS = 64,
+    SHIMAORE_ENGINE_SHARDS_MAXIMUM = 64,
+};
+
+static struct {
+    switch_memory_pool_t *pool;
+    switch_mutex_t *mutex;
+    /* "ip:port" -> shimaore_destination_t */
+    switch_hash_t *destinations;
+
+    shimaore_slab_class_t slab[SHIMAORE_SLAB_CLASSES];
+    shimaore_slab_arena_t *slab_arenas;
+    switch_bool_t slab_hugepages;
+
+    /* uuid -> shimaore_context_t of every running tap */
+    switch_hash_t *taps;
+    /* conference name -> shimaore_conference_t (see shimaore_conference_start) */
+    switch_hash_t *conferences;
+    /* Recycled contexts (see shimaore_context_acquire) */
+    shimaore_context_t *free_contexts;
+    uint32_t free_context_count;
+
+    switch_event_node_t *answer_node;
+    switch_event_node_t *bridge_node;
+
+    /* Module-wide default source port range (`local-port-range`), 0 when unset */
+    switch_port_t port_range_min;
+    switch_port_t port_range_max;
+    /* One bit per UDP port currently assigned to a tap; updated with atomic bit operations only */
+    volatile uint64_t port_bitmap[65536 / 64];
+    /* Rotating start point, so that consecutive taps do not contend for the same bit */
+    switch_atomic_t port_cursor;
+
+    /* Send engine settings, copied into each of the `send-engine-workers` shards */
+    shimaore_engine_t engine;
+    shimaore_engine_t *engines;
+    uint32_t engine_count;
+    int engine_cpus[SHIMAORE_ENGINE_SHARDS_MAXIMUM];
+    uint32_t engine_cpu_count;
+    /* Taps go to the shard of their media thread's core rather than of their UUID (`send-engine-shard`) */
+    switch_bool_t engine_follow_cpu;
+
+    /* Smallest bunch sent with MSG_ZEROCOPY (`zerocopy-threshold`), 0 to never */
+    uint32_t zerocopy_threshold;
+
+    /* Watches the sockets of the taps started with `nack=` */
+    int nack_epoll_fd;
+    switch_thread_t *nack_thread;
+    switch_mutex_t *nack_mutex;
+    /* Taps that stopped listening, whose reference the NACK thread still holds */
+    struct shimaore_unicast_context_s *nack_closed;
+
+    /* Sender report thread and its period (`rtcp-interval`) */
+    switch_thread_t *rtcp_thread;
+    uint32_t rtcp_interval_ms;
+    volatile switch_bool_t running;
+} globals;
+
+/* Pooled contexts kept for reuse; beyond that they are destroyed on close */
+enum {
+    SHIMAORE_CONTEXT_POOL_MAXIMUM = 4096,
+    /* How deep shimaore_context_acquire looks into the free list for a compatible socket */
+    SHIMAORE_CONTEXT_POOL_SCAN = 8,
+};
+
 /* Bunch every ten frames, i.e. every 200ms at 20ms sampling time,
  * making for 3200 bytes UDP payload for single channel SLIN16 at 8kHz.
  */
@@ -73,225 +719,3946 @@ enum {
     BUNCHER_MAXIMUM_PACKET_COUNT = 10
 };
 
+enum {
+    /* Default and maximum history kept by an armed tap */
+    SHIMAORE_PREROLL_DEFAULT_MS = 5000,
+    SHIMAORE_PREROLL_MAXIMUM_MS = 60000,
+    /* History bunches flushed per read frame, i.e. up to 40x real time with 10-frame bunches */
+    SHIMAORE_PREROLL_BUNCHES_PER_FRAME = 4,
+};
+
+enum {
+    /* RFC 3550 section 6.2 recommended minimum */
+    SHIMAORE_RTCP_DEFAULT_INTERVAL_MS = 5000,
+};
+
 char SHIMAORE_UNICAST_BUG[] = "_shimaore_unicast_bug_";
 
-static switch_status_t shimaore_send_start(shimaore_context_t *context) {
-  switch_size_t len = 0;
-  switch_status_t outcome;
-  uint8_t packet_buffer[2*SWITCH_RECOMMENDED_BUFFER_SIZE];
+/* Custom event fired when a tap stops, with its counters and latency percentiles */
+#define SHIMAORE_STATS_EVENT "shimaore::stats"
 
-  if (context->meta_length == 0) {
-    return SWITCH_STATUS_FALSE;
-  }
+/*** Source ports ***/
+
+/* Give each tap its own source port so that the receiver's RSS / SO_REUSEPORT hashing can
+ * spread flows over sockets and cores. Lock-free: a port is owned by whoever sets its bit.
+ */
+static switch_port_t shimaore_port_allocate(switch_port_t min, switch_port_t max) {
+    uint32_t span = (uint32_t) max - min + 1;
+    uint32_t start;
+
+    switch_atomic_inc(&globals.port_cursor);
+    start = switch_atomic_read(&globals.port_cursor);
+
+    for (uint32_t i = 0; i < span; i++) {
+        uint32_t port = min + (start + i) % span;
+        uint64_t bit = 1ULL << (port % 64);
 
-  /* Network byte order */
-  packet_buffer[0] = 2 << 6; /* version 2, no padding, no extension, no CSRC */
-  packet_buffer[1] = 124; /* no marker, dynamic */
-  /* sequence number */
-  packet_buffer[2] = context->rtp_sequence_number >> 8;
-  packet_buffer[3] = context->rtp_sequence_number;
-  /* Timestamp */
-  packet_buffer[4] = context->rtp_timestamp >> 24;
-  packet_buffer[5] = context->rtp_timestamp >> 16;
-  packet_buffer[6] = context->rtp_timestamp >> 8;
-  packet_buffer[7] = context->rtp_timestamp;
-  /* SSRC identifier */
-  packet_buffer[8] = context->rtp_ssrc >> 24;
-  packet_buffer[9] = context->rtp_ssrc >> 16;
-  packet_buffer[10] = context->rtp_ssrc >> 8;
-  packet_buffer[11] = context->rtp_ssrc;
-  /* Payload */
-  memcpy(packet_buffer+12, context->meta, context->meta_length);
-  len = 12+context->meta_length;
-  outcome = switch_socket_send(context->socket, packet_buffer, &len);
-  return outcome;
+        if (!(__atomic_fetch_or(&globals.port_bitmap[port / 64], bit, __ATOMIC_ACQ_REL) & bit)) {
+            return (switch_port_t) port;
+        }
+    }
+    return 0;
 }
 
-static switch_status_t shimaore_send_stop(shimaore_context_t *context) {
-  switch_size_t len = 0;
-  switch_status_t outcome;
+static void shimaore_port_release(switch_port_t port) {
+    if (port) {
+        __atomic_fetch_and(&globals.port_bitmap[port / 64], ~(1ULL << (port % 64)), __ATOMIC_RELEASE);
+    }
+}
 
-  if (context->meta_length == 0) {
-    return SWITCH_STATUS_FALSE;
-  }
+static switch_status_t shimaore_port_range_parse(const char *value, switch_port_t *min, switch_port_t *max) {
+    const char *dash = strchr(value, '-');
+    int first = atoi(value);
+    int last = dash ? atoi(dash+1) : 0;
 
-  uint8_t packet_buffer[2*SWITCH_RECOMMENDED_BUFFER_SIZE];
-  /* L16 per RFC 3511 section 4.5.11 */
-  /* Network byte order */
-  packet_buffer[0] = 2 << 6; /* version 2, no padding, no extension, no CSRC */
-  packet_buffer[1] = 125; /* no marker, dynamic */
-  /* sequence number */
-  packet_buffer[2] = context->rtp_sequence_number >> 8;
-  packet_buffer[3] = context->rtp_sequence_number;
-  /* Timestamp */
-  packet_buffer[4] = context->rtp_timestamp >> 24;
-  packet_buffer[5] = context->rtp_timestamp >> 16;
-  packet_buffer[6] = context->rtp_timestamp >> 8;
-  packet_buffer[7] = context->rtp_timestamp;
-  /* SSRC identifier */
-  packet_buffer[8] = context->rtp_ssrc >> 24;
-  packet_buffer[9] = context->rtp_ssrc >> 16;
-  packet_buffer[10] = context->rtp_ssrc >> 8;
-  packet_buffer[11] = context->rtp_ssrc;
-  /* Payload */
-  len = 12;
-  outcome = switch_socket_send(context->socket, packet_buffer, &len);
-  return outcome;
+    if (first <= 0 || last < first || last > 65535) {
+        return SWITCH_STATUS_FALSE;
+    }
+    *min = first;
+    *max = last;
+    return SWITCH_STATUS_SUCCESS;
 }
 
-/*** Unicast ***/
-static switch_status_t shimaore_send(shimaore_context_t *context) {
-    switch_size_t len = 0;
-    switch_status_t outcome;
-    len = context->buncher_position;
-    context->rtp_sequence_number++;
+/* Bind the tap's socket, either to the fixed `local_port` or to the first free port of the range
+ * that the system lets us have (ports used outside of this module are skipped).
+ */
+static switch_status_t shimaore_socket_bind(shimaore_context_t *context, const char *local_ip, int local_port,
+                                            switch_port_t min, switch_port_t max, switch_memory_pool_t *pool) {
+    switch_sockaddr_t *local_addr;
+    uint32_t attempts = max - min + 1;
 
-    switch (context->framing) {
-        case SHIMAORE_FRAMING_PLAIN: {
-            /* Explicitly ignore errors */
-            outcome = switch_socket_send(context->socket, context->buncher_buffer, &len);
-            context->sent_attempted++;
-            if (outcome == SWITCH_STATUS_SUCCESS) {
-                context->sent_successful++;
-            }
-            break;
+    if (local_port > 0) {
+        if (switch_sockaddr_info_get(&local_addr, local_ip, SWITCH_UNSPEC, local_port, 0, pool) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_FALSE;
         }
-        case SHIMAORE_FRAMING_RTP_L16: {
-            uint8_t packet_buffer[2*SWITCH_RECOMMENDED_BUFFER_SIZE];
-            /* L16 per RFC 3511 section 4.5.11 */
-            /* Network byte order */
-            packet_buffer[0] = 2 << 6; /* version 2, no padding, no extension, no CSRC */
-            packet_buffer[1] = 96; /* no marker, dynamic */
-            /* sequence number */
-            packet_buffer[2] = context->rtp_sequence_number >> 8;
-            packet_buffer[3] = context->rtp_sequence_number;
-            /* Timestamp */
-            packet_buffer[4] = context->rtp_timestamp >> 24;
-            packet_buffer[5] = context->rtp_timestamp >> 16;
-            packet_buffer[6] = context->rtp_timestamp >> 8;
-            packet_buffer[7] = context->rtp_timestamp;
-            /* SSRC identifier */
-            packet_buffer[8] = context->rtp_ssrc >> 24;
-            packet_buffer[9] = context->rtp_ssrc >> 16;
-            packet_buffer[10] = context->rtp_ssrc >> 8;
-            packet_buffer[11] = context->rtp_ssrc;
-            /* Payload */
-            memcpy(packet_buffer+12, context->buncher_buffer, len);
-
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-            switch_swap_linear((int16_t *)packet_buffer+12,len/2);
-#endif
-            len += 12;
-            outcome = switch_socket_send(context->socket, packet_buffer, &len);
-            context->sent_attempted++;
-            if (outcome == SWITCH_STATUS_SUCCESS) {
-                context->sent_successful++;
-            }
+        return switch_socket_bind(context->socket, local_addr);
+    }
 
-            context->rtp_timestamp += context->buncher_position;
+    if (attempts > 16) {
+        attempts = 16;
+    }
+    while (attempts--) {
+        switch_port_t port = shimaore_port_allocate(min, max);
 
-            /* Re-send the metadata every so often in case the first frame got lost */
-            if (context->sent_attempted % 16 == 0) {
-                shimaore_send_start(context);
-            }
+        if (!port) {
+            break;
         }
+        if (switch_sockaddr_info_get(&local_addr, local_ip, SWITCH_UNSPEC, port, 0, pool) == SWITCH_STATUS_SUCCESS &&
+            switch_socket_bind(context->socket, local_addr) == SWITCH_STATUS_SUCCESS) {
+            context->allocated_port = port;
+            return SWITCH_STATUS_SUCCESS;
+        }
+        shimaore_port_release(port);
     }
-    context->buncher_position = 0;
-    context->buncher_frame_count = 0;
-    return outcome;
+    return SWITCH_STATUS_FALSE;
 }
 
-static switch_bool_t shimaore_unicast_bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
-{
-    shimaore_context_t *context = (shimaore_context_t *) user_data;
-    if (!context) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "No context in callback!\n");
-        return SWITCH_TRUE;
+/*** Slab ***/
+
+static int shimaore_slab_class(switch_size_t size) {
+    int klass = 0;
+
+    while (klass < SHIMAORE_SLAB_CLASSES && ((switch_size_t) 1 << (SHIMAORE_SLAB_MINIMUM_SHIFT + klass)) < size) {
+        klass++;
     }
+    return klass < SHIMAORE_SLAB_CLASSES ? klass : -1;
+}
 
-    switch (type) {
-    case SWITCH_ABC_TYPE_INIT:
-        {
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: init");
-            shimaore_send_start(context);
+static void *shimaore_slab_arena_new(void) {
+    void *base = MAP_FAILED;
+    shimaore_slab_arena_t *arena;
+
+#ifdef MAP_HUGETLB
+    if (globals.slab_hugepages) {
+        base = mmap(NULL, SHIMAORE_SLAB_ARENA_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (base == MAP_FAILED) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "No hugepage available, using regular pages\n");
+            globals.slab_hugepages = SWITCH_FALSE;
         }
-        break;
-    case SWITCH_ABC_TYPE_CLOSE:
-        {
-            if (context->buncher_position > 0) {
-                shimaore_send(context);
+    }
+#endif
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, SHIMAORE_SLAB_ARENA_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    }
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    switch_mutex_lock(globals.mutex);
+    arena = (shimaore_slab_arena_t *) switch_core_alloc(globals.pool, sizeof(*arena));
+    arena->base = base;
+    arena->next = globals.slab_arenas;
+    globals.slab_arenas = arena;
+    switch_mutex_unlock(globals.mutex);
+    return base;
+}
+
+/* Returns a buffer of at least `size` bytes, or NULL */
+static void *shimaore_slab_alloc(switch_size_t size) {
+    int klass = shimaore_slab_class(size);
+    shimaore_slab_class_t *slab;
+    switch_size_t object_size;
+    void *object = NULL;
+
+    if (klass < 0) {
+        return NULL;
+    }
+    slab = &globals.slab[klass];
+    object_size = (switch_size_t) 1 << (SHIMAORE_SLAB_MINIMUM_SHIFT + klass);
+
+    switch_mutex_lock(slab->mutex);
+    if (slab->free) {
+        object = slab->free;
+        slab->free = slab->free->next;
+        slab->free_count--;
+    } else {
+        if (slab->fresh == slab->fresh_end) {
+            uint8_t *base = (uint8_t *) shimaore_slab_arena_new();
+            if (base) {
+                slab->fresh = base;
+                slab->fresh_end = base + SHIMAORE_SLAB_ARENA_SIZE;
+                slab->arenas++;
             }
-            shimaore_send_stop(context);
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: close: attempted %ld, successful %ld", context->sent_attempted, context->sent_successful);
         }
-        break;
-    case SWITCH_ABC_TYPE_READ:
-        {
-            // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: read");
+        if (slab->fresh != slab->fresh_end) {
+            object = slab->fresh;
+            slab->fresh += object_size;
+        }
+    }
+    if (object) {
+        slab->in_use++;
+    }
+    switch_mutex_unlock(slab->mutex);
+    return object;
+}
 
-            if (!context->socket) {
-                // switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "No socket in callback!\n");
-                return SWITCH_TRUE;
-            }
+static void shimaore_slab_free(void *object, switch_size_t size) {
+    shimaore_slab_class_t *slab;
 
-            {
-                uint32_t flags = 0;
-                switch_frame_t read_frame = { 0 };
-                read_frame.data = context->buncher_buffer + context->buncher_position;
-                read_frame.buflen = SWITCH_RECOMMENDED_BUFFER_SIZE;
+    if (!object) {
+        return;
+    }
+    slab = &globals.slab[shimaore_slab_class(size)];
+    switch_mutex_lock(slab->mutex);
+    ((shimaore_slab_object_t *) object)->next = slab->free;
+    slab->free = (shimaore_slab_object_t *) object;
+    slab->free_count++;
+    slab->in_use--;
+    switch_mutex_unlock(slab->mutex);
+}
 
-                // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: reading frame");
-                if (switch_core_media_bug_read(bug, &read_frame, SWITCH_FALSE) != SWITCH_STATUS_SUCCESS) {
-                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: no frame");
-                    return SWITCH_TRUE;
-                }
+/* Copy `from` into a single slab object, strings included. Returns NULL on failure. */
+static shimaore_config_t *shimaore_config_copy(const shimaore_config_t *from) {
+    switch_size_t ip_length = from->remote_ip ? strlen(from->remote_ip) + 1 : 0;
+    switch_size_t size = sizeof(*from) + ip_length + from->meta_length;
+    shimaore_config_t *config = (shimaore_config_t *) shimaore_slab_alloc(size);
+    uint8_t *tail;
 
-                /* Append to the buffer */
-                context->buncher_position += read_frame.datalen;
-                context->buncher_frame_count += 1;
+    if (!config) {
+        return NULL;
+    }
+    *config = *from;
+    config->allocated = (uint32_t) size;
+    tail = (uint8_t *) (config + 1);
+    if (from->remote_ip) {
+        memcpy(tail, from->remote_ip, ip_length);
+        config->remote_ip = (const char *) tail;
+        tail += ip_length;
+    }
+    if (from->meta_length > 0) {
+        memcpy(tail, from->meta, from->meta_length);
+        config->meta = tail;
+    } else {
+        config->meta = NULL;
+    }
+    return config;
+}
 
-                // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: got frame %d\n", read_frame.datalen);
+static void shimaore_config_free(shimaore_config_t *config) {
+    if (config) {
+        shimaore_slab_free(config, config->allocated);
+    }
+}
 
-                /* If we have less that the recommended size left or we already processed the proper number of frames, send out and reset. */
-                if (context->buncher_position >= SWITCH_RECOMMENDED_BUFFER_SIZE || context->buncher_frame_count >= context->buncher_maximum) {
-                    switch_status_t outcome = shimaore_send(context);
-                    // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: sending rtp_sequence_number=%d outcome=%d\n", context->rtp_sequence_number, outcome);
-                }
-            }
+/* Make room for `frames` frames of `frame_bytes` in the bunch buffer, keeping its content */
+static switch_status_t shimaore_buncher_reserve(shimaore_context_t *context, uint32_t frames, uint32_t frame_bytes) {
+    uint32_t capacity = frames * frame_bytes;
+    uint8_t *object;
+
+    if (capacity == 0) {
+        capacity = SWITCH_RECOMMENDED_BUFFER_SIZE;
+    }
+    if (context->buncher_buffer && capacity <= context->buncher_capacity) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    /* Use the whole slab object */
+    {
+        int klass = shimaore_slab_class(SHIMAORE_HEADROOM + capacity);
+        if (klass < 0) {
+            return SWITCH_STATUS_FALSE;
         }
-        break;
-    default:
-        // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: other");
-        break;
+        capacity = ((uint32_t) 1 << (SHIMAORE_SLAB_MINIMUM_SHIFT + klass)) - SHIMAORE_HEADROOM;
+    }
+    if (!(object = (uint8_t *) shimaore_slab_alloc(SHIMAORE_HEADROOM + capacity))) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if (context->buncher_buffer) {
+        memcpy(object + SHIMAORE_HEADROOM, context->buncher_buffer, context->buncher_position);
+        shimaore_slab_free(context->buncher_buffer - SHIMAORE_HEADROOM, SHIMAORE_HEADROOM + context->buncher_capacity);
+    }
+    context->buncher_buffer = object + SHIMAORE_HEADROOM;
+    context->buncher_capacity = capacity;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void shimaore_buncher_free(shimaore_context_t *context) {
+    if (context->buncher_buffer) {
+        shimaore_slab_free(context->buncher_buffer - SHIMAORE_HEADROOM, SHIMAORE_HEADROOM + context->buncher_capacity);
+        context->buncher_buffer = NULL;
+        context->buncher_capacity = 0;
+    }
+}
+
+/* Buffers the kernel still holds are leaked rather than handed to another tap */
+static void shimaore_zerocopy_free(shimaore_context_t *context) {
+    shimaore_zerocopy_t *zerocopy = context->zerocopy;
+
+    if (!zerocopy) {
+        return;
+    }
+    for (int i = 0; i < SHIMAORE_ZEROCOPY_BUFFERS; i++) {
+        if (zerocopy->buffers[i].object && !zerocopy->buffers[i].busy) {
+            shimaore_slab_free(zerocopy->buffers[i].object, SHIMAORE_HEADROOM + zerocopy->buffers[i].capacity);
+        }
+    }
+    if (zerocopy->pending) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "zerocopy: %u buffers still pinned by the kernel, leaking them\n", zerocopy->pending);
+    }
+    shimaore_slab_free(zerocopy, sizeof(*zerocopy));
+    context->zerocopy = NULL;
+}
+
+/*** Retransmission history ***/
+
+static switch_size_t shimaore_history_bytes(uint32_t size) {
+    return sizeof(shimaore_history_t) + size * sizeof(shimaore_history_entry_t);
+}
+
+static switch_status_t shimaore_history_alloc(shimaore_context_t *context, uint32_t size) {
+    shimaore_history_t *history;
+
+    if (!(history = (shimaore_history_t *) shimaore_slab_alloc(shimaore_history_bytes(size)))) {
+        return SWITCH_STATUS_FALSE;
+    }
+    memset(history, 0, shimaore_history_bytes(size));
+    history->size = size;
+    context->history = history;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Parity keeps a second buffer, for the packet being sent */
+static switch_size_t shimaore_fec_bytes(shimaore_fec_t fec, uint32_t capacity) {
+    return sizeof(shimaore_fec_state_t) + (fec == SHIMAORE_FEC_PARITY ? 2 : 1) * (switch_size_t) capacity;
+}
+
+/* On release, and before each start: an armed tap keeps its context across start attempts */
+static void shimaore_fec_free(shimaore_context_t *context) {
+    if (context->fec_state) {
+        shimaore_slab_free(context->fec_state, shimaore_fec_bytes(context->fec_state->fec, context->fec_state->capacity));
+        context->fec_state = NULL;
+    }
+}
+
+/* Once no thread refers to the context anymore */
+static void shimaore_history_free(shimaore_context_t *context) {
+    shimaore_history_t *history = context->history;
+
+    if (!history) {
+        return;
+    }
+    for (uint32_t i = 0; i < history->size; i++) {
+        shimaore_slab_free(history->entries[i].data, history->entries[i].capacity);
+    }
+    shimaore_slab_free(history, shimaore_history_bytes(history->size));
+    context->history = NULL;
+}
+
+/* Held for a copy at most, by threads that may not block */
+static inline void shimaore_spin_lock(volatile uint8_t *lock) {
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static inline void shimaore_spin_unlock(volatile uint8_t *lock) {
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+/* Any thread sending a bunch of the tap: keep a copy of the RTP packet in `iov`. The entry's
+ * buffer is taken out, filled and put back, so that the lock only covers pointer swaps.
+ */
+static void shimaore_history_record(shimaore_context_t *context, const struct iovec *iov, int iovcnt) {
+    shimaore_history_t *history = context->history;
+    const uint8_t *header = (const uint8_t *) iov[0].iov_base;
+    uint16_t sequence_number = (uint16_t) (header[2] << 8 | header[3]);
+    shimaore_history_entry_t *entry;
+    uint8_t *data;
+    uint32_t capacity;
+    uint8_t *stale;
+    uint32_t stale_capacity;
+    uint32_t length = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        length += iov[i].iov_len;
+    }
+    entry = &history->entries[sequence_number % history->size];
+    shimaore_spin_lock(&history->lock);
+    data = entry->data;
+    capacity = entry->capacity;
+    entry->data = NULL;
+    entry->capacity = 0;
+    entry->length = 0;
+    shimaore_spin_unlock(&history->lock);
+
+    if (capacity < length) {
+        int klass = shimaore_slab_class(length);
+
+        shimaore_slab_free(data, capacity);
+        /* Use the whole slab object, as the bunch buffer does */
+        capacity = klass < 0 ? 0 : 1u << (SHIMAORE_SLAB_MINIMUM_SHIFT + klass);
+        if (!capacity || !(data = (uint8_t *) shimaore_slab_alloc(capacity))) {
+            data = NULL;
+            capacity = 0;
+        }
+    }
+    if (data) {
+        for (int i = 0, at = 0; i < iovcnt; at += iov[i].iov_len, i++) {
+            memcpy(data + at, iov[i].iov_base, iov[i].iov_len);
+        }
+    }
+
+    shimaore_spin_lock(&history->lock);
+    stale = entry->data;
+    stale_capacity = entry->capacity;
+    entry->data = data;
+    entry->capacity = capacity;
+    entry->length = data ? length : 0;
+    entry->sequence_number = sequence_number;
+    shimaore_spin_unlock(&history->lock);
+    /* Set only if another sending thread recorded into the same entry meanwhile */
+    shimaore_slab_free(stale, stale_capacity);
+}
+
+/*** Contexts ***/
+
+static switch_bool_t shimaore_context_reusable(shimaore_context_t *context, const char *local_ip, int local_port,
+                                               switch_port_t min, switch_port_t max) {
+    return context->socket && local_port == 0 &&
+        context->allocated_port >= min && context->allocated_port <= max &&
+        !strcmp(context->local_ip, local_ip);
+}
+
+/* Get a context for a new tap, preferably a pooled one whose socket is already bound to a suitable
+ * source port, saving socket creation, options and bind. Everything from `uuid` on is zeroed.
+ */
+static shimaore_context_t *shimaore_context_acquire(const char *local_ip, int local_port,
+                                                   switch_port_t min, switch_port_t max) {
+    shimaore_context_t *context = NULL;
+    shimaore_context_t **link;
+    uint32_t scanned = 0;
+
+    switch_mutex_lock(globals.mutex);
+    for (link = &globals.free_contexts; *link && scanned < SHIMAORE_CONTEXT_POOL_SCAN; link = &(*link)->next_free, scanned++) {
+        if (shimaore_context_reusable(*link, local_ip, local_port, min, max)) {
+            context = *link;
+            *link = context->next_free;
+            globals.free_context_count--;
+            break;
+        }
+    }
+    switch_mutex_unlock(globals.mutex);
+
+    if (context) {
+        switch_os_socket_t fd;
+        int error;
+        socklen_t error_len = sizeof(error);
+
+        /* Drop a pending error (e.g. ICMP unreachable) left over by the previous tap */
+        if (switch_os_sock_get(&fd, context->socket) == SWITCH_STATUS_SUCCESS) {
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+        }
+    } else {
+        switch_memory_pool_t *pool;
+
+        if (switch_core_new_memory_pool(&pool) != SWITCH_STATUS_SUCCESS) {
+            return NULL;
+        }
+        context = (shimaore_context_t *) switch_core_alloc(pool, sizeof(*context));
+        context->pool = pool;
+        context->socket = NULL;
+        context->allocated_port = 0;
+        context->rtcp_socket = NULL;
+        context->zerocopy_id = 0;
+    }
+
+    context->next_free = NULL;
+    memset(context->uuid, 0, sizeof(*context) - offsetof(shimaore_context_t, uuid));
+    context->refs = 1;
+    return context;
+}
+
+/* Return a context whose tap is gone. Contexts with an allocated port keep their socket bound
+ * and go back to the free list; the others are destroyed.
+ */
+static void shimaore_context_release(shimaore_context_t *context) {
+    switch_memory_pool_t *pool = context->pool;
+
+    shimaore_buncher_free(context);
+    shimaore_zerocopy_free(context);
+    if (context->engine) {
+        __atomic_sub_fetch(&context->engine->taps, 1, __ATOMIC_RELAXED);
+    }
+    if (context->latency) {
+        shimaore_slab_free(context->latency, sizeof(*context->latency));
+        context->latency = NULL;
+    }
+    if (context->features) {
+        shimaore_slab_free(context->features, sizeof(*context->features));
+        context->features = NULL;
+    }
+    shimaore_history_free(context);
+    /* The media thread applies one of these two */
+    shimaore_config_free(context->published_config);
+    shimaore_config_free(context->retired_config);
+    context->published_config = context->config = context->retired_config = NULL;
+    shimaore_fec_free(context);
+    if (context->encode_scratch) {
+        shimaore_slab_free(context->encode_scratch, context->encode_scratch_capacity);
+        context->encode_scratch = NULL;
+    }
+
+    /* A pre-roll ring was carved out of the context's pool: do not let such pools grow through reuse */
+    if (context->socket && context->allocated_port && !context->preroll_ring) {
+        switch_mutex_lock(globals.mutex);
+        if (globals.free_context_count < SHIMAORE_CONTEXT_POOL_MAXIMUM) {
+            context->next_free = globals.free_contexts;
+            globals.free_contexts = context;
+            globals.free_context_count++;
+            context = NULL;
+        }
+        switch_mutex_unlock(globals.mutex);
+        if (!context) {
+            return;
+        }
+    }
+
+    if (context->socket) {
+        switch_socket_close(context->socket);
+    }
+    if (context->rtcp_socket) {
+        switch_socket_close(context->rtcp_socket);
+    }
+    shimaore_port_release(context->allocated_port);
+    switch_core_destroy_memory_pool(&pool);
+}
+
+/* Drop a reference; the last one releases the context (from the media, engine, NACK or report thread) */
+static void shimaore_context_put(shimaore_context_t *context) {
+    if (__atomic_sub_fetch(&context->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        shimaore_context_release(context);
+    }
+}
+
+static void shimaore_context_register(shimaore_context_t *context) {
+    switch_mutex_lock(globals.mutex);
+    switch_core_hash_insert(globals.taps, context->uuid, context);
+    switch_mutex_unlock(globals.mutex);
+}
+
+/* The tap registered as `uuid` (a channel UUID or `conference:<name>`), with a reference for the
+ * caller to put; NULL if there is none. A tap is unregistered before it is closed, so the one
+ * returned stays usable, if perhaps about to stop.
+ */
+static shimaore_context_t *shimaore_context_find(const char *uuid) {
+    shimaore_context_t *context;
+
+    switch_mutex_lock(globals.mutex);
+    if ((context = (shimaore_context_t *) switch_core_hash_find(globals.taps, uuid))) {
+        __atomic_add_fetch(&context->refs, 1, __ATOMIC_RELAXED);
+    }
+    switch_mutex_unlock(globals.mutex);
+    return context;
+}
+
+static void shimaore_context_unregister(shimaore_context_t *context) {
+    switch_mutex_lock(globals.mutex);
+    if (switch_core_hash_find(globals.taps, context->uuid) == context) {
+        switch_core_hash_delete(globals.taps, context->uuid);
+    }
+    switch_mutex_unlock(globals.mutex);
+}
+
+/*** Destinations ***/
+
+/* FNV-1a */
+static uint32_t shimaore_hash(const char *str) {
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h ^= (uint8_t) *str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Murmur3 finalizer, used to combine the UUID and destination hashes for rendezvous hashing */
+static uint32_t shimaore_hash_mix(uint32_t a, uint32_t b) {
+    uint32_t h = a ^ (b * 0x9e3779b1u);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static shimaore_destination_t *shimaore_destination_get(const char *ip, int port) {
+    shimaore_destination_t *destination;
+    switch_memory_pool_t *scratch = NULL;
+    switch_sockaddr_t *resolved;
+    char name[256];
+    char address[64];
+
+    switch_snprintf(name, sizeof(name), "%s:%d", ip, port);
+
+    switch_mutex_lock(globals.mutex);
+    destination = (shimaore_destination_t *) switch_core_hash_find(globals.destinations, name);
+    switch_mutex_unlock(globals.mutex);
+    if (destination) {
+        return destination;
+    }
+
+    /* Resolve without globals.mutex: a slow resolver must not hold up every other tap */
+    if (switch_core_new_memory_pool(&scratch) != SWITCH_STATUS_SUCCESS) {
+        return NULL;
+    }
+    /* Tap sockets are IPv4: so must be the destination a name resolves to */
+    if (switch_sockaddr_info_get(&resolved, ip, SWITCH_UNSPEC, port, 0, scratch) != SWITCH_STATUS_SUCCESS ||
+        switch_sockaddr_get_family(resolved) != AF_INET) {
+        switch_core_destroy_memory_pool(&scratch);
+        return NULL;
+    }
+    switch_get_addr(address, sizeof(address), resolved);
+    switch_core_destroy_memory_pool(&scratch);
+
+    switch_mutex_lock(globals.mutex);
+    /* Another tap may have added it meanwhile */
+    if ((destination = (shimaore_destination_t *) switch_core_hash_find(globals.destinations, name))) {
+        goto done;
+    }
+
+    destination = (shimaore_destination_t *) switch_core_alloc(globals.pool, sizeof(*destination));
+    /* Numeric from here on: no lookup under the lock */
+    if (switch_sockaddr_info_get(&destination->addr, address, AF_INET, port, 0, globals.pool) != SWITCH_STATUS_SUCCESS ||
+        switch_sockaddr_info_get(&destination->rtcp_addr, address, AF_INET, port + 1, 0, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        /* The few bytes already allocated stay in the module pool */
+        destination = NULL;
+        goto done;
+    }
+    destination->sockaddr.sin_family = AF_INET;
+    destination->sockaddr.sin_port = htons(port);
+    inet_pton(AF_INET, address, &destination->sockaddr.sin_addr);
+    destination->name = switch_core_strdup(globals.pool, name);
+    destination->hash = shimaore_hash(name);
+    switch_core_hash_insert(globals.destinations, destination->name, destination);
+
+ done:
+    switch_mutex_unlock(globals.mutex);
+    return destination;
+}
+
+/* Select a destination in the group of `config`, never `exclude`. Destinations that are held
+ * down are only considered when no healthy one is left.
+ */
+static shimaore_destination_t *shimaore_destination_select(shimaore_context_t *context, const shimaore_config_t *config,
+                                                           shimaore_destination_t *exclude) {
+    shimaore_destination_t *best = NULL;
+    uint32_t best_score = 0;
+    uint32_t best_load = 0;
+    switch_bool_t best_healthy = SWITCH_FALSE;
+    switch_time_t now = switch_micro_time_now();
+
+    for (uint32_t i = 0; i < config->destination_count; i++) {
+        shimaore_destination_t *candidate = config->destinations[i];
+        switch_bool_t healthy = candidate->down_until <= now;
+        uint32_t score = shimaore_hash_mix(context->uuid_hash, candidate->hash);
+        uint32_t load = switch_atomic_read(&candidate->active_taps);
+
+        if (candidate == exclude) {
+            continue;
+        }
+        if (best) {
+            if (best_healthy && !healthy) {
+                continue;
+            }
+            if (best_healthy == healthy) {
+                if (config->balance == SHIMAORE_BALANCE_LEAST && load != best_load) {
+                    if (load > best_load) {
+                        continue;
+                    }
+                } else if (score <= best_score) {
+                    continue;
+                }
+            }
+        }
+        best = candidate;
+        best_score = score;
+        best_load = load;
+        best_healthy = healthy;
+    }
+    return best;
+}
+
+static switch_status_t shimaore_destination_attach(shimaore_context_t *context, shimaore_destination_t *destination) {
+    /* Connecting an already connected UDP socket simply changes its peer */
+    if (switch_socket_connect(context->socket, destination->addr) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if (context->destination) {
+        switch_atomic_dec(&context->destination->active_taps);
+    }
+    switch_atomic_inc(&destination->active_taps);
+    context->destination = destination;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static void shimaore_destination_detach(shimaore_context_t *context) {
+    if (context->destination) {
+        switch_atomic_dec(&context->destination->active_taps);
+        context->destination = NULL;
+    }
+}
+
+static switch_status_t shimaore_send_start(shimaore_context_t *context);
+
+/* Update the health of the current destination after a send; on repeated errors, hold it
+ * down and move this tap to another member of its group, announcing itself with a fresh
+ * start packet.
+ */
+static void shimaore_destination_feedback(shimaore_context_t *context, switch_status_t outcome) {
+    shimaore_destination_t *current = context->destination;
+    shimaore_destination_t *next;
+
+    if (!current) {
+        return;
+    }
+
+    if (outcome == SWITCH_STATUS_SUCCESS) {
+        if (switch_atomic_read(&current->consecutive_errors)) {
+            switch_atomic_set(&current->consecutive_errors, 0);
+        }
+        return;
+    }
+
+    switch_atomic_inc(&current->consecutive_errors);
+    if (switch_atomic_read(&current->consecutive_errors) < SHIMAORE_DESTINATION_ERROR_THRESHOLD) {
+        return;
+    }
+
+    if (current->down_until <= switch_micro_time_now()) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "destination %s: holding down after %u errors\n",
+                          current->name, switch_atomic_read(&current->consecutive_errors));
+        current->down_until = switch_micro_time_now() + SHIMAORE_DESTINATION_HOLDDOWN;
+        switch_atomic_set(&current->consecutive_errors, 0);
+    }
+
+    if (!(next = shimaore_destination_select(context, context->config, current)) || next->down_until > switch_micro_time_now()) {
+        /* Nowhere better to go, stay */
+        return;
+    }
+
+    if (shimaore_destination_attach(context, next) == SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_NOTICE, "tap ssrc %u: failing over %s -> %s\n",
+                          context->rtp_ssrc, current->name, next->name);
+        shimaore_send_start(context);
+    }
+}
+
+/*** Latency ***/
+
+static inline switch_time_t shimaore_realtime_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (switch_time_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint32_t shimaore_histogram_bucket(uint64_t value) {
+    uint32_t shift;
+
+    if (value >= ((uint64_t) 1 << SHIMAORE_HISTOGRAM_MAXIMUM_BITS)) {
+        value = ((uint64_t) 1 << SHIMAORE_HISTOGRAM_MAXIMUM_BITS) - 1;
+    }
+    if (value < (1 << SHIMAORE_HISTOGRAM_SUB_BITS)) {
+        return (uint32_t) value;
+    }
+    shift = 63 - __builtin_clzll(value) - SHIMAORE_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << SHIMAORE_HISTOGRAM_SUB_BITS) | ((value >> shift) & ((1 << SHIMAORE_HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* Smallest value of a bucket */
+static inline uint64_t shimaore_histogram_value(uint32_t bucket) {
+    uint32_t sub = 1 << SHIMAORE_HISTOGRAM_SUB_BITS;
+
+    if (bucket < sub) {
+        return bucket;
+    }
+    return (uint64_t) (sub + bucket % sub) << (bucket / sub - 1);
+}
+
+static inline void shimaore_latency_record(shimaore_latency_t *latency, shimaore_latency_stage_t stage, switch_time_t from, switch_time_t to) {
+    uint64_t value = to > from ? (uint64_t) (to - from) : 0;
+
+    latency->counts[stage][shimaore_histogram_bucket(value)]++;
+    if (value > latency->maximum[stage]) {
+        latency->maximum[stage] = value > UINT32_MAX ? UINT32_MAX : (uint32_t) value;
+    }
+}
+
+static uint32_t shimaore_latency_count(const shimaore_latency_t *latency, shimaore_latency_stage_t stage) {
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < SHIMAORE_HISTOGRAM_BUCKETS; i++) {
+        total += latency->counts[stage][i];
+    }
+    return total;
+}
+
+/* Lower bound of the bucket holding the `percent` percentile */
+static uint64_t shimaore_latency_percentile(const shimaore_latency_t *latency, shimaore_latency_stage_t stage, uint32_t total, uint32_t percent) {
+    uint64_t rank = ((uint64_t) total * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < SHIMAORE_HISTOGRAM_BUCKETS; i++) {
+        seen += latency->counts[stage][i];
+        if (seen >= rank && seen > 0) {
+            return shimaore_histogram_value(i);
+        }
+    }
+    return 0;
+}
+
+static const char *shimaore_latency_names[SHIMAORE_LATENCY_STAGES] = { "buffered", "prepare", "syscall", "kernel" };
+
+/* Framing ops call this right before their send syscall */
+static inline void shimaore_latency_send_before(shimaore_context_t *context) {
+    if (context->latency) {
+        context->latency->send_before = switch_time_ref();
+    }
+}
+
+/* Every send on the socket takes a kernel timestamp id, whether or not we wait for it */
+static inline uint32_t shimaore_latency_tx_id(shimaore_context_t *context) {
+    if (!context->latency || !context->latency->kernel) {
+        return 0;
+    }
+    return __atomic_fetch_add(&context->latency->tx_id, 1, __ATOMIC_RELAXED);
+}
+
+/* Switch kernel TX timestamps (software, reported on the socket's error queue) on or off */
+static switch_status_t shimaore_latency_kernel(shimaore_context_t *context, switch_bool_t on) {
+#ifdef SO_TIMESTAMPING
+    int flags = on ? SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY : 0;
+
+    if (setsockopt(context->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+    return SWITCH_STATUS_SUCCESS;
+#else
+    return on ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+#endif
+}
+
+static void shimaore_zerocopy_completed(shimaore_context_t *context, uint32_t from, uint32_t to, switch_bool_t copied);
+
+/* Consume the socket's error queue: kernel TX timestamps and zero-copy completions. Non-blocking. */
+static void shimaore_errqueue_drain(shimaore_context_t *context) {
+#ifdef __linux__
+    shimaore_latency_t *latency = context->latency;
+
+    for (int i = 0; i < SHIMAORE_LATENCY_TX_PENDING + SHIMAORE_ZEROCOPY_BUFFERS; i++) {
+        char control[256];
+        struct msghdr msg = { 0 };
+        struct cmsghdr *cmsg;
+        struct scm_timestamping *timestamps = NULL;
+        struct sock_extended_err *error = NULL;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(context->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                timestamps = (struct scm_timestamping *) CMSG_DATA(cmsg);
+            } else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                       (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                error = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            }
+        }
+        if (!error) {
+            continue;
+        }
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+        if (error->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+            shimaore_zerocopy_completed(context, error->ee_info, error->ee_data, (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+            continue;
+        }
+#endif
+        if (!latency || !timestamps || error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING) {
+            continue;
+        }
+        {
+            uint32_t slot = error->ee_data % SHIMAORE_LATENCY_TX_PENDING;
+            switch_time_t at = (switch_time_t) timestamps->ts[0].tv_sec * 1000000 + timestamps->ts[0].tv_nsec / 1000;
+
+            if (latency->tx[slot].id == error->ee_data && latency->tx[slot].sent) {
+                shimaore_latency_record(latency, SHIMAORE_LATENCY_KERNEL, latency->tx[slot].sent, at);
+                latency->tx[slot].sent = 0;
+            }
+        }
+    }
+#endif
+}
+
+/* Media thread, around the send of a bunch */
+static void shimaore_latency_sent(shimaore_context_t *context, uint32_t tx_id) {
+    shimaore_latency_t *latency = context->latency;
+    switch_time_t now = switch_time_ref();
+
+    shimaore_latency_record(latency, SHIMAORE_LATENCY_BUFFERED, latency->bunch_read, latency->bunch_complete);
+    shimaore_latency_record(latency, SHIMAORE_LATENCY_PREPARE, latency->bunch_complete, latency->send_before);
+    shimaore_latency_record(latency, SHIMAORE_LATENCY_SYSCALL, latency->send_before, now);
+
+    if (latency->kernel) {
+        uint32_t slot = tx_id % SHIMAORE_LATENCY_TX_PENDING;
+
+        latency->tx[slot].id = tx_id;
+        latency->tx[slot].sent = shimaore_realtime_now();
+        shimaore_errqueue_drain(context);
+    }
+}
+
+/*** Zero-copy ***/
+
+/* Switch SO_ZEROCOPY on and set up the buffer pool; without kernel support the tap copies as before */
+static switch_status_t shimaore_zerocopy_enable(shimaore_context_t *context) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int on = 1;
+
+    if (context->zerocopy) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (setsockopt(context->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if (!(context->zerocopy = (shimaore_zerocopy_t *) shimaore_slab_alloc(sizeof(*context->zerocopy)))) {
+        return SWITCH_STATUS_FALSE;
+    }
+    memset(context->zerocopy, 0, sizeof(*context->zerocopy));
+    return SWITCH_STATUS_SUCCESS;
+#else
+    return SWITCH_STATUS_FALSE;
+#endif
+}
+
+/* Sends `from` to `to` (inclusive, modulo 2^32) are done with their buffers */
+static void shimaore_zerocopy_completed(shimaore_context_t *context, uint32_t from, uint32_t to, switch_bool_t copied) {
+    shimaore_zerocopy_t *zerocopy = context->zerocopy;
+
+    /* Left over by the socket's previous tap */
+    if (!zerocopy) {
+        return;
+    }
+    for (int i = 0; i < SHIMAORE_ZEROCOPY_BUFFERS; i++) {
+        if (zerocopy->buffers[i].busy && zerocopy->buffers[i].id - from <= to - from) {
+            zerocopy->buffers[i].busy = SWITCH_FALSE;
+            zerocopy->pending--;
+        }
+    }
+    if (copied) {
+        zerocopy->copied += to - from + 1;
+        zerocopy->disabled = SWITCH_TRUE;
+    }
+}
+
+/* Send a bunch with MSG_ZEROCOPY and swap the now pinned bunch buffer for an idle one of the
+ * pool. A copying send is used instead when no buffer is idle or the kernel refuses (ENOBUFS:
+ * the socket's option memory, which tracks pinned pages, is exhausted).
+ */
+static switch_status_t shimaore_zerocopy_send(shimaore_context_t *context, const struct iovec *iov, int iovcnt) {
+#ifdef MSG_ZEROCOPY
+    shimaore_zerocopy_t *zerocopy = context->zerocopy;
+    struct msghdr msg = { 0 };
+    int spare = -1;
+
+    if (zerocopy->pending) {
+        shimaore_errqueue_drain(context);
+    }
+    for (int i = 0; i < SHIMAORE_ZEROCOPY_BUFFERS && spare < 0; i++) {
+        if (!zerocopy->buffers[i].busy) {
+            spare = i;
+        }
+    }
+    if (spare >= 0 && zerocopy->buffers[spare].object && zerocopy->buffers[spare].capacity != context->buncher_capacity) {
+        /* The bunch buffer was resized since */
+        shimaore_slab_free(zerocopy->buffers[spare].object, SHIMAORE_HEADROOM + zerocopy->buffers[spare].capacity);
+        zerocopy->buffers[spare].object = NULL;
+    }
+    if (spare >= 0 && !zerocopy->buffers[spare].object &&
+        (zerocopy->buffers[spare].object = (uint8_t *) shimaore_slab_alloc(SHIMAORE_HEADROOM + context->buncher_capacity))) {
+        zerocopy->buffers[spare].capacity = context->buncher_capacity;
+    }
+    if (spare < 0 || !zerocopy->buffers[spare].object) {
+        zerocopy->fallbacks++;
+        return writev(context->fd, iov, iovcnt) < 0 ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+    }
+
+    msg.msg_iov = (struct iovec *) iov;
+    msg.msg_iovlen = iovcnt;
+    if (sendmsg(context->fd, &msg, MSG_ZEROCOPY) < 0) {
+        if (errno != ENOBUFS) {
+            return SWITCH_STATUS_FALSE;
+        }
+        zerocopy->fallbacks++;
+        return writev(context->fd, iov, iovcnt) < 0 ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+    }
+
+    {
+        uint8_t *sent = context->buncher_buffer - SHIMAORE_HEADROOM;
+
+        context->buncher_buffer = zerocopy->buffers[spare].object + SHIMAORE_HEADROOM;
+        zerocopy->buffers[spare].object = sent;
+        zerocopy->buffers[spare].id = context->zerocopy_id++;
+        zerocopy->buffers[spare].busy = SWITCH_TRUE;
+        zerocopy->pending++;
+        zerocopy->sent++;
+    }
+    return SWITCH_STATUS_SUCCESS;
+#else
+    return writev(context->fd, iov, iovcnt) < 0 ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+#endif
+}
+
+/* Closing tap: give the kernel a moment to return the buffers still pinned */
+static void shimaore_zerocopy_flush(shimaore_context_t *context) {
+    struct pollfd pfd = { context->fd, 0, 0 };
+
+    for (int waited = 0; context->zerocopy->pending && waited < SHIMAORE_ZEROCOPY_CLOSE_WAIT_MS; waited += 5) {
+        /* POLLERR is always reported: the error queue is not empty */
+        poll(&pfd, 1, 5);
+        shimaore_errqueue_drain(context);
+    }
+}
+
+/*** Forward error correction ***/
+
+static shimaore_engine_slot_t *shimaore_engine_slot_get(shimaore_engine_t *engine);
+static void shimaore_engine_push(shimaore_engine_t *engine, shimaore_engine_slot_t *slot);
+
+static switch_status_t shimaore_fec_alloc(shimaore_context_t *context, shimaore_fec_t fec, uint32_t group) {
+    uint32_t capacity = fec == SHIMAORE_FEC_PARITY ? SHIMAORE_FEC_PACKET_MAXIMUM : SHIMAORE_RED_BLOCK_MAXIMUM;
+    shimaore_fec_state_t *state;
+
+    context->fec = fec;
+    context->fec_group = group;
+    if (fec == SHIMAORE_FEC_OFF) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!(state = (shimaore_fec_state_t *) shimaore_slab_alloc(shimaore_fec_bytes(fec, capacity)))) {
+        return SWITCH_STATUS_FALSE;
+    }
+    memset(state, 0, shimaore_fec_bytes(fec, capacity));
+    state->fec = fec;
+    state->capacity = capacity;
+    state->data = state->buffers;
+    if (fec == SHIMAORE_FEC_PARITY) {
+        state->spare = state->buffers + capacity;
+    }
+    /* The first group starts with the first bunch */
+    state->first = (uint16_t) (context->rtp_sequence_number + 1);
+    context->fec_state = state;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Whether `fec` does anything for bunches of `frames` frames: a redundant block is attached only up
+ * to SHIMAORE_RED_BLOCK_MAXIMUM bytes, and parity covers packets up to SHIMAORE_FEC_PACKET_MAXIMUM.
+ * Judged on the largest payload the framing may produce; a conference's frames are only known once
+ * it writes. Errors are reported on `stream`.
+ */
+static switch_status_t shimaore_fec_check(shimaore_context_t *context, shimaore_fec_t fec, uint32_t frames,
+                                          switch_stream_handle_t *stream) {
+    uint32_t payload = frames * context->frame_bytes;
+
+    if (fec == SHIMAORE_FEC_OFF || context->frame_bytes == 0) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (context->framing == SHIMAORE_FRAMING_FEATURES && context->features) {
+        payload = shimaore_features_size(context->features, payload / 2);
+    }
+    if (fec == SHIMAORE_FEC_RED && payload > SHIMAORE_RED_BLOCK_MAXIMUM) {
+        stream->write_function(stream, "-ERR fec=red attaches at most %d bytes, bunches take up to %u: lower frames_per_packet!\n",
+                               SHIMAORE_RED_BLOCK_MAXIMUM, payload);
+        return SWITCH_STATUS_FALSE;
+    }
+    if (fec == SHIMAORE_FEC_PARITY && context->rtp_template.length + payload > SHIMAORE_FEC_PACKET_MAXIMUM) {
+        stream->write_function(stream, "-ERR fec=parity covers packets of at most %d bytes, bunches take up to %u: lower frames_per_packet!\n",
+                               SHIMAORE_FEC_PACKET_MAXIMUM, context->rtp_template.length + payload);
+        return SWITCH_STATUS_FALSE;
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Send the parity packet of the group from `first`, behind the bunches queued on the send engine
+ * when it has room for it, directly otherwise. Without the state's lock: `data` is the spare buffer.
+ */
+static void shimaore_parity_send(shimaore_context_t *context, uint16_t first, uint16_t mask, uint16_t length_xor,
+                                 uint32_t timestamp, const uint8_t *data, uint32_t length) {
+    shimaore_engine_t *engine = context->engine;
+    shimaore_engine_slot_t *slot;
+    uint8_t header[SHIMAORE_RTP_HEADER_SIZE + SHIMAORE_PARITY_HEADER_SIZE];
+    uint32_t total = sizeof(header) + length;
+
+    shimaore_rtp_control_write(&context->rtp_template, header, (uint16_t) (first + context->fec_group), timestamp,
+                               SHIMAORE_PT_PARITY);
+    shimaore_parity_write(header + SHIMAORE_RTP_HEADER_SIZE, first, mask, length_xor);
+
+    if (engine && engine->running && total <= engine->slot_size && (slot = shimaore_engine_slot_get(engine))) {
+        memcpy(slot->data, header, sizeof(header));
+        memcpy(slot->data + sizeof(header), data, length);
+        slot->length = total;
+        slot->payload = 0;
+        slot->context = context;
+        slot->address = NULL;
+        __atomic_add_fetch(&context->refs, 1, __ATOMIC_RELAXED);
+        shimaore_engine_push(engine, slot);
+        __atomic_add_fetch(&engine->queued, 1, __ATOMIC_RELAXED);
+    } else {
+        struct iovec iov[2] = { { header, sizeof(header) }, { (void *) data, length } };
+
+        if (writev(context->fd, iov, 2) < 0) {
+            return;
+        }
+    }
+    __atomic_add_fetch(&context->fec_state->parity_sent, 1, __ATOMIC_RELAXED);
+}
+
+/* Any thread sending a bunch of the tap: add the RTP packet in `iov` to its group. The media
+ * thread leaves the sequence number after each group free for the parity packet, so a bunch's
+ * group follows from its sequence number; groups that a bunch skips past are given up.
+ */
+static void shimaore_parity_add(shimaore_context_t *context, const struct iovec *iov, int iovcnt) {
+    shimaore_fec_state_t *state = context->fec_state;
+    const uint8_t *header = (const uint8_t *) iov[0].iov_base;
+    uint16_t sequence_number = (uint16_t) (header[2] << 8 | header[3]);
+    uint32_t span = context->fec_group + 1;
+    uint32_t length = 0;
+    uint16_t position;
+    /* A completed group, sent once unlocked */
+    uint8_t *sending = NULL;
+    uint16_t first = 0;
+    uint16_t mask = 0;
+    uint16_t length_xor = 0;
+    uint32_t timestamp = 0;
+    uint32_t sending_length = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        length += iov[i].iov_len;
+    }
+    shimaore_spin_lock(&state->lock);
+    position = (uint16_t) (sequence_number - state->first);
+    /* Older than the group: too late */
+    if (position >= 32768) {
+        goto done;
+    }
+    if (position >= span) {
+        if (state->mask) {
+            state->groups_incomplete++;
+        }
+        state->first += position / span * span;
+        position %= span;
+        memset(state->data, 0, state->length);
+        state->mask = 0;
+        state->length_xor = 0;
+        state->length = 0;
+    }
+    if (position == context->fec_group || (state->mask & 1u << position) || length > state->capacity) {
+        goto done;
+    }
+
+    for (int i = 0, at = 0; i < iovcnt; at += iov[i].iov_len, i++) {
+        shimaore_xor(state->data + at, (const uint8_t *) iov[i].iov_base, iov[i].iov_len);
+    }
+    if (length > state->length) {
+        state->length = length;
+    }
+    state->length_xor ^= (uint16_t) length;
+    state->mask |= 1u << position;
+    memcpy(&state->timestamp, header + 4, sizeof(state->timestamp));
+    state->timestamp = ntohl(state->timestamp);
+
+    if (state->mask == (1u << context->fec_group) - 1) {
+        if (state->spare) {
+            sending = state->data;
+            first = state->first;
+            mask = state->mask;
+            length_xor = state->length_xor;
+            timestamp = state->timestamp;
+            sending_length = state->length;
+            state->data = state->spare;
+            state->spare = NULL;
+        } else {
+            /* Another thread is still sending the previous group's packet */
+            state->groups_incomplete++;
+            memset(state->data, 0, state->length);
+        }
+        state->first += span;
+        state->mask = 0;
+        state->length_xor = 0;
+        state->length = 0;
+    }
+ done:
+    shimaore_spin_unlock(&state->lock);
+
+    if (sending) {
+        shimaore_parity_send(context, first, mask, length_xor, timestamp, sending, sending_length);
+        memset(sending, 0, sending_length);
+        shimaore_spin_lock(&state->lock);
+        state->spare = sending;
+        shimaore_spin_unlock(&state->lock);
+    }
+}
+
+/* Encoding thread: turn the payload of the bunch at `packet` (`length` bytes at `payload`, which
+ * may be `to` itself) into an RFC 2198 payload at `to`, the previous bunch's payload first when it
+ * is short enough and immediately precedes. Returns the length, 0 when it does not fit.
+ */
+static uint32_t shimaore_red_encode(shimaore_context_t *context, uint8_t *packet, const uint8_t *payload, uint32_t length,
+                                    uint8_t *to, uint32_t capacity) {
+    shimaore_fec_state_t *state = context->fec_state;
+    uint16_t sequence_number = (uint16_t) (packet[2] << 8 | packet[3]);
+    uint32_t timestamp;
+    uint32_t offset;
+    uint32_t redundant;
+    uint8_t payload_type = packet[1] & 0x7f;
+
+    memcpy(&timestamp, packet + 4, sizeof(timestamp));
+    timestamp = ntohl(timestamp);
+    offset = timestamp - state->timestamp;
+    redundant = state->length > 0 && (uint16_t) (state->sequence_number + 1) == sequence_number &&
+        offset <= SHIMAORE_RED_OFFSET_MAXIMUM ? state->length : 0;
+    if (redundant && SHIMAORE_RED_HEADER_SIZE + redundant + 1 + length > capacity) {
+        redundant = 0;
+    }
+    if (1 + length > capacity) {
+        return 0;
+    }
+
+    /* Headers, the redundant block, then the primary one */
+    memmove(to + (redundant ? SHIMAORE_RED_HEADER_SIZE + redundant : 0) + 1, payload, length);
+    if (redundant) {
+        to[0] = 0x80 | state->payload_type;
+        to[1] = (uint8_t) (offset >> 6);
+        to[2] = (uint8_t) ((offset & 0x3f) << 2 | redundant >> 8);
+        to[3] = (uint8_t) redundant;
+        to[SHIMAORE_RED_HEADER_SIZE] = payload_type;
+        memcpy(to + SHIMAORE_RED_HEADER_SIZE + 1, state->data, redundant);
+        state->redundant++;
+    } else {
+        to[0] = payload_type;
+    }
+    packet[1] = (packet[1] & 0x80) | SHIMAORE_PT_RED;
+
+    state->length = length <= state->capacity ? length : 0;
+    memcpy(state->data, to + (redundant ? SHIMAORE_RED_HEADER_SIZE + redundant : 0) + 1, state->length);
+    state->sequence_number = sequence_number;
+    state->timestamp = timestamp;
+    state->payload_type = payload_type;
+    return (redundant ? SHIMAORE_RED_HEADER_SIZE + redundant : 0) + 1 + length;
+}
+
+/* Encoding thread: the framing's encoder, then the redundancy of `fec=red`; 0 to send the packet
+ * as it stands (see shimaore_framing_ops_t)
+ */
+static uint32_t shimaore_encode(shimaore_context_t *context, uint8_t *packet, uint32_t header_length, uint32_t length,
+                                uint8_t *to, uint32_t capacity) {
+    uint32_t encoded = context->framing_ops->encode ?
+        context->framing_ops->encode(context, packet, header_length, length, to, capacity) : 0;
+    uint32_t red;
+
+    if (context->fec != SHIMAORE_FEC_RED) {
+        return encoded;
+    }
+    red = shimaore_red_encode(context, packet, encoded ? to : packet + header_length, encoded ? encoded : length, to, capacity);
+    return red ? red : encoded;
+}
+
+/* Largest payload shimaore_encode may write for `length` bytes of audio */
+static uint32_t shimaore_encode_bound(shimaore_context_t *context, uint32_t length) {
+    /* shimaore_lossless_encode gives up rather than exceed the audio, which then goes out as L16 */
+    uint32_t bound = length;
+
+    /* Short bunches may carry more features than audio */
+    if (context->framing == SHIMAORE_FRAMING_FEATURES && context->features) {
+        uint32_t size = shimaore_features_size(context->features, length / 2);
+        if (size > bound) {
+            bound = size;
+        }
+    }
+    if (context->fec == SHIMAORE_FEC_RED) {
+        bound += SHIMAORE_RED_HEADER_SIZE + 1 + SHIMAORE_RED_BLOCK_MAXIMUM;
+    }
+    return bound;
+}
+
+/* Any thread that sent or queued a bunch of the tap: what `nack=` and `fec=parity` keep of it */
+static void shimaore_bunch_protect(shimaore_context_t *context, const struct iovec *iov, int iovcnt) {
+    if (context->history) {
+        shimaore_history_record(context, iov, iovcnt);
+    }
+    if (context->fec == SHIMAORE_FEC_PARITY) {
+        shimaore_parity_add(context, iov, iovcnt);
+    }
+}
+
+/*** Send engine ***/
+
+/* Pop a free slot, NULL when the pool is exhausted. Any thread. */
+static shimaore_engine_slot_t *shimaore_engine_slot_get(shimaore_engine_t *engine) {
+    uint64_t head = __atomic_load_n(&engine->free_head, __ATOMIC_ACQUIRE);
+    uint64_t next;
+    uint32_t index;
+
+    do {
+        if (!(index = (uint32_t) head)) {
+            return NULL;
+        }
+        /* Stale when another thread won the race; the tag makes the exchange fail then */
+        next = (((head >> 32) + 1) << 32) | __atomic_load_n(&engine->free_next[index - 1], __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&engine->free_head, &head, next, SWITCH_TRUE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return &engine->slots[index - 1];
+}
+
+static void shimaore_engine_slot_put(shimaore_engine_t *engine, shimaore_engine_slot_t *slot) {
+    uint64_t head = __atomic_load_n(&engine->free_head, __ATOMIC_RELAXED);
+    uint64_t next;
+
+    do {
+        __atomic_store_n(&engine->free_next[slot->index], (uint32_t) head, __ATOMIC_RELAXED);
+        next = (((head >> 32) + 1) << 32) | (slot->index + 1);
+    } while (!__atomic_compare_exchange_n(&engine->free_head, &head, next, SWITCH_TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Queue a slot for the engine thread. Any thread, wait-free. */
+static void shimaore_engine_push(shimaore_engine_t *engine, shimaore_engine_slot_t *slot) {
+    shimaore_engine_slot_t *previous;
+
+    __atomic_store_n(&slot->next, NULL, __ATOMIC_RELAXED);
+    previous = __atomic_exchange_n(&engine->head, slot, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&previous->next, slot, __ATOMIC_RELEASE);
+}
+
+/* Engine thread only. NULL when the queue is empty, or when a producer is half-way through a push. */
+static shimaore_engine_slot_t *shimaore_engine_pop(shimaore_engine_t *engine) {
+    shimaore_engine_slot_t *tail = engine->tail;
+    shimaore_engine_slot_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &engine->stub) {
+        if (!next) {
+            return NULL;
+        }
+        engine->tail = tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        engine->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&engine->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    /* Last element: put the stub behind it so that it can be detached */
+    shimaore_engine_push(engine, &engine->stub);
+    if ((next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE))) {
+        engine->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/* Engine thread: the next queued slot, its bunch encoded in place when the framing has an encoder
+ * or `fec=red` adds redundancy, and kept for `nack=` and `fec=parity`
+ */
+static shimaore_engine_slot_t *shimaore_engine_next(shimaore_engine_t *engine) {
+    shimaore_engine_slot_t *slot = shimaore_engine_pop(engine);
+    uint32_t header_length;
+    uint32_t length;
+
+    if (!slot || !slot->payload) {
+        return slot;
+    }
+    if (slot->context->framing_ops->encode || slot->context->fec == SHIMAORE_FEC_RED) {
+        header_length = slot->length - slot->payload;
+        length = shimaore_encode(slot->context, slot->data, header_length, slot->payload, engine->scratch,
+                                 engine->slot_size - header_length);
+        if (length > 0) {
+            memcpy(slot->data + header_length, engine->scratch, length);
+            slot->length = header_length + length;
+        }
+    }
+    if (slot->context->history || slot->context->fec == SHIMAORE_FEC_PARITY) {
+        struct iovec iov = { slot->data, slot->length };
+
+        /* A parity packet is queued behind its group's last bunch */
+        shimaore_bunch_protect(slot->context, &iov, 1);
+    }
+    return slot;
+}
+
+/* Without send engine: encode on the media thread and send header and payload together */
+static switch_status_t shimaore_transmit_encoded(shimaore_context_t *context, uint8_t *packet, uint32_t header_length, uint32_t length) {
+    uint32_t largest = context->config->buncher_maximum * context->frame_bytes;
+    uint32_t capacity = shimaore_encode_bound(context, length > largest ? length : largest);
+    struct iovec iov[2];
+    ssize_t sent;
+
+    /* Grown once per tap, for its largest bunch */
+    if (capacity > context->encode_scratch_capacity) {
+        uint8_t *scratch = (uint8_t *) shimaore_slab_alloc(capacity);
+
+        if (scratch) {
+            shimaore_slab_free(context->encode_scratch, context->encode_scratch_capacity);
+            context->encode_scratch = scratch;
+            context->encode_scratch_capacity = capacity;
+        } else if (!context->encode_scratch_warned) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "tap ssrc %u: no buffer for %u encoded bytes, sending audio as is\n",
+                              context->rtp_ssrc, capacity);
+            context->encode_scratch_warned = SWITCH_TRUE;
+        }
+    }
+
+    iov[0].iov_base = packet;
+    iov[0].iov_len = header_length;
+    iov[1].iov_base = context->encode_scratch;
+    if (!context->encode_scratch ||
+        !(iov[1].iov_len = shimaore_encode(context, packet, header_length, length, context->encode_scratch,
+                                           context->encode_scratch_capacity))) {
+        iov[1].iov_base = packet + header_length;
+        iov[1].iov_len = length;
+    }
+    sent = writev(context->fd, iov, 2);
+    shimaore_bunch_protect(context, iov, 2);
+    return sent < 0 ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+}
+
+/* Send one packet on the tap's socket: through the send engine when it is running and has a
+ * slot for it, directly otherwise (zero-copy for large enough bunches). `payload` is the audio length for bunches, 0 for signalling.
+ * A packet sent directly may overtake packets still queued; receivers reorder by sequence number.
+ */
+static switch_status_t shimaore_transmit(shimaore_context_t *context, const struct iovec *iov, int iovcnt, uint32_t payload) {
+    shimaore_engine_t *engine = context->engine;
+    shimaore_engine_slot_t *slot;
+    uint32_t length = 0;
+    /* Bunches to encode come as one buffer: header then audio */
+    switch_bool_t encode = payload && (context->framing_ops->encode || context->fec == SHIMAORE_FEC_RED);
+    switch_status_t outcome;
+
+    context->send_pending = SWITCH_FALSE;
+    if (!engine || !engine->running) {
+        if (encode) {
+            return shimaore_transmit_encoded(context, iov[0].iov_base, iov[0].iov_len - payload, payload);
+        }
+        if (payload && context->zerocopy && !context->zerocopy->disabled && payload >= globals.zerocopy_threshold) {
+            outcome = shimaore_zerocopy_send(context, iov, iovcnt);
+        } else {
+            outcome = writev(context->fd, iov, iovcnt) < 0 ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+        }
+        if (payload) {
+            shimaore_bunch_protect(context, iov, iovcnt);
+        }
+        return outcome;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        length += iov[i].iov_len;
+    }
+    /* Too large for a slot before coding; lossless coding is stateless, so the media thread may do it */
+    if (length > engine->slot_size && context->framing == SHIMAORE_FRAMING_LOSSLESS && context->fec != SHIMAORE_FEC_RED) {
+        __atomic_add_fetch(&engine->fallbacks, 1, __ATOMIC_RELAXED);
+        return shimaore_transmit_encoded(context, iov[0].iov_base, iov[0].iov_len - payload, payload);
+    }
+    if (length > engine->slot_size || !(slot = shimaore_engine_slot_get(engine))) {
+        if (encode) {
+            /* Accounted as sent by the engine, i.e. not at all: no failover for a full pool */
+            __atomic_add_fetch(&engine->dropped, 1, __ATOMIC_RELAXED);
+            context->send_pending = SWITCH_TRUE;
+            return SWITCH_STATUS_SUCCESS;
+        }
+        __atomic_add_fetch(&engine->fallbacks, 1, __ATOMIC_RELAXED);
+        outcome = writev(context->fd, iov, iovcnt) < 0 ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+        if (payload) {
+            shimaore_bunch_protect(context, iov, iovcnt);
+        }
+        return outcome;
+    }
+
+    for (int i = 0, at = 0; i < iovcnt; at += iov[i].iov_len, i++) {
+        memcpy(slot->data + at, iov[i].iov_base, iov[i].iov_len);
+    }
+    slot->length = length;
+    slot->payload = payload;
+    slot->context = context;
+    /* Receivers tell plain streams apart by source port only; NACKs come back to the source, sender
+     * reports and parity packets leave from it, and an allocated port is the tap's own to keep
+     */
+    slot->address = engine->mode == SHIMAORE_ENGINE_TICK && engine->tick_shared && context->framing != SHIMAORE_FRAMING_PLAIN &&
+        !context->history && context->fec != SHIMAORE_FEC_PARITY && context->rtcp == SHIMAORE_RTCP_OFF && !context->allocated_port ?
+        &context->destination->sockaddr : NULL;
+    /* Released by the engine thread on completion */
+    __atomic_add_fetch(&context->refs, 1, __ATOMIC_RELAXED);
+    shimaore_engine_push(engine, slot);
+    __atomic_add_fetch(&engine->queued, 1, __ATOMIC_RELAXED);
+    context->send_pending = SWITCH_TRUE;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Media thread: destination health from the completions of queued bunches seen since last time */
+static void shimaore_engine_feedback(shimaore_context_t *context) {
+    uint32_t failures = __atomic_exchange_n(&context->async_failures, 0, __ATOMIC_RELAXED);
+    uint32_t successes = __atomic_exchange_n(&context->async_successes, 0, __ATOMIC_RELAXED);
+
+    if (failures) {
+        for (uint32_t i = 0; i < failures && i < SHIMAORE_DESTINATION_ERROR_THRESHOLD; i++) {
+            shimaore_destination_feedback(context, SWITCH_STATUS_FALSE);
+        }
+    } else if (successes) {
+        shimaore_destination_feedback(context, SWITCH_STATUS_SUCCESS);
+    }
+}
+
+/* Engine thread: account for a finished send and recycle its slot */
+static void shimaore_engine_complete(shimaore_engine_t *engine, shimaore_engine_slot_t *slot, switch_bool_t ok) {
+    shimaore_context_t *context = slot->context;
+
+    if (ok) {
+        if (slot->payload) {
+            __atomic_add_fetch(&context->sent_successful, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&context->sent_octets, slot->payload, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&context->async_successes, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&engine->completed, 1, __ATOMIC_RELAXED);
+    } else {
+        if (slot->payload) {
+            __atomic_add_fetch(&context->async_failures, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&engine->failed, 1, __ATOMIC_RELAXED);
+    }
+    slot->context = NULL;
+    shimaore_engine_slot_put(engine, slot);
+    shimaore_context_put(context);
+}
+
+/* Engine thread, on start */
+static void shimaore_engine_pin(shimaore_engine_t *engine) {
+    if (engine->cpu >= 0 && switch_core_thread_set_cpu_affinity(engine->cpu) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "send engine %u: cannot pin to cpu %d\n", engine->index, engine->cpu);
+    }
+}
+
+/* Map the slot region and fill the free stack; the queue starts empty */
+static switch_status_t shimaore_engine_slots_init(shimaore_engine_t *engine) {
+    size_t size = (size_t) engine->slot_count * engine->slot_size;
+
+    if ((engine->memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        engine->memory = NULL;
+        return SWITCH_STATUS_FALSE;
+    }
+    engine->slots = (shimaore_engine_slot_t *) switch_core_alloc(globals.pool, engine->slot_count * sizeof(*engine->slots));
+    engine->free_next = (uint32_t *) switch_core_alloc(globals.pool, engine->slot_count * sizeof(*engine->free_next));
+    engine->scratch = (uint8_t *) switch_core_alloc(globals.pool, engine->slot_size);
+    for (uint32_t i = 0; i < engine->slot_count; i++) {
+        engine->slots[i].index = i;
+        engine->slots[i].data = engine->memory + (size_t) i * engine->slot_size;
+        /* Each slot links to the one below it */
+        engine->free_next[i] = i;
+    }
+    engine->free_head = engine->slot_count;
+    engine->stub.next = NULL;
+    engine->head = engine->tail = &engine->stub;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*** Tick engine ***/
+
+/* Send the messages prepared for this tick, in as few sendmmsg calls as the kernel takes them */
+static void shimaore_engine_tick_send(shimaore_engine_t *engine, uint32_t messages) {
+    uint32_t done = 0;
+
+    while (done < messages) {
+        int sent = sendmmsg(engine->tick_fd, engine->tick_messages + done, messages - done, 0);
+
+        engine->tick_syscalls++;
+        if (sent <= 0) {
+            /* The first message failed; the others get their chance */
+            engine->tick_messages[done].msg_len = (unsigned int) -1;
+            sent = 1;
+        }
+        done += sent;
+    }
+
+    for (uint32_t m = 0, s = 0; m < messages; m++) {
+        uint32_t count = engine->tick_messages[m].msg_hdr.msg_iovlen;
+        switch_bool_t ok = engine->tick_messages[m].msg_len != (unsigned int) -1;
+
+        for (uint32_t i = 0; i < count; i++, s++) {
+            shimaore_engine_complete(engine, engine->tick_batch[s], ok);
+        }
+    }
+}
+
+/* Flush every slot queued since the last tick. RTP taps go out on the engine's socket, runs of
+ * same-size packets to the same destination as one UDP GSO message when they fit the MTU; plain
+ * taps, which receivers tell apart by source port, keep their own socket.
+ */
+static void shimaore_engine_tick_flush(shimaore_engine_t *engine) {
+    shimaore_engine_slot_t *slot;
+    uint32_t messages = 0;
+    uint32_t slots = 0;
+
+    while ((slot = shimaore_engine_next(engine))) {
+        struct msghdr *message;
+
+        if (!slot->address) {
+            shimaore_engine_complete(engine, slot, send(slot->context->fd, slot->data, slot->length, 0) >= 0);
+            continue;
+        }
+
+        engine->tick_batch[slots] = slot;
+        engine->tick_iov[slots].iov_base = slot->data;
+        engine->tick_iov[slots].iov_len = slot->length;
+
+        message = messages ? &engine->tick_messages[messages - 1].msg_hdr : NULL;
+        if (message && engine->gso && slot->address == message->msg_name &&
+            slot->length == engine->tick_batch[slots - 1]->length && slot->length <= SHIMAORE_ENGINE_GSO_SEGMENT_MAXIMUM &&
+            message->msg_iovlen < SHIMAORE_ENGINE_GSO_SEGMENTS &&
+            (message->msg_iovlen + 1) * slot->length <= SHIMAORE_ENGINE_GSO_MAXIMUM) {
+            /* One more segment of the previous message */
+#ifdef UDP_SEGMENT
+            if (message->msg_iovlen++ == 1) {
+                struct cmsghdr *cmsg;
+
+                message->msg_control = engine->tick_control[messages - 1];
+                message->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsg = CMSG_FIRSTHDR(message);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t *) CMSG_DATA(cmsg) = (uint16_t) slot->length;
+                engine->tick_gso++;
+            }
+#endif
+        } else {
+            memset(&engine->tick_messages[messages], 0, sizeof(engine->tick_messages[messages]));
+            message = &engine->tick_messages[messages++].msg_hdr;
+            message->msg_name = (void *) slot->address;
+            message->msg_namelen = sizeof(*slot->address);
+            message->msg_iov = &engine->tick_iov[slots];
+            message->msg_iovlen = 1;
+        }
+        slots++;
+
+        if (slots == SHIMAORE_ENGINE_TICK_BATCH) {
+            shimaore_engine_tick_send(engine, messages);
+            messages = slots = 0;
+        }
+    }
+    if (messages) {
+        shimaore_engine_tick_send(engine, messages);
+    }
+}
+
+/* Sleep to the next multiple of `flush-tick-ms` of the wall clock and flush. Runs until the
+ * module stops and the queue is empty.
+ */
+static void *SWITCH_THREAD_FUNC shimaore_engine_tick_thread(switch_thread_t *thread, void *obj) {
+    shimaore_engine_t *engine = (shimaore_engine_t *) obj;
+    switch_time_t tick = (switch_time_t) engine->tick_ms * 1000;
+
+    shimaore_engine_pin(engine);
+    while (engine->running) {
+        switch_time_t now = switch_micro_time_now();
+
+        switch_yield(tick - now % tick);
+        now = switch_time_ref();
+        shimaore_engine_tick_flush(engine);
+        __atomic_add_fetch(&engine->busy_us, switch_time_ref() - now, __ATOMIC_RELAXED);
+        engine->ticks++;
+    }
+    shimaore_engine_tick_flush(engine);
+    return NULL;
+}
+
+/* The engine's own unconnected socket; probes UDP GSO support */
+static switch_status_t shimaore_engine_tick_init(shimaore_engine_t *engine) {
+    int size = 4 * 1024 * 1024;
+
+    if ((engine->tick_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "send engine: cannot create socket (%s), sending directly\n", strerror(errno));
+        return SWITCH_STATUS_FALSE;
+    }
+    setsockopt(engine->tick_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+#ifdef UDP_SEGMENT
+    {
+        int segment = SHIMAORE_ENGINE_GSO_SEGMENT_MAXIMUM;
+
+        /* Set then cleared: only per-message segment sizes are used */
+        if (setsockopt(engine->tick_fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0) {
+            segment = 0;
+            setsockopt(engine->tick_fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment));
+            engine->gso = SWITCH_TRUE;
+        }
+    }
+#endif
+    engine->tick_batch = (shimaore_engine_slot_t **) switch_core_alloc(globals.pool, SHIMAORE_ENGINE_TICK_BATCH * sizeof(*engine->tick_batch));
+    engine->tick_iov = (struct iovec *) switch_core_alloc(globals.pool, SHIMAORE_ENGINE_TICK_BATCH * sizeof(*engine->tick_iov));
+    engine->tick_messages = (struct mmsghdr *) switch_core_alloc(globals.pool, SHIMAORE_ENGINE_TICK_BATCH * sizeof(*engine->tick_messages));
+    engine->tick_control = (shimaore_engine_control_t *) switch_core_alloc(globals.pool, SHIMAORE_ENGINE_TICK_BATCH * sizeof(*engine->tick_control));
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*** io_uring engine ***/
+
+#ifdef HAVE_LIBURING
+/* Account for finished sends; returns how many */
+static uint32_t shimaore_engine_reap(shimaore_engine_t *engine) {
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    uint32_t seen = 0;
+
+    io_uring_for_each_cqe(&engine->ring, head, cqe) {
+        shimaore_engine_complete(engine, (shimaore_engine_slot_t *) io_uring_cqe_get_data(cqe), cqe->res >= 0);
+        seen++;
+    }
+    io_uring_cq_advance(&engine->ring, seen);
+    engine->inflight -= seen;
+    return seen;
+}
+
+/* Owns the ring: queued slots become WRITE_FIXED submissions (offset 0 on a connected datagram
+ * socket, buffer 0 being the whole slot region). Runs until the module stops and nothing is left
+ * in flight.
+ */
+static void *SWITCH_THREAD_FUNC shimaore_engine_uring_thread(switch_thread_t *thread, void *obj) {
+    shimaore_engine_t *engine = (shimaore_engine_t *) obj;
+    shimaore_engine_slot_t *slot = NULL;
+
+    shimaore_engine_pin(engine);
+    while (engine->running || engine->inflight || slot || (slot = shimaore_engine_next(engine))) {
+        struct io_uring_sqe *sqe;
+        uint32_t submitted = 0;
+        switch_time_t started = switch_time_ref();
+
+        for (;;) {
+            if (!slot && !(slot = shimaore_engine_next(engine))) {
+                break;
+            }
+            if (engine->inflight >= SHIMAORE_ENGINE_RING_ENTRIES || !(sqe = io_uring_get_sqe(&engine->ring))) {
+                /* Kept for the next round */
+                break;
+            }
+            io_uring_prep_write_fixed(sqe, slot->context->fd, slot->data, slot->length, 0, 0);
+            io_uring_sqe_set_data(sqe, slot);
+            engine->inflight++;
+            submitted++;
+            slot = NULL;
+        }
+        if (submitted) {
+            io_uring_submit(&engine->ring);
+        }
+        if (!shimaore_engine_reap(engine) && !submitted) {
+            switch_yield(SHIMAORE_ENGINE_IDLE_US);
+        } else {
+            __atomic_add_fetch(&engine->busy_us, switch_time_ref() - started, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+/* Set up the ring and register the slot region as buffer 0 */
+static switch_status_t shimaore_engine_uring_init(shimaore_engine_t *engine) {
+    struct io_uring_params params;
+    struct iovec region;
+    int error;
+
+    memset(&params, 0, sizeof(params));
+    if (engine->sqpoll) {
+        /* The kernel polls the submission queue: no syscall per round while busy */
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000;
+    }
+    if ((error = io_uring_queue_init_params(SHIMAORE_ENGINE_RING_ENTRIES, &engine->ring, &params)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "send engine: io_uring unavailable (%s), sending directly\n", strerror(-error));
+        return SWITCH_STATUS_FALSE;
+    }
+    region.iov_base = engine->memory;
+    region.iov_len = (size_t) engine->slot_count * engine->slot_size;
+    if ((error = io_uring_register_buffers(&engine->ring, &region, 1)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "send engine: cannot register %lu bytes of buffers (%s), sending directly\n",
+                          (unsigned long) region.iov_len, strerror(-error));
+        io_uring_queue_exit(&engine->ring);
+        return SWITCH_STATUS_FALSE;
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+#endif
+
+/* Tear down what shimaore_engine_start set up */
+static void shimaore_engine_cleanup(shimaore_engine_t *engine) {
+
+#ifdef HAVE_LIBURING
+    if (engine->mode == SHIMAORE_ENGINE_IO_URING && engine->ring_ready) {
+        io_uring_queue_exit(&engine->ring);
+    }
+#endif
+    if (engine->tick_fd >= 0) {
+        close(engine->tick_fd);
+        engine->tick_fd = -1;
+    }
+    if (engine->memory) {
+        munmap(engine->memory, (size_t) engine->slot_count * engine->slot_size);
+        engine->memory = NULL;
+    }
+}
+
+/* Set up the engine selected by `send-engine` and start its thread. On failure the module keeps
+ * sending directly.
+ */
+static switch_status_t shimaore_engine_start(shimaore_engine_t *engine) {
+    switch_threadattr_t *thd_attr = NULL;
+    switch_thread_start_t run = NULL;
+
+    if (shimaore_engine_slots_init(engine) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "send engine: cannot map buffers, sending directly\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch (engine->mode) {
+    case SHIMAORE_ENGINE_IO_URING:
+#ifdef HAVE_LIBURING
+        if (shimaore_engine_uring_init(engine) == SWITCH_STATUS_SUCCESS) {
+            engine->ring_ready = SWITCH_TRUE;
+            run = shimaore_engine_uring_thread;
+        }
+#else
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "send engine: built without io_uring, sending directly\n");
+#endif
+        break;
+    case SHIMAORE_ENGINE_TICK:
+        if (shimaore_engine_tick_init(engine) == SWITCH_STATUS_SUCCESS) {
+            run = shimaore_engine_tick_thread;
+        }
+        break;
+    default:
+        break;
+    }
+    if (!run) {
+        shimaore_engine_cleanup(engine);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    engine->running = SWITCH_TRUE;
+    engine->started = switch_micro_time_now();
+    switch_threadattr_create(&thd_attr, globals.pool);
+    switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+    if (switch_thread_create(&engine->thread, thd_attr, run, engine, globals.pool) != SWITCH_STATUS_SUCCESS) {
+        engine->running = SWITCH_FALSE;
+        engine->thread = NULL;
+        shimaore_engine_cleanup(engine);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "send engine %u: %s, %u slots of %u bytes%s\n",
+                      engine->index, shimaore_engine_names[engine->mode], engine->slot_count, engine->slot_size,
+                      engine->mode == SHIMAORE_ENGINE_TICK ? (engine->gso ? ", UDP GSO" : ", no UDP GSO") : engine->sqpoll ? ", SQPOLL" : "");
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* One shard per `send-engine-workers`, each with its own thread, slots, queue and socket or ring;
+ * shards share nothing, taps stick to theirs.
+ */
+static void shimaore_engines_start(void) {
+    globals.engines = (shimaore_engine_t *) switch_core_alloc(globals.pool, globals.engine_count * sizeof(*globals.engines));
+    for (uint32_t i = 0; i < globals.engine_count; i++) {
+        shimaore_engine_t *engine = &globals.engines[i];
+
+        *engine = globals.engine;
+        engine->index = i;
+        engine->cpu = globals.engine_cpu_count ? globals.engine_cpus[i % globals.engine_cpu_count] : -1;
+        shimaore_engine_start(engine);
+    }
+}
+
+/* A new tap's shard, by UUID hash; NULL without send engine */
+static shimaore_engine_t *shimaore_engine_for(shimaore_context_t *context) {
+    shimaore_engine_t *engine;
+
+    if (globals.engine_count == 0) {
+        return NULL;
+    }
+    engine = &globals.engines[context->uuid_hash % globals.engine_count];
+    __atomic_add_fetch(&engine->taps, 1, __ATOMIC_RELAXED);
+    return engine;
+}
+
+/* `send-engine-shard=cpu`: media thread, first frame. Move to the shard pinned to the current core,
+ * if any, so that packets stay in its cache; taps whose media thread migrates later stay put.
+ */
+static void shimaore_engine_follow_cpu(shimaore_context_t *context) {
+    shimaore_engine_t *engine = NULL;
+    int cpu = sched_getcpu();
+
+    context->engine_pinned = SWITCH_TRUE;
+    if (cpu < 0 || !context->engine) {
+        return;
+    }
+    for (uint32_t i = 0; i < globals.engine_count && !engine; i++) {
+        if (globals.engines[i].cpu == cpu) {
+            engine = &globals.engines[i];
+        }
+    }
+    if (!engine) {
+        engine = &globals.engines[cpu % globals.engine_count];
+    }
+    if (engine != context->engine) {
+        __atomic_sub_fetch(&context->engine->taps, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&engine->taps, 1, __ATOMIC_RELAXED);
+        context->engine = engine;
+    }
+}
+
+/* Flush what is queued and in flight, then tear down */
+static void shimaore_engine_stop(shimaore_engine_t *engine) {
+    switch_status_t status;
+
+    if (!engine->thread) {
+        return;
+    }
+    engine->running = SWITCH_FALSE;
+    switch_thread_join(&status, engine->thread);
+    engine->thread = NULL;
+    shimaore_engine_cleanup(engine);
+}
+
+/*** Framing ***/
+
+/* Write the tap's header at `to` with the current sequence number, timestamp and capture time */
+static inline void shimaore_rtp_header_write(shimaore_context_t *context, uint8_t *to) {
+    shimaore_rtp_template_write(&context->rtp_template, to, context->rtp_sequence_number, context->rtp_timestamp,
+                                context->bunch_capture_time);
+    shimaore_rtp_levels_write(&context->rtp_template, to, context->levels.rms, context->levels.peak, context->levels.clipped);
+}
+
+/* Start (metadata) and stop packets: same header with a signalling payload type */
+static switch_status_t shimaore_send_control(shimaore_context_t *context, uint8_t payload_type, const uint8_t *payload, uint16_t len) {
+    uint8_t header[SHIMAORE_RTP_HEADER_SIZE];
+    struct iovec iov[2];
+
+    shimaore_rtp_control_write(&context->rtp_template, header, context->rtp_sequence_number, context->rtp_timestamp, payload_type);
+    iov[0].iov_base = header;
+    iov[0].iov_len = SHIMAORE_RTP_HEADER_SIZE;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len = len;
+    shimaore_latency_tx_id(context);
+    return shimaore_transmit(context, iov, len > 0 ? 2 : 1, 0);
+}
+
+static switch_status_t shimaore_control_start(shimaore_context_t *context) {
+    return shimaore_send_control(context, SHIMAORE_PT_START, context->config->meta, context->config->meta_length);
+}
+
+static switch_status_t shimaore_control_stop(shimaore_context_t *context) {
+    return shimaore_send_control(context, SHIMAORE_PT_STOP, NULL, 0);
+}
+
+/* Raw audio over UDP, native system byte order */
+static switch_status_t shimaore_plain_bunch(shimaore_context_t *context, uint32_t len) {
+    struct iovec iov = { context->buncher_buffer, len };
+
+    shimaore_latency_send_before(context);
+    return shimaore_transmit(context, &iov, 1, len);
+}
+
+/* L16 per RFC 3551 section 4.5.11: header in the headroom, payload converted in place */
+static switch_status_t shimaore_rtp_l16_bunch(shimaore_context_t *context, uint32_t len) {
+    uint8_t *packet = context->buncher_buffer - context->rtp_template.length;
+    struct iovec iov = { packet, context->rtp_template.length + len };
+
+    shimaore_rtp_header_write(context, packet);
+    shimaore_l16_to_network(context->buncher_buffer, len);
+    shimaore_latency_send_before(context);
+    return shimaore_transmit(context, &iov, 1, len);
+}
+
+/* Framings with an encoder: header in the headroom, audio left in native order for the encoder */
+static switch_status_t shimaore_encoded_bunch(shimaore_context_t *context, uint32_t len) {
+    uint8_t *packet = context->buncher_buffer - context->rtp_template.length;
+    struct iovec iov = { packet, context->rtp_template.length + len };
+
+    shimaore_rtp_header_write(context, packet);
+    shimaore_latency_send_before(context);
+    return shimaore_transmit(context, &iov, 1, len);
+}
+
+/* The packet's timestamp tells the encoder whether the audio follows on from the previous bunch */
+static uint32_t shimaore_features_bunch_encode(shimaore_context_t *context, uint8_t *packet, uint32_t header_length,
+                                               uint32_t length, uint8_t *to, uint32_t capacity) {
+    uint32_t timestamp;
+
+    memcpy(&timestamp, packet + 4, sizeof(timestamp));
+    return shimaore_features_encode(context->features, ntohl(timestamp), (const int16_t *) (packet + header_length), length / 2,
+                                    to, capacity);
+}
+
+/* Each packet is coded on its own; those that do not shrink go out as L16 */
+static uint32_t shimaore_lossless_bunch_encode(shimaore_context_t *context, uint8_t *packet, uint32_t header_length,
+                                               uint32_t length, uint8_t *to, uint32_t capacity) {
+    uint32_t encoded = shimaore_lossless_encode((const int16_t *) (packet + header_length), length / 2, context->channels,
+                                                to, capacity);
+
+    if (encoded == 0) {
+        shimaore_l16_to_network(packet + header_length, length);
+        packet[1] = (packet[1] & 0x80) | SHIMAORE_PT_L16;
+    }
+    return encoded;
+}
+
+static const shimaore_framing_ops_t shimaore_framings[] = {
+    [SHIMAORE_FRAMING_PLAIN] = {
+        "plain", shimaore_plain_bunch, shimaore_control_start, shimaore_control_stop, SWITCH_FALSE
+    },
+    [SHIMAORE_FRAMING_RTP_L16] = {
+        "rtp", shimaore_rtp_l16_bunch, shimaore_control_start, shimaore_control_stop, SWITCH_TRUE
+    },
+    [SHIMAORE_FRAMING_FEATURES] = {
+        "features", shimaore_encoded_bunch, shimaore_control_start, shimaore_control_stop, SWITCH_TRUE,
+        shimaore_features_bunch_encode
+    },
+    [SHIMAORE_FRAMING_LOSSLESS] = {
+        "lossless", shimaore_encoded_bunch, shimaore_control_start, shimaore_control_stop, SWITCH_TRUE,
+        shimaore_lossless_bunch_encode
+    },
+};
+
+static switch_status_t shimaore_send_start(shimaore_context_t *context) {
+  /* Armed but not started */
+  if (!context->config) {
+    return SWITCH_STATUS_FALSE;
+  }
+
+  if (context->config->meta_length == 0) {
+    return SWITCH_STATUS_FALSE;
+  }
+
+  return context->framing_ops->send_start(context);
+}
+
+static switch_status_t shimaore_send_stop(shimaore_context_t *context) {
+  if (!context->config || context->config->meta_length == 0) {
+    return SWITCH_STATUS_FALSE;
+  }
+
+  return context->framing_ops->send_stop(context);
+}
+
+/*** Levels ***/
+
+/* -dBov of a mean square / squared peak (full scale: 32768^2), clamped to 0..SHIMAORE_LEVEL_SILENCE */
+static uint8_t shimaore_level_dbov(double power) {
+    double dbov = power > 0 ? -10.0 * log10(power / (32768.0 * 32768.0)) : SHIMAORE_LEVEL_SILENCE;
+
+    return dbov >= SHIMAORE_LEVEL_SILENCE ? SHIMAORE_LEVEL_SILENCE : dbov <= 0 ? 0 : (uint8_t) (dbov + 0.5);
+}
+
+/* Media thread: measure the bunch (native order L16) before framing converts it. One branch-free
+ * pass, which compilers vectorize; the logarithms are per bunch.
+ */
+static void shimaore_levels_measure(shimaore_context_t *context, const int16_t *samples, uint32_t count) {
+    shimaore_levels_t *levels = &context->levels;
+    uint64_t energy = 0;
+    int32_t maximum = 0;
+    int32_t minimum = 0;
+    uint32_t clipped = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        int32_t sample = samples[i];
+
+        energy += (uint32_t) (sample * sample);
+        maximum = sample > maximum ? sample : maximum;
+        minimum = sample < minimum ? sample : minimum;
+        clipped += (sample == INT16_MAX) | (sample == INT16_MIN);
+    }
+    if (-minimum > maximum) {
+        maximum = -minimum;
+    }
+
+    levels->rms = shimaore_level_dbov(count ? (double) energy / count : 0);
+    levels->peak = shimaore_level_dbov((double) maximum * maximum);
+    levels->clipped = clipped > UINT16_MAX ? UINT16_MAX : (uint16_t) clipped;
+
+    levels->energy += energy;
+    levels->samples += count;
+    levels->clipped_samples += clipped;
+    if ((uint32_t) maximum > levels->peak_sample) {
+        levels->peak_sample = maximum;
+    }
+    /* Two bytes per sample */
+    if (levels->samples >= context->timestamp_rate / 2) {
+        __atomic_store_n(&levels->second_rms, shimaore_level_dbov((double) levels->energy / levels->samples), __ATOMIC_RELAXED);
+        __atomic_store_n(&levels->second_peak, shimaore_level_dbov((double) levels->peak_sample * levels->peak_sample), __ATOMIC_RELAXED);
+        __atomic_store_n(&levels->second_clipped, levels->clipped_samples, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&levels->clipped_total, levels->clipped_samples, __ATOMIC_RELAXED);
+        levels->energy = 0;
+        levels->samples = 0;
+        levels->peak_sample = 0;
+        levels->clipped_samples = 0;
+    }
+}
+
+/*** RTCP ***/
+
+/* Media thread: the RTP timestamp just past the bunch that was sent corresponds to now */
+static void shimaore_rtcp_clock(shimaore_context_t *context) {
+    __atomic_store_n(&context->rtcp_clock_sequence, context->rtcp_clock_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&context->rtcp_clock_time, switch_micro_time_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&context->rtcp_clock_timestamp, context->rtp_timestamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&context->rtcp_clock_sequence, context->rtcp_clock_sequence + 1, __ATOMIC_RELEASE);
+}
+
+/* Report thread, with a reference on the tap and only while it is not closing.
+ * Counters are read racily: a report may be one bunch behind.
+ */
+static void shimaore_rtcp_report(shimaore_context_t *context) {
+    shimaore_destination_t *destination = __atomic_load_n(&context->destination, __ATOMIC_RELAXED);
+    uint8_t sr[SHIMAORE_RTCP_SR_SIZE];
+    uint32_t sequence;
+    switch_time_t clock_time;
+    uint32_t clock_timestamp;
+    switch_time_t now;
+    switch_size_t len = sizeof(sr);
+
+    if (context->rtcp == SHIMAORE_RTCP_OFF || !destination || !__atomic_load_n(&context->config, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    do {
+        sequence = __atomic_load_n(&context->rtcp_clock_sequence, __ATOMIC_ACQUIRE);
+        clock_time = __atomic_load_n(&context->rtcp_clock_time, __ATOMIC_RELAXED);
+        clock_timestamp = __atomic_load_n(&context->rtcp_clock_timestamp, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1) || sequence != __atomic_load_n(&context->rtcp_clock_sequence, __ATOMIC_RELAXED));
+
+    /* Nothing sent live yet */
+    if (clock_time == 0) {
+        return;
+    }
+
+    /* Extrapolate the RTP timestamp to now; it keeps running while paused */
+    now = switch_micro_time_now();
+    clock_timestamp += (uint32_t) ((now - clock_time) * context->timestamp_rate / 1000000);
+
+    shimaore_rtcp_sr_write(sr, context->rtp_ssrc, now, clock_timestamp, (uint32_t) context->sent_successful, (uint32_t) context->sent_octets);
+
+    if (context->rtcp == SHIMAORE_RTCP_MUX) {
+        /* Racing the media thread for the id may misattribute one kernel timestamp; harmless */
+        shimaore_latency_tx_id(context);
+        send(context->fd, sr, len, 0);
+    } else if (context->rtcp_socket) {
+        switch_socket_sendto(context->rtcp_socket, destination->rtcp_addr, 0, (const char *) sr, &len);
+    }
+}
+
+/* Report thread. The taps are listed with a reference each under globals.mutex, and the reports
+ * sent without it, so that starting and stopping taps does not wait for the sends.
+ */
+static void *SWITCH_THREAD_FUNC shimaore_rtcp_thread(switch_thread_t *thread, void *obj) {
+    shimaore_context_t **snapshot = NULL;
+    uint32_t capacity = 0;
+
+    while (globals.running) {
+        switch_hash_index_t *hi;
+        uint32_t count = 0;
+
+        switch_mutex_lock(globals.mutex);
+        if (switch_core_hash_count(globals.taps) > capacity) {
+            uint32_t wanted = switch_core_hash_count(globals.taps) * 2;
+            shimaore_context_t **grown = (shimaore_context_t **) realloc(snapshot, wanted * sizeof(*snapshot));
+
+            if (grown) {
+                snapshot = grown;
+                capacity = wanted;
+            }
+        }
+        for (hi = switch_core_hash_first(globals.taps); hi && count < capacity; hi = switch_core_hash_next(&hi)) {
+            void *val;
+
+            switch_core_hash_this(hi, NULL, NULL, &val);
+            snapshot[count] = (shimaore_context_t *) val;
+            __atomic_add_fetch(&snapshot[count]->refs, 1, __ATOMIC_RELAXED);
+            count++;
+        }
+        /* Left early only if the list could not grow */
+        switch_safe_free(hi);
+        switch_mutex_unlock(globals.mutex);
+
+        for (uint32_t i = 0; i < count; i++) {
+            shimaore_context_t *context = snapshot[i];
+
+            /* The reference outlives the tap: nothing once the stop packet may be out */
+            __atomic_add_fetch(&context->rtcp_reporting, 1, __ATOMIC_SEQ_CST);
+            if (!__atomic_load_n(&context->closing, __ATOMIC_SEQ_CST)) {
+                shimaore_rtcp_report(context);
+            }
+            __atomic_sub_fetch(&context->rtcp_reporting, 1, __ATOMIC_RELEASE);
+            shimaore_context_put(context);
+        }
+
+        /* Short naps, so that unloading the module does not wait for a full interval */
+        for (uint32_t waited = 0; waited < globals.rtcp_interval_ms && globals.running; waited += 100) {
+            switch_yield(100000);
+        }
+    }
+    switch_safe_free(snapshot);
+    return NULL;
+}
+
+/*** NACK ***/
+
+/* NACK thread: send again the packet `sequence_number` if the history still has it */
+static void shimaore_nack_resend(shimaore_context_t *context, uint16_t sequence_number) {
+    shimaore_history_t *history = context->history;
+    shimaore_history_entry_t *entry = &history->entries[sequence_number % history->size];
+    ssize_t sent = -1;
+
+    shimaore_spin_lock(&history->lock);
+    if (entry->length > 0 && entry->sequence_number == sequence_number) {
+        sent = send(context->fd, entry->data, entry->length, MSG_DONTWAIT);
+    }
+    shimaore_spin_unlock(&history->lock);
+    if (sent > 0) {
+        history->retransmitted++;
+    } else {
+        history->unavailable++;
+    }
+}
+
+/* NACK thread, with globals.nack_mutex held: the feedback waiting on the tap's socket. Anything
+ * but transport layer feedback about this tap's stream is skipped. Each datagram gets at most
+ * one history's worth of retransmissions, whatever it asks for.
+ */
+static void shimaore_nack_receive(shimaore_context_t *context) {
+    uint8_t buffer[1500];
+    ssize_t len;
+
+    for (int datagrams = 0; datagrams < SHIMAORE_NACK_EVENTS; datagrams++) {
+        uint32_t budget = context->history->size;
+
+        if ((len = recv(context->fd, buffer, sizeof(buffer), MSG_DONTWAIT)) < 0) {
+            break;
+        }
+        for (const uint8_t *p = buffer, *end = buffer + len; p + SHIMAORE_NACK_HEADER_SIZE <= end;) {
+            const uint8_t *next = p + 4 * ((p[2] << 8 | p[3]) + 1);
+            uint32_t fmt = p[0] & 0x1f;
+            uint32_t media_ssrc = (uint32_t) p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11];
+
+            if (p[0] >> 6 != 2 || next > end) {
+                break;
+            }
+            if (p[1] == SHIMAORE_PT_RTPFB && media_ssrc == context->rtp_ssrc &&
+                (fmt == SHIMAORE_NACK_FMT_GENERIC || fmt == SHIMAORE_NACK_FMT_RANGES)) {
+                for (const uint8_t *fci = p + SHIMAORE_NACK_HEADER_SIZE; fci + 4 <= next; fci += 4) {
+                    uint16_t first = (uint16_t) (fci[0] << 8 | fci[1]);
+                    uint16_t word = (uint16_t) (fci[2] << 8 | fci[3]);
+                    uint32_t count = fmt == SHIMAORE_NACK_FMT_RANGES ? (uint32_t) word + 1 : 17;
+
+                    for (uint32_t i = 0; i < count && budget > 0; i++) {
+                        /* Generic NACK: the first packet, then those whose bit is set */
+                        if (fmt == SHIMAORE_NACK_FMT_GENERIC && i > 0 && !(word & 1u << (i - 1))) {
+                            continue;
+                        }
+                        context->history->requested++;
+                        shimaore_nack_resend(context, (uint16_t) (first + i));
+                        budget--;
+                    }
+                }
+            }
+            p = next;
+        }
+    }
+}
+
+/* Have the NACK thread watch the socket of a tap started with `nack=`, from its start */
+static void shimaore_nack_listen(shimaore_context_t *context) {
+    struct epoll_event event = { 0 };
+
+    if (!context->history || globals.nack_epoll_fd < 0) {
+        return;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = context;
+    __atomic_add_fetch(&context->refs, 1, __ATOMIC_RELAXED);
+    switch_mutex_lock(globals.nack_mutex);
+    if (epoll_ctl(globals.nack_epoll_fd, EPOLL_CTL_ADD, context->fd, &event) == 0) {
+        context->nack_listening = SWITCH_TRUE;
+    }
+    switch_mutex_unlock(globals.nack_mutex);
+    if (!context->nack_listening) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "%s: cannot watch the socket for NACKs: %s\n", context->uuid,
+                          strerror(errno));
+        shimaore_context_put(context);
+    }
+}
+
+/* When the tap closes. The NACK thread may be in the middle of a batch of events that refer to
+ * the context, so it drops its reference itself, before its next wait.
+ */
+static void shimaore_nack_unlisten(shimaore_context_t *context) {
+    switch_mutex_lock(globals.nack_mutex);
+    if (context->nack_listening) {
+        epoll_ctl(globals.nack_epoll_fd, EPOLL_CTL_DEL, context->fd, NULL);
+        context->nack_listening = SWITCH_FALSE;
+        context->nack_next = globals.nack_closed;
+        globals.nack_closed = context;
+    }
+    switch_mutex_unlock(globals.nack_mutex);
+}
+
+static void shimaore_nack_drop_closed(void) {
+    shimaore_context_t *closed;
+
+    switch_mutex_lock(globals.nack_mutex);
+    closed = globals.nack_closed;
+    globals.nack_closed = NULL;
+    switch_mutex_unlock(globals.nack_mutex);
+    while (closed) {
+        shimaore_context_t *context = closed;
+
+        closed = context->nack_next;
+        context->nack_next = NULL;
+        shimaore_context_put(context);
+    }
+}
+
+static void *SWITCH_THREAD_FUNC shimaore_nack_thread(switch_thread_t *thread, void *obj) {
+    struct epoll_event events[SHIMAORE_NACK_EVENTS];
+
+    while (globals.running) {
+        int count;
+
+        shimaore_nack_drop_closed();
+        /* Short waits, so that unloading the module is not held up */
+        if ((count = epoll_wait(globals.nack_epoll_fd, events, SHIMAORE_NACK_EVENTS, 100)) <= 0) {
+            continue;
+        }
+        switch_mutex_lock(globals.nack_mutex);
+        for (int i = 0; i < count; i++) {
+            shimaore_context_t *context = (shimaore_context_t *) events[i].data.ptr;
+
+            if (context->nack_listening && (events[i].events & EPOLLIN)) {
+                shimaore_nack_receive(context);
+            }
+        }
+        switch_mutex_unlock(globals.nack_mutex);
+    }
+    shimaore_nack_drop_closed();
+    return NULL;
+}
+
+/*** Unicast ***/
+static switch_status_t shimaore_send(shimaore_context_t *context) {
+    switch_status_t outcome;
+    uint32_t len = context->buncher_position;
+    uint32_t tx_id;
+
+    context->rtp_sequence_number++;
+
+    if (context->latency) {
+        context->latency->bunch_complete = switch_time_ref();
+    }
+    tx_id = shimaore_latency_tx_id(context);
+
+    SHIMAORE_PROBE4(bunch_flush, context->uuid, context->rtp_ssrc, len, context->buncher_frame_count);
+
+    if (context->levels.enabled) {
+        shimaore_levels_measure(context, (const int16_t *) context->buncher_buffer, len / 2);
+    }
+
+    /* Errors are only counted */
+    outcome = context->framing_ops->send_bunch(context, len);
+    SHIMAORE_PROBE4(send_result, context->uuid, context->rtp_ssrc, len, outcome == SWITCH_STATUS_SUCCESS ? 0 : errno);
+    if (context->latency) {
+        shimaore_latency_sent(context, tx_id);
+    }
+    context->sent_attempted++;
+    if (context->send_pending) {
+        /* Counted by the send engine on completion */
+        shimaore_engine_feedback(context);
+    } else {
+        if (outcome == SWITCH_STATUS_SUCCESS) {
+            __atomic_add_fetch(&context->sent_successful, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&context->sent_octets, len, __ATOMIC_RELAXED);
+        }
+        shimaore_destination_feedback(context, outcome);
+    }
+
+    context->rtp_timestamp += len;
+    /* History sent while catching up is behind the wall clock */
+    if (context->rtcp != SHIMAORE_RTCP_OFF && !context->preroll_catching_up) {
+        shimaore_rtcp_clock(context);
+    }
+
+    if (context->framing_ops->resend_meta && context->sent_attempted % SHIMAORE_META_RESEND_INTERVAL == 0) {
+        SHIMAORE_PROBE3(meta_resend, context->uuid, context->rtp_ssrc, context->config->meta_length);
+        shimaore_send_start(context);
+    }
+
+    /* The sequence number after each group goes to its parity packet (see shimaore_parity_add) */
+    if (context->fec == SHIMAORE_FEC_PARITY && ++context->fec_count == context->fec_group) {
+        context->fec_count = 0;
+        context->rtp_sequence_number++;
+    }
+
+    context->buncher_position = 0;
+    context->buncher_frame_count = 0;
+    return outcome;
+}
+
+/* Switch the media thread over to the latest published configuration. Runs on the media
+ * thread only, so socket, buffer and sequence state are never touched concurrently.
+ */
+static void shimaore_config_apply(shimaore_context_t *context, shimaore_config_t *config) {
+    shimaore_config_t *previous = context->config;
+    switch_bool_t grown = config->buncher_maximum > previous->buncher_maximum;
+    switch_bool_t meta_changed = config->meta_length != previous->meta_length ||
+        (config->meta_length > 0 && memcmp(config->meta, previous->meta, config->meta_length) != 0);
+    switch_bool_t moved = SWITCH_FALSE;
+
+    /* From here on the next `update` may free `previous` */
+    __atomic_store_n(&context->config, config, __ATOMIC_RELEASE);
+
+    if (grown) {
+        shimaore_buncher_reserve(context, config->buncher_maximum, context->frame_bytes);
+    }
+
+    /* Move to the new group only if the current destination is not part of it */
+    {
+        switch_bool_t member = SWITCH_FALSE;
+
+        for (uint32_t i = 0; i < config->destination_count; i++) {
+            if (config->destinations[i] == context->destination) {
+                member = SWITCH_TRUE;
+            }
+        }
+        if (!member) {
+            shimaore_destination_t *destination = shimaore_destination_select(context, config, NULL);
+
+            if (destination && shimaore_destination_attach(context, destination) == SWITCH_STATUS_SUCCESS) {
+                moved = SWITCH_TRUE;
+            }
+        }
+    }
+
+    /* Flush what we have if the bunch is now complete */
+    if (context->buncher_frame_count >= config->buncher_maximum && context->buncher_position > 0) {
+        shimaore_send(context);
+    }
+
+    /* A new consumer needs a start packet; so does the current one if the metadata changed */
+    if (moved || meta_changed) {
+        shimaore_send_start(context);
+    }
+}
+
+/*** Pre-roll ***/
+
+static void shimaore_preroll_record(shimaore_context_t *context, const uint8_t *data, uint32_t len) {
+    uint32_t offset = context->preroll_written % context->preroll_size;
+    uint32_t first = len < context->preroll_size - offset ? len : context->preroll_size - offset;
+
+    if (len > context->preroll_size) {
+        return;
+    }
+    memcpy(context->preroll_ring + offset, data, first);
+    memcpy(context->preroll_ring, data + first, len - first);
+    context->preroll_written += len;
+}
+
+static void shimaore_preroll_copy(shimaore_context_t *context, uint64_t from, uint8_t *to, uint32_t len) {
+    uint32_t offset = from % context->preroll_size;
+    uint32_t first = len < context->preroll_size - offset ? len : context->preroll_size - offset;
+
+    memcpy(to, context->preroll_ring + offset, first);
+    memcpy(to + first, context->preroll_ring, len - first);
+}
+
+/* An armed tap got its first configuration: start streaming, from `preroll_ms` ago if asked */
+static void shimaore_preroll_go_live(shimaore_context_t *context, shimaore_config_t *config) {
+    uint64_t wanted = (uint64_t) context->preroll_ms * context->preroll_bytes_per_ms;
+    uint64_t available = context->preroll_written < context->preroll_size ? context->preroll_written : context->preroll_size;
+
+    __atomic_store_n(&context->config, config, __ATOMIC_RELEASE);
+    shimaore_buncher_reserve(context, config->buncher_maximum, context->frame_bytes);
+    SHIMAORE_PROBE3(tap_start, context->uuid, context->rtp_ssrc, context->destination ? context->destination->name : "");
+    shimaore_nack_listen(context);
+    shimaore_send_start(context);
+
+    if (wanted > available) {
+        wanted = available;
+    }
+    /* Each frame is recorded before the history is drained: leave it room in the ring */
+    if (wanted + context->frame_bytes > context->preroll_size) {
+        wanted = context->preroll_size > context->frame_bytes ? context->preroll_size - context->frame_bytes : 0;
+    }
+    /* Frames are recorded whole: stay on a frame boundary */
+    if (context->frame_bytes) {
+        wanted -= wanted % context->frame_bytes;
+    }
+    context->preroll_read = context->preroll_written - wanted;
+    context->preroll_catching_up = wanted > 0;
+}
+
+/* The ring's last byte was captured just now */
+static switch_time_t shimaore_preroll_capture_time(shimaore_context_t *context, uint64_t position) {
+    return switch_micro_time_now() - (switch_time_t) ((context->preroll_written - position) * 1000 / context->preroll_bytes_per_ms);
+}
+
+/* Send up to SHIMAORE_PREROLL_BUNCHES_PER_FRAME bunches of history. Once less than a bunch is left,
+ * it becomes the beginning of the live bunch and the tap is caught up.
+ */
+static void shimaore_preroll_drain(shimaore_context_t *context) {
+    uint32_t bunch = context->config->buncher_maximum * context->frame_bytes;
+
+    if (bunch > context->buncher_capacity) {
+        bunch = context->buncher_capacity - context->buncher_capacity % context->frame_bytes;
+    }
+
+    for (int i = 0; i < SHIMAORE_PREROLL_BUNCHES_PER_FRAME; i++) {
+        uint64_t backlog = context->preroll_written - context->preroll_read;
+
+        if (context->rtp_template.capture_time_offset) {
+            context->bunch_capture_time = shimaore_preroll_capture_time(context, context->preroll_read);
+        }
+        /* History counts as buffered from the moment it is sent */
+        if (context->latency) {
+            context->latency->bunch_read = switch_time_ref();
+        }
+        if (backlog < bunch) {
+            shimaore_preroll_copy(context, context->preroll_read, context->buncher_buffer, backlog);
+            context->buncher_position = backlog;
+            context->buncher_frame_count = backlog / context->frame_bytes;
+            context->preroll_read = context->preroll_written;
+            context->preroll_catching_up = SWITCH_FALSE;
+            return;
+        }
+        shimaore_preroll_copy(context, context->preroll_read, context->buncher_buffer, bunch);
+        context->buncher_position = bunch;
+        context->buncher_frame_count = bunch / context->frame_bytes;
+        context->preroll_read += bunch;
+        shimaore_send(context);
+    }
+}
+
+/* Percentiles reported by `status` and the stats event */
+static const uint32_t shimaore_latency_percentiles[] = { 50, 90, 99 };
+
+static void shimaore_stats_event(shimaore_context_t *context) {
+    switch_event_t *event;
+    char name[64];
+
+    if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, SHIMAORE_STATS_EVENT) != SWITCH_STATUS_SUCCESS) {
+        return;
+    }
+    switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Unique-ID", context->uuid);
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Shimaore-SSRC", "%u", context->rtp_ssrc);
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Shimaore-Sent-Attempted", "%lu", (unsigned long) context->sent_attempted);
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Shimaore-Sent-Successful", "%lu", (unsigned long) context->sent_successful);
+    switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Shimaore-Sent-Octets", "%lu", (unsigned long) context->sent_octets);
+    if (context->history) {
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Shimaore-NACK-Requested", "%lu",
+                                (unsigned long) __atomic_load_n(&context->history->requested, __ATOMIC_RELAXED));
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Shimaore-NACK-Retransmitted", "%lu",
+                                (unsigned long) __atomic_load_n(&context->history->retransmitted, __ATOMIC_RELAXED));
+        switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Shimaore-NACK-Unavailable", "%lu",
+                                (unsigned long) __atomic_load_n(&context->history->unavailable, __ATOMIC_RELAXED));
+    }
+
+    if (context->latency) {
+        for (int stage = 0; stage < SHIMAORE_LATENCY_STAGES; stage++) {
+            uint32_t total = shimaore_latency_count(context->latency, stage);
+
+            if (total == 0) {
+                continue;
+            }
+            /* e.g. Shimaore-Latency-Syscall-P99, in microseconds */
+            for (int i = 0; i < sizeof(shimaore_latency_percentiles) / sizeof(shimaore_latency_percentiles[0]); i++) {
+                switch_snprintf(name, sizeof(name), "Shimaore-Latency-%s-P%u", shimaore_latency_names[stage], shimaore_latency_percentiles[i]);
+                name[17] = switch_toupper(name[17]);
+                switch_event_add_header(event, SWITCH_STACK_BOTTOM, name, "%lu",
+                                        (unsigned long) shimaore_latency_percentile(context->latency, stage, total, shimaore_latency_percentiles[i]));
+            }
+            switch_snprintf(name, sizeof(name), "Shimaore-Latency-%s-Max", shimaore_latency_names[stage]);
+            name[17] = switch_toupper(name[17]);
+            switch_event_add_header(event, SWITCH_STACK_BOTTOM, name, "%u", context->latency->maximum[stage]);
+        }
+    }
+    switch_event_fire(&event);
+}
+
+/* Media thread, end of the audio: send what is left and the stop packet, then let go of the tap */
+static void shimaore_context_close(shimaore_context_t *context) {
+    /* No sender report after the stop packet: let one being sent go first */
+    __atomic_store_n(&context->closing, SWITCH_TRUE, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&context->rtcp_reporting, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    if (context->config && context->buncher_position > 0) {
+        shimaore_send(context);
+    }
+    shimaore_send_stop(context);
+    SHIMAORE_PROBE4(tap_stop, context->uuid, context->rtp_ssrc, context->sent_attempted, context->sent_successful);
+    if (context->zerocopy) {
+        shimaore_zerocopy_flush(context);
+    }
+    if (context->latency && context->latency->kernel) {
+        /* Leave a clean socket to the next tap */
+        shimaore_errqueue_drain(context);
+        shimaore_latency_kernel(context, SWITCH_FALSE);
+    }
+    if (context->config) {
+        shimaore_stats_event(context);
+    }
+    shimaore_nack_unlisten(context);
+    shimaore_destination_detach(context);
+    shimaore_context_unregister(context);
+    /* Packets still queued on the send engine keep the context alive */
+    shimaore_context_put(context);
+}
+
+/* Media thread: a frame of `len` bytes was just placed at the end of the bunch; send the bunch
+ * once it is full.
+ */
+static void shimaore_buncher_commit(shimaore_context_t *context, uint32_t len) {
+    if (context->latency && context->buncher_frame_count == 0) {
+        context->latency->bunch_read = switch_time_ref();
+    }
+
+    /* The frame just read ended now */
+    if (context->rtp_template.capture_time_offset && context->buncher_frame_count == 0) {
+        context->bunch_capture_time = switch_micro_time_now() -
+            (context->timestamp_rate ? (switch_time_t) len * 1000000 / context->timestamp_rate : 0);
+    }
+
+    /* Append to the buffer */
+    context->buncher_position += len;
+    context->buncher_frame_count += 1;
+
+    /* If there is no room left for another frame or we already processed the proper number of frames, send out and reset. */
+    if (context->buncher_position + context->frame_bytes > context->buncher_capacity || context->buncher_frame_count >= context->config->buncher_maximum) {
+        shimaore_send(context);
+    }
+}
+
+static switch_bool_t shimaore_unicast_bug_callback(switch_media_bug_t *bug, void *user_data, switch_abc_type_t type)
+{
+    shimaore_context_t *context = (shimaore_context_t *) user_data;
+    if (!context) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "No context in callback!\n");
+        return SWITCH_TRUE;
+    }
+
+    switch (type) {
+    case SWITCH_ABC_TYPE_INIT:
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: init");
+            /* An armed tap starts in shimaore_preroll_go_live */
+            if (context->config) {
+                SHIMAORE_PROBE3(tap_start, context->uuid, context->rtp_ssrc, context->destination ? context->destination->name : "");
+                shimaore_nack_listen(context);
+            }
+            shimaore_send_start(context);
+        }
+        break;
+    case SWITCH_ABC_TYPE_CLOSE:
+        {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: close: attempted %ld, successful %ld", context->sent_attempted, context->sent_successful);
+            shimaore_context_close(context);
+        }
+        break;
+    case SWITCH_ABC_TYPE_READ:
+        {
+            // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: read");
+
+            if (globals.engine_follow_cpu && !context->engine_pinned) {
+                shimaore_engine_follow_cpu(context);
+            }
+
+            {
+                shimaore_config_t *config = __atomic_load_n(&context->published_config, __ATOMIC_ACQUIRE);
+
+                /* Even while paused, so that the next `update` may reclaim the configuration this one replaced */
+                if (config != context->config) {
+                    if (context->config) {
+                        shimaore_config_apply(context, config);
+                    } else if (!__atomic_load_n(&context->paused, __ATOMIC_ACQUIRE)) {
+                        shimaore_preroll_go_live(context, config);
+                    }
+                }
+            }
+
+            if (__atomic_load_n(&context->paused, __ATOMIC_ACQUIRE)) {
+                if (!context->was_paused) {
+                    /* Deliver what was captured before the pause */
+                    if (context->config && context->buncher_position > 0) {
+                        shimaore_send(context);
+                    }
+                    context->was_paused = SWITCH_TRUE;
+                }
+                /* Drop the frame without copying it, but let time pass for the consumer */
+                switch_core_media_bug_flush(bug);
+                context->rtp_timestamp += context->frame_bytes;
+                return SWITCH_TRUE;
+            }
+            context->was_paused = SWITCH_FALSE;
+
+            if (!context->config) {
+                /* Armed only: record into the pre-roll ring */
+                switch_frame_t read_frame = { 0 };
+                read_frame.data = context->buncher_buffer;
+                read_frame.buflen = context->buncher_capacity;
+
+                if (switch_core_media_bug_read(bug, &read_frame, SWITCH_FALSE) == SWITCH_STATUS_SUCCESS) {
+                    context->frame_bytes = read_frame.datalen;
+                    shimaore_preroll_record(context, read_frame.data, read_frame.datalen);
+                }
+                return SWITCH_TRUE;
+            }
+
+            if (!context->socket) {
+                // switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "No socket in callback!\n");
+                return SWITCH_TRUE;
+            }
+
+            /* Not enough room left for a frame (e.g. the codec changed): send what we have, grow if needed */
+            if (context->buncher_capacity - context->buncher_position < context->frame_bytes) {
+                if (context->buncher_position > 0) {
+                    shimaore_send(context);
+                }
+                if (context->buncher_capacity < context->frame_bytes &&
+                    shimaore_buncher_reserve(context, 1, context->frame_bytes) != SWITCH_STATUS_SUCCESS) {
+                    switch_core_media_bug_flush(bug);
+                    return SWITCH_TRUE;
+                }
+            }
+
+            {
+                uint32_t flags = 0;
+                switch_frame_t read_frame = { 0 };
+                read_frame.data = context->buncher_buffer + context->buncher_position;
+                read_frame.buflen = context->buncher_capacity - context->buncher_position;
+
+                // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: reading frame");
+                if (switch_core_media_bug_read(bug, &read_frame, SWITCH_FALSE) != SWITCH_STATUS_SUCCESS) {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: no frame");
+                    return SWITCH_TRUE;
+                }
+
+                context->frame_bytes = read_frame.datalen;
+                SHIMAORE_PROBE4(frame_read, context->uuid, context->rtp_ssrc, read_frame.datalen, context->buncher_frame_count);
+
+                if (context->preroll_ring) {
+                    shimaore_preroll_record(context, read_frame.data, read_frame.datalen);
+                    if (context->preroll_catching_up) {
+                        /* The frame is in the ring; bunches come out of the ring until we catch up */
+                        shimaore_preroll_drain(context);
+                        return SWITCH_TRUE;
+                    }
+                }
+
+                // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: got frame %d\n", read_frame.datalen);
+                shimaore_buncher_commit(context, read_frame.datalen);
+            }
+        }
+        break;
+    default:
+        // switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(switch_core_media_bug_get_session(bug)), SWITCH_LOG_INFO, "bug: other");
+        break;
+    }
+
+    return SWITCH_TRUE;
+}
+
+inline uint8_t hexdigit(char c) {
+  const char hex[] = "0123456789abcdef";
+  const char *p = strchr(hex,c);
+  if (p == NULL) return 0;
+  return p-hex;
+}
+
+uint8_t hex(const char* str) {
+  return hexdigit(str[0]) << 4 | hexdigit(str[1]);
+}
+
+/* Configuration options shared by `start` and `update`.
+ * Returns SWITCH_STATUS_NOTFOUND for keys that are not configuration options.
+ */
+static switch_status_t shimaore_config_option(shimaore_config_t *config, const char *key, char *value,
+                                              char **remote, switch_bool_t *remote_changed, switch_memory_pool_t *pool) {
+    if (!strcmp(key,"remote_ip")) {
+        config->remote_ip = switch_core_strdup(pool, value);
+        *remote_changed = SWITCH_TRUE;
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!strcmp(key,"remote_port")) {
+        config->remote_port = atoi(value);
+        *remote_changed = SWITCH_TRUE;
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!strcmp(key,"remote")) {
+        *remote = value;
+        *remote_changed = SWITCH_TRUE;
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!strcmp(key,"balance")) {
+        if (!strcmp(value,"hash")) {
+            config->balance = SHIMAORE_BALANCE_HASH;
+        } else if (!strcmp(value,"least")) {
+            config->balance = SHIMAORE_BALANCE_LEAST;
+        } else {
+            return SWITCH_STATUS_FALSE;
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!strcmp(key,"frames_per_packet")) {
+        int count = atoi(value);
+        if (count <= 0 || count > BUNCHER_MAXIMUM_PACKET_COUNT) {
+            return SWITCH_STATUS_FALSE;
+        }
+        config->buncher_maximum = count;
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!strcmp(key,"meta")) {
+        config->meta_length = strlen(value)/2;
+        config->meta = (uint8_t *) switch_core_alloc(pool, config->meta_length + 1);
+        for (int i = 0; i < config->meta_length; i ++) {
+          config->meta[i] = hex(value+i*2);
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+    return SWITCH_STATUS_NOTFOUND;
+}
+
+/* Tap sockets are IPv4 only */
+static switch_bool_t shimaore_ipv6_literal(const char *ip) {
+    return *ip == '[' || strchr(ip, ':') != NULL;
+}
+
+/* Build the destination group: either `remote=` or the single `remote_ip`/`remote_port` pair */
+static switch_status_t shimaore_config_destinations(shimaore_config_t *config, char *remote, switch_stream_handle_t *stream) {
+    config->destination_count = 0;
+
+    if (remote) {
+        char *members[SHIMAORE_DESTINATION_MAXIMUM] = { 0 };
+        int count = 1;
+
+        for (const char *p = remote; *p; p++) {
+            count += *p == ',';
+        }
+        if (count > SHIMAORE_DESTINATION_MAXIMUM) {
+            stream->write_function(stream, "-ERR At most %d remote destinations!\n", SHIMAORE_DESTINATION_MAXIMUM);
+            return SWITCH_STATUS_GENERR;
+        }
+        count = switch_separate_string(remote, ',', members, SHIMAORE_DESTINATION_MAXIMUM);
+
+        for (int i = 0; i < count; i++) {
+            char *colon = strrchr(members[i], ':');
+            shimaore_destination_t *destination;
+            int port;
+
+            if (colon == NULL || (port = atoi(colon+1)) <= 0) {
+                return SWITCH_STATUS_FALSE;
+            }
+            *colon = '\0';
+            if (shimaore_ipv6_literal(members[i])) {
+                stream->write_function(stream, "-ERR IPv6 remote %s is not supported!\n", members[i]);
+                return SWITCH_STATUS_GENERR;
+            }
+            if (!(destination = shimaore_destination_get(members[i], port))) {
+                stream->write_function(stream, "-ERR Failure for remote %s!\n", members[i]);
+                return SWITCH_STATUS_GENERR;
+            }
+            config->destinations[config->destination_count++] = destination;
+        }
+        config->remote_ip = NULL;
+        config->remote_port = 0;
+    } else if (config->remote_ip && config->remote_port > 0) {
+        if (shimaore_ipv6_literal(config->remote_ip)) {
+            stream->write_function(stream, "-ERR IPv6 remote %s is not supported!\n", config->remote_ip);
+            return SWITCH_STATUS_GENERR;
+        }
+        if (!(config->destinations[0] = shimaore_destination_get(config->remote_ip, config->remote_port))) {
+            stream->write_function(stream, "-ERR Failure for remote!\n");
+            return SWITCH_STATUS_GENERR;
+        }
+        config->destination_count = 1;
+    }
+
+    return config->destination_count > 0 ? SWITCH_STATUS_SUCCESS : SWITCH_STATUS_FALSE;
+}
+
+/* Options of `start`, parsed once and usable for any number of sessions */
+typedef struct shimaore_options_s {
+    /* Template for each tap's initial configuration */
+    shimaore_config_t config;
+    shimaore_framing_t framing;
+    /* Mel bands of `framing=features` */
+    uint32_t features_bands;
+    uint32_t rtp_ssrc;
+    shimaore_rtcp_t rtcp;
+    /* RFC 8285 extension identifier of abs-capture-time, 0 for none */
+    uint8_t capture_time_id;
+    /* `levels=`: meters, and the extension identifier to send them with (0 for none) */
+    switch_bool_t levels;
+    uint8_t levels_id;
+    shimaore_latency_mode_t latency;
+    /* `nack=`: bunches kept for retransmission, 0 for none */
+    uint32_t nack_history;
+    shimaore_fec_t fec;
+    /* `fec=parity:<k>` */
+    uint32_t fec_group;
+    const char *local_ip;
+    int local_port;
+    switch_port_t port_range_min;
+    switch_port_t port_range_max;
+    /* Only meaningful on an armed tap */
+    uint32_t preroll_ms;
+} shimaore_options_t;
+
+/* Parse the `key=value` options of `start`; `argv` is modified in place.
+ * Returns SWITCH_STATUS_FALSE on a syntax error, SWITCH_STATUS_GENERR when an error was
+ * already reported on `stream`.
+ */
+static switch_status_t shimaore_options_parse(shimaore_options_t *options, int argc, char **argv,
+                                              switch_memory_pool_t *pool, switch_stream_handle_t *stream) {
+    char *remote = NULL;
+    switch_bool_t remote_changed = SWITCH_FALSE;
+
+    memset(options, 0, sizeof(*options));
+    options->config.buncher_maximum = BUNCHER_MAXIMUM_PACKET_COUNT;
+    options->config.balance = SHIMAORE_BALANCE_HASH;
+    options->config.remote_ip = "127.0.0.1";
+    options->framing = SHIMAORE_FRAMING_PLAIN;
+    options->features_bands = SHIMAORE_FEATURES_BANDS_DEFAULT;
+    options->local_ip = "127.0.0.1";
+    options->port_range_min = globals.port_range_min;
+    options->port_range_max = globals.port_range_max;
+
+    if (argc < 1) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        char *key = argv[i];
+        char *sign = strchr(argv[i],'=');
+        if (sign == NULL) {
+            return SWITCH_STATUS_FALSE;
+        }
+        char *value = sign+1;
+        if (*value == '\0') {
+            return SWITCH_STATUS_FALSE;
+        }
+        *sign = '\0';
+        switch (shimaore_config_option(&options->config, key, value, &remote, &remote_changed, pool)) {
+            case SWITCH_STATUS_SUCCESS:
+                continue;
+            case SWITCH_STATUS_NOTFOUND:
+                break;
+            default:
+                return SWITCH_STATUS_FALSE;
+        }
+        if (!strcmp(key,"local_ip")) {
+            options->local_ip = value;
+            continue;
+        }
+        if (!strcmp(key,"local_port")) {
+            options->local_port = atoi(value);
+            if (options->local_port <= 0) {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"local_port_range")) {
+            if (shimaore_port_range_parse(value, &options->port_range_min, &options->port_range_max) != SWITCH_STATUS_SUCCESS) {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"rtp_ssrc")) {
+            /* Implies RTP framing */
+            if (options->framing == SHIMAORE_FRAMING_PLAIN) {
+                options->framing = SHIMAORE_FRAMING_RTP_L16;
+            }
+            options->rtp_ssrc = atoi(value);
+            continue;
+        }
+        if (!strcmp(key,"framing")) {
+            if (!strcmp(value, "plain")) {
+                options->framing = SHIMAORE_FRAMING_PLAIN;
+            } else if (!strcmp(value, "rtp")) {
+                options->framing = SHIMAORE_FRAMING_RTP_L16;
+            } else if (!strcmp(value, "features")) {
+                options->framing = SHIMAORE_FRAMING_FEATURES;
+            } else if (!strcmp(value, "lossless")) {
+                options->framing = SHIMAORE_FRAMING_LOSSLESS;
+            } else {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"features_bands")) {
+            options->features_bands = atoi(value);
+            if (options->features_bands < 1 || options->features_bands > SHIMAORE_FEATURES_BANDS_MAXIMUM) {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"preroll_ms")) {
+            options->preroll_ms = atoi(value);
+            continue;
+        }
+        if (!strcmp(key,"abs_capture_time")) {
+            int id = atoi(value);
+            if (id < 1 || id > SHIMAORE_RTP_EXTENSION_ID_MAXIMUM) {
+                return SWITCH_STATUS_FALSE;
+            }
+            options->capture_time_id = id;
+            continue;
+        }
+        if (!strcmp(key,"levels")) {
+            int id = atoi(value);
+            if (!strcmp(value,"off")) {
+                options->levels = SWITCH_FALSE;
+                options->levels_id = 0;
+            } else if (!strcmp(value,"on")) {
+                options->levels = SWITCH_TRUE;
+                options->levels_id = 0;
+            } else if (id >= 1 && id <= SHIMAORE_RTP_EXTENSION_ID_MAXIMUM) {
+                options->levels = SWITCH_TRUE;
+                options->levels_id = id;
+            } else {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"latency")) {
+            if (!strcmp(value,"off")) {
+                options->latency = SHIMAORE_LATENCY_OFF;
+            } else if (!strcmp(value,"on")) {
+                options->latency = SHIMAORE_LATENCY_ON;
+            } else if (!strcmp(value,"kernel")) {
+                options->latency = SHIMAORE_LATENCY_WITH_KERNEL;
+            } else {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"nack")) {
+            int size = atoi(value);
+            if (!strcmp(value,"off")) {
+                options->nack_history = 0;
+            } else if (!strcmp(value,"on")) {
+                options->nack_history = SHIMAORE_NACK_HISTORY_DEFAULT;
+            } else if (size >= 1 && size <= SHIMAORE_NACK_HISTORY_MAXIMUM) {
+                options->nack_history = size;
+            } else {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"fec")) {
+            if (!strcmp(value,"off")) {
+                options->fec = SHIMAORE_FEC_OFF;
+            } else if (!strcmp(value,"red")) {
+                options->fec = SHIMAORE_FEC_RED;
+            } else if (!strncmp(value,"parity:",7)) {
+                options->fec = SHIMAORE_FEC_PARITY;
+                options->fec_group = atoi(value + 7);
+                if (options->fec_group < 2 || options->fec_group > SHIMAORE_PARITY_GROUP_MAXIMUM) {
+                    return SWITCH_STATUS_FALSE;
+                }
+            } else {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        if (!strcmp(key,"rtcp")) {
+            if (!strcmp(value,"off")) {
+                options->rtcp = SHIMAORE_RTCP_OFF;
+            } else if (!strcmp(value,"mux")) {
+                options->rtcp = SHIMAORE_RTCP_MUX;
+            } else if (!strcmp(value,"port")) {
+                options->rtcp = SHIMAORE_RTCP_PORT;
+            } else {
+                return SWITCH_STATUS_FALSE;
+            }
+            continue;
+        }
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* Sender reports, header extensions, retransmissions and FEC need an RTP stream */
+    if ((options->rtcp != SHIMAORE_RTCP_OFF || options->capture_time_id || options->levels_id || options->nack_history ||
+         options->fec != SHIMAORE_FEC_OFF) &&
+        options->framing == SHIMAORE_FRAMING_PLAIN) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if (options->local_port == 0 && options->port_range_min == 0) {
+        options->local_port = SHIMAORE_DEFAULT_LOCAL_PORT;
+    }
+
+    return shimaore_config_destinations(&options->config, remote, stream);
+}
+
+/* What starting a tap takes besides its audio source: framing, configuration, socket and
+ * destination. `rate` and `channels` describe the audio; the tap's own copy of the configuration
+ * is returned in `config`, for the context to free. Errors are reported on `stream`; `session`
+ * is only used for logging and may be NULL.
+ */
+static switch_status_t shimaore_context_open(shimaore_context_t *context, const shimaore_options_t *options, uint32_t rate,
+                                             uint32_t channels, shimaore_config_t **config_out,
+                                             switch_core_session_t *session, switch_stream_handle_t *stream) {
+    int local_port = options->local_port;
+
+    context->framing = options->framing;
+    context->framing_ops = &shimaore_framings[options->framing];
+    context->rtp_ssrc = options->rtp_ssrc;
+    context->rtp_sequence_number = rand();
+    context->rtp_timestamp = rand();
+    shimaore_rtp_template_init(&context->rtp_template, context->rtp_ssrc, options->capture_time_id, options->levels_id);
+    memset(&context->levels, 0, sizeof(context->levels));
+    context->levels.enabled = options->levels;
+    context->levels.rms = context->levels.peak = SHIMAORE_LEVEL_SILENCE;
+    context->rtcp = options->rtcp;
+    context->timestamp_rate = rate * channels * 2;
+    context->channels = channels;
+
+    if (options->framing == SHIMAORE_FRAMING_FEATURES) {
+        context->rtp_template.header[1] = SHIMAORE_PT_FEATURES;
+        if (!context->features && !(context->features = (shimaore_features_t *) shimaore_slab_alloc(sizeof(*context->features)))) {
+            stream->write_function(stream, "-ERR Failure allocating feature tables!\n");
+            return SWITCH_STATUS_FALSE;
+        }
+        if (channels != 1 || shimaore_features_init(context->features, rate, options->features_bands) < 0) {
+            stream->write_function(stream, "-ERR Features need mono audio at 100 Hz to 48 kHz!\n");
+            return SWITCH_STATUS_FALSE;
+        }
+    }
+    if (options->framing == SHIMAORE_FRAMING_LOSSLESS) {
+        context->rtp_template.header[1] = SHIMAORE_PT_LOSSLESS;
+    }
+    if (shimaore_fec_check(context, options->fec, options->config.buncher_maximum, stream) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_FALSE;
+    }
+    /* Left over by a failed start of an armed tap, maybe with other `fec=` options */
+    shimaore_fec_free(context);
+    if (shimaore_fec_alloc(context, options->fec, options->fec_group) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR Failure allocating FEC state!\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    context->destination = NULL;
+
+
+    /** Create socket */
+    {
+        shimaore_destination_t *destination = shimaore_destination_select(context, &options->config, NULL);
+
+        /* A pooled context comes with its socket already bound */
+        if (!context->socket) {
+            if (switch_socket_create(&context->socket, AF_INET, SOCK_DGRAM, 0, context->pool) != SWITCH_STATUS_SUCCESS) {
+                stream->write_function(stream, "-ERR Failure creating socket!\n");
+                context->socket = NULL;
+                return SWITCH_STATUS_FALSE;
+            }
+
+            if (switch_socket_opt_set(context->socket, SWITCH_SO_REUSEADDR, 1) != SWITCH_STATUS_SUCCESS) {
+                stream->write_function(stream, "-ERR Failure setting socket re-use!\n");
+                return SWITCH_STATUS_FALSE;
+            }
+
+            if (switch_socket_opt_set(context->socket, SWITCH_SO_NONBLOCK, 1) != SWITCH_STATUS_SUCCESS) {
+                stream->write_function(stream, "-ERR Failure setting socket non-blocking!\n");
+                return SWITCH_STATUS_FALSE;
+            }
+
+            if (shimaore_socket_bind(context, options->local_ip, local_port, options->port_range_min, options->port_range_max,
+                                     context->pool) != SWITCH_STATUS_SUCCESS) {
+                stream->write_function(stream, "-ERR Failure binding socket!\n");
+                return SWITCH_STATUS_FALSE;
+            }
+            switch_copy_string(context->local_ip, options->local_ip, sizeof(context->local_ip));
+            switch_os_sock_get(&context->fd, context->socket);
+        }
+        if (context->allocated_port) {
+            local_port = context->allocated_port;
+        }
+
+        if (options->latency != SHIMAORE_LATENCY_OFF && !context->latency) {
+            if (!(context->latency = (shimaore_latency_t *) shimaore_slab_alloc(sizeof(*context->latency)))) {
+                stream->write_function(stream, "-ERR Failure allocating latency histograms!\n");
+                return SWITCH_STATUS_FALSE;
+            }
+            memset(context->latency, 0, sizeof(*context->latency));
+            if (options->latency == SHIMAORE_LATENCY_WITH_KERNEL) {
+                if (shimaore_latency_kernel(context, SWITCH_TRUE) == SWITCH_STATUS_SUCCESS) {
+                    context->latency->kernel = SWITCH_TRUE;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_WARNING, "No kernel TX timestamps on this socket\n");
+                }
+            }
+        }
+
+        if (options->nack_history && !context->history && shimaore_history_alloc(context, options->nack_history) != SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "-ERR Failure allocating retransmission history!\n");
+            return SWITCH_STATUS_FALSE;
+        }
+
+        /* Only bunches of at least the threshold go zero-copy; the option stays on a pooled socket */
+        if (globals.zerocopy_threshold && shimaore_zerocopy_enable(context) != SWITCH_STATUS_SUCCESS) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "No MSG_ZEROCOPY on this socket\n");
+        }
+
+        /* Kept with a pooled context, like the RTP socket */
+        if (options->rtcp == SHIMAORE_RTCP_PORT && !context->rtcp_socket) {
+            if (switch_socket_create(&context->rtcp_socket, AF_INET, SOCK_DGRAM, 0, context->pool) != SWITCH_STATUS_SUCCESS) {
+                stream->write_function(stream, "-ERR Failure creating RTCP socket!\n");
+                context->rtcp_socket = NULL;
+                return SWITCH_STATUS_FALSE;
+            }
+            switch_socket_opt_set(context->rtcp_socket, SWITCH_SO_NONBLOCK, 1);
+        }
+
+        if (shimaore_destination_attach(context, destination) != SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "-ERR Failure connecting socket!\n");
+            return SWITCH_STATUS_FALSE;
+        }
+
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Created unicast connection %s:%d->%s\n",
+                          options->local_ip, local_port, destination->name);
+    }
+
+    /* The template may belong to a shorter-lived pool: take our own copy */
+    if (!(*config_out = shimaore_config_copy(&options->config))) {
+        stream->write_function(stream, "-ERR Failure allocating configuration!\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Start a tap on `session`. Returns SWITCH_STATUS_SUCCESS once the media bug is attached;
+ * errors are reported on `stream`.
+ */
+static switch_status_t shimaore_unicast_start(switch_core_session_t *session, const shimaore_options_t *options,
+                                              switch_stream_handle_t *stream) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    shimaore_context_t *context;
+    shimaore_config_t *config;
+    switch_media_bug_t *armed_bug;
+    const char *function = "shimaore_unicast";
+
+    if ((armed_bug = (switch_media_bug_t *) switch_channel_get_private(channel, SHIMAORE_UNICAST_BUG))) {
+        /* An armed tap is started in place; its media thread is running and only looks at
+         * the fields set below once it sees the published configuration.
+         */
+        context = (shimaore_context_t *) switch_core_media_bug_get_user_data(armed_bug);
+        if (!context->preroll_ring || __atomic_load_n(&context->published_config, __ATOMIC_ACQUIRE)) {
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "already started\n");
+            stream->write_function(stream, "-ERR Unicast already activated\n");
+            return SWITCH_STATUS_FALSE;
+        }
+        context->preroll_ms = options->preroll_ms;
+    } else {
+        if (!(context = shimaore_context_acquire(options->local_ip, options->local_port,
+                                                 options->port_range_min, options->port_range_max))) {
+            stream->write_function(stream, "-ERR Failure allocating context!\n");
+            return SWITCH_STATUS_FALSE;
+        }
+        switch_copy_string(context->uuid, switch_core_session_get_uuid(session), sizeof(context->uuid));
+        context->uuid_hash = shimaore_hash(context->uuid);
+        context->engine = shimaore_engine_for(context);
+        context->buncher_position = 0;
+        context->buncher_frame_count = 0;
+        context->paused = 0;
+        context->was_paused = SWITCH_FALSE;
+        {
+            switch_codec_implementation_t read_impl = { 0 };
+            switch_core_session_get_read_impl(session, &read_impl);
+            context->frame_bytes = read_impl.decoded_bytes_per_packet;
+        }
+    }
+    {
+        switch_codec_implementation_t read_impl = { 0 };
+
+        switch_core_session_get_read_impl(session, &read_impl);
+        if (shimaore_context_open(context, options, read_impl.actual_samples_per_second, read_impl.number_of_channels,
+                                  &config, session, stream) != SWITCH_STATUS_SUCCESS) {
+            goto fail;
+        }
+    }
+
+    if (armed_bug) {
+        /* Hand over to the media thread, which sends the start packet and the pre-roll */
+        __atomic_store_n(&context->published_config, config, __ATOMIC_RELEASE);
+        return SWITCH_STATUS_SUCCESS;
+    }
+    context->config = config;
+    context->published_config = config;
+
+    if (shimaore_buncher_reserve(context, config->buncher_maximum, context->frame_bytes) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR Failure allocating buffer!\n");
+        goto fail;
+    }
+
+    /** Create media bug */
+    {
+        switch_media_bug_flag_t flags = SMBF_READ_STREAM;
+        switch_media_bug_t *bug;
+        switch_status_t status;
+
+        shimaore_context_register(context);
+        if ((status = switch_core_media_bug_add(session, function, NULL,
+                                                shimaore_unicast_bug_callback, context, 0, flags, &bug)) != SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "-ERR Failure!\n");
+            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Creating media bug failed");
+            shimaore_context_unregister(context);
+            goto fail;
+        }
+
+        switch_channel_set_private(channel, SHIMAORE_UNICAST_BUG, bug);
+        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Created media bug");
+    }
+
+    return SWITCH_STATUS_SUCCESS;
+
+ fail:
+    shimaore_destination_detach(context);
+    /* When armed, the media bug still owns the context, which stays armed */
+    if (!armed_bug) {
+        shimaore_context_release(context);
+    }
+    return SWITCH_STATUS_FALSE;
+}
+
+/* Attach a media bug that only records the last `history_ms` of read audio, for a later
+ * `start ... preroll_ms=`.
+ */
+static switch_status_t shimaore_unicast_arm(switch_core_session_t *session, uint32_t history_ms, switch_stream_handle_t *stream) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_codec_implementation_t read_impl = { 0 };
+    shimaore_context_t *context;
+    switch_media_bug_t *bug;
+    uint32_t frames;
+
+    if (switch_channel_get_private(channel, SHIMAORE_UNICAST_BUG)) {
+        stream->write_function(stream, "-ERR Unicast already activated\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_core_session_get_read_impl(session, &read_impl);
+    if (read_impl.decoded_bytes_per_packet == 0 || read_impl.microseconds_per_packet == 0) {
+        stream->write_function(stream, "-ERR No read codec!\n");
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* No local_port: never takes a pooled socket, which would sit idle while armed */
+    if (!(context = shimaore_context_acquire("", -1, 0, 0))) {
+        stream->write_function(stream, "-ERR Failure allocating context!\n");
+        return SWITCH_STATUS_FALSE;
+    }
+    switch_copy_string(context->uuid, switch_core_session_get_uuid(session), sizeof(context->uuid));
+    context->uuid_hash = shimaore_hash(context->uuid);
+    context->engine = shimaore_engine_for(context);
+    context->frame_bytes = read_impl.decoded_bytes_per_packet;
+
+    /* Whole frames only */
+    frames = (history_ms * 1000 + read_impl.microseconds_per_packet - 1) / read_impl.microseconds_per_packet;
+    context->preroll_size = frames * read_impl.decoded_bytes_per_packet;
+    context->preroll_bytes_per_ms = read_impl.decoded_bytes_per_packet * 1000 / read_impl.microseconds_per_packet;
+    context->preroll_ring = (uint8_t *) switch_core_alloc(context->pool, context->preroll_size);
+    /* Frames are read here before going into the ring; grown on start */
+    if (shimaore_buncher_reserve(context, 1, context->frame_bytes) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR Failure allocating buffer!\n");
+        shimaore_context_release(context);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    shimaore_context_register(context);
+    if (switch_core_media_bug_add(session, "shimaore_unicast", NULL,
+                                  shimaore_unicast_bug_callback, context, 0, SMBF_READ_STREAM, &bug) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR Failure!\n");
+        shimaore_context_unregister(context);
+        shimaore_context_release(context);
+        return SWITCH_STATUS_FALSE;
+    }
+    switch_channel_set_private(channel, SHIMAORE_UNICAST_BUG, bug);
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Armed with %ums of pre-roll\n", history_ms);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t shimaore_unicast_stop(switch_core_session_t *session) {
+    switch_channel_t *channel = switch_core_session_get_channel(session);
+    switch_media_bug_t *bug;
+
+    if (!(bug = (switch_media_bug_t *) switch_channel_get_private(channel, SHIMAORE_UNICAST_BUG))) {
+        return SWITCH_STATUS_NOTFOUND;
+    }
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_DEBUG, "media bug found\n");
+    switch_channel_set_private(channel, SHIMAORE_UNICAST_BUG, NULL);
+    switch_core_media_bug_remove(session, &bug);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Counters are read racily from the media thread, which is fine for display */
+static void shimaore_unicast_status(shimaore_context_t *context, switch_stream_handle_t *stream) {
+    shimaore_destination_t *destination = context->destination;
+
+    stream->write_function(stream, "+OK\n");
+    stream->write_function(stream, "state: %s\n", !context->config ? "armed" : context->paused ? "paused" : "running");
+    stream->write_function(stream, "destination: %s\n", destination ? destination->name : "none");
+    stream->write_function(stream, "ssrc: %u\n", context->rtp_ssrc);
+    stream->write_function(stream, "sent: %lu attempted, %lu successful, %lu octets\n",
+                           (unsigned long) context->sent_attempted, (unsigned long) context->sent_successful, (unsigned long) context->sent_octets);
+
+    if (context->levels.enabled) {
+        stream->write_function(stream, "levels: rms -%u dBov, peak -%u dBov, %u clipped samples over the last second, %lu in total\n",
+                               __atomic_load_n(&context->levels.second_rms, __ATOMIC_RELAXED),
+                               __atomic_load_n(&context->levels.second_peak, __ATOMIC_RELAXED),
+                               __atomic_load_n(&context->levels.second_clipped, __ATOMIC_RELAXED),
+                               (unsigned long) __atomic_load_n(&context->levels.clipped_total, __ATOMIC_RELAXED));
+    }
+
+    if (context->zerocopy) {
+        stream->write_function(stream, "zerocopy: %lu sent, %lu copied by the kernel, %lu fallbacks, %u pending%s\n",
+                               (unsigned long) context->zerocopy->sent, (unsigned long) context->zerocopy->copied,
+                               (unsigned long) context->zerocopy->fallbacks, context->zerocopy->pending,
+                               context->zerocopy->disabled ? " (disabled)" : "");
+    }
+
+    if (context->fec_state && context->fec == SHIMAORE_FEC_PARITY) {
+        stream->write_function(stream, "fec: parity every %u bunches, %lu parity packets, %lu groups incomplete\n",
+                               context->fec_group, (unsigned long) context->fec_state->parity_sent,
+                               (unsigned long) context->fec_state->groups_incomplete);
+    } else if (context->fec_state) {
+        stream->write_function(stream, "fec: red, %lu bunches with the previous one\n", (unsigned long) context->fec_state->redundant);
+    }
+
+    /* Counted by the NACK thread */
+    if (context->history) {
+        stream->write_function(stream, "nack: history %u bunches, %lu requested, %lu retransmitted, %lu unavailable\n",
+                               context->history->size,
+                               (unsigned long) __atomic_load_n(&context->history->requested, __ATOMIC_RELAXED),
+                               (unsigned long) __atomic_load_n(&context->history->retransmitted, __ATOMIC_RELAXED),
+                               (unsigned long) __atomic_load_n(&context->history->unavailable, __ATOMIC_RELAXED));
+    }
+
+    if (!context->latency) {
+        return;
+    }
+    stream->write_function(stream, "latency (us)     count       p50       p90       p99       max\n");
+    for (int stage = 0; stage < SHIMAORE_LATENCY_STAGES; stage++) {
+        uint32_t total = shimaore_latency_count(context->latency, stage);
+
+        if (stage == SHIMAORE_LATENCY_KERNEL && !context->latency->kernel) {
+            continue;
+        }
+        stream->write_function(stream, "%-10s %10u %9lu %9lu %9lu %9u\n", shimaore_latency_names[stage], total,
+                               (unsigned long) shimaore_latency_percentile(context->latency, stage, total, 50),
+                               (unsigned long) shimaore_latency_percentile(context->latency, stage, total, 90),
+                               (unsigned long) shimaore_latency_percentile(context->latency, stage, total, 99),
+                               context->latency->maximum[stage]);
+    }
+}
+
+/* Build and publish the configuration for `update`; with `context->updating` set.
+ * Returns SWITCH_STATUS_FALSE when the usage should be shown.
+ */
+static switch_status_t shimaore_unicast_update_config(shimaore_context_t *context, int argc, char **argv,
+                                                      switch_stream_handle_t *stream) {
+    shimaore_config_t *published = context->published_config;
+    shimaore_config_t draft;
+    shimaore_config_t *config;
+    switch_memory_pool_t *scratch = NULL;
+    char *remote = NULL;
+    switch_bool_t remote_changed = SWITCH_FALSE;
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
+
+    if (argc < 1) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if (!published) {
+        stream->write_function(stream, "-ERR Unicast armed, not started\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+    /* Only the configuration the media thread has left may be reclaimed: at most one update in flight */
+    if (__atomic_load_n(&context->config, __ATOMIC_ACQUIRE) != published) {
+        stream->write_function(stream, "-ERR Previous update not applied yet, try again!\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+    shimaore_config_free(context->retired_config);
+    context->retired_config = NULL;
+
+    /* Read-copy-update: strings go to a scratch pool until the copy owns them */
+    if (switch_core_new_memory_pool(&scratch) != SWITCH_STATUS_SUCCESS) {
+        stream->write_function(stream, "-ERR Failure allocating memory!\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+    draft = *published;
+
+    for (int i = 0; i < argc; i++) {
+        char *key = argv[i];
+        char *sign = strchr(argv[i],'=');
+        if (sign == NULL || sign[1] == '\0') {
+            status = SWITCH_STATUS_FALSE;
+            goto done;
+        }
+        *sign = '\0';
+        if (shimaore_config_option(&draft, key, sign+1, &remote, &remote_changed, scratch) != SWITCH_STATUS_SUCCESS) {
+            status = SWITCH_STATUS_FALSE;
+            goto done;
+        }
+    }
+
+    /* A tap sent to `remote=` has no pair to change one half of */
+    if (remote_changed && !remote && (!draft.remote_ip || draft.remote_port <= 0)) {
+        stream->write_function(stream, "-ERR Tap sends to remote=: give remote= or both remote_ip= and remote_port=!\n");
+        goto done;
+    }
+    if (draft.buncher_maximum != published->buncher_maximum &&
+        shimaore_fec_check(context, context->fec, draft.buncher_maximum, stream) != SWITCH_STATUS_SUCCESS) {
+        goto done;
+    }
+    if (remote_changed && (status = shimaore_config_destinations(&draft, remote, stream)) != SWITCH_STATUS_SUCCESS) {
+        if (status != SWITCH_STATUS_FALSE) {
+            status = SWITCH_STATUS_SUCCESS;
+        }
+        goto done;
+    }
+
+    if (!(config = shimaore_config_copy(&draft))) {
+        stream->write_function(stream, "-ERR Failure allocating configuration!\n");
+        goto done;
+    }
+    /* Freed by the next update, once the media thread has switched to `config` */
+    context->retired_config = published;
+    __atomic_store_n(&context->published_config, config, __ATOMIC_RELEASE);
+
+    stream->write_function(stream, "+OK Success\n");
+
+done:
+    switch_core_destroy_memory_pool(&scratch);
+    return status;
+}
+
+/* `update key=value...`: publish a modified copy of the tap's configuration. The caller holds a
+ * reference on `context`; globals.mutex is not held, as destinations may have to be resolved.
+ * Returns SWITCH_STATUS_FALSE when the usage should be shown.
+ */
+static switch_status_t shimaore_unicast_update(shimaore_context_t *context, int argc, char **argv,
+                                               switch_stream_handle_t *stream) {
+    switch_status_t status;
+
+    if (__atomic_test_and_set(&context->updating, __ATOMIC_ACQUIRE)) {
+        stream->write_function(stream, "-ERR Another update in progress, try again!\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+    status = shimaore_unicast_update_config(context, argc, argv, stream);
+    __atomic_clear(&context->updating, __ATOMIC_RELEASE);
+    return status;
+}
+
+/* Run `<action> [key=value...]` against `session`; shared by the API, the dialplan application
+ * and auto-start. Returns SWITCH_STATUS_FALSE when the usage should be shown.
+ */
+static switch_status_t shimaore_unicast_execute(switch_core_session_t *session, int argc, char **argv,
+                                                switch_stream_handle_t *stream) {
+    shimaore_context_t *context;
+    const char *action = argv[0];
+    switch_status_t status;
+
+    if (argc < 1 || zstr(action)) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if (!strcasecmp(action, "stop")) {
+        if (shimaore_unicast_stop(session) == SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "+OK Success\n");
+        } else {
+            stream->write_function(stream, "+OK Not activated\n");
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (!strcasecmp(action, "pause") || !strcasecmp(action, "resume") || !strcasecmp(action, "status")) {
+        /* A hangup may close the tap meanwhile: the reference keeps the context until we are done */
+        if (!(context = shimaore_context_find(switch_core_session_get_uuid(session)))) {
+            stream->write_function(stream, "+OK Not activated\n");
+        } else if (!strcasecmp(action, "status")) {
+            shimaore_unicast_status(context, stream);
+        } else {
+            __atomic_store_n(&context->paused, !strcasecmp(action, "pause"), __ATOMIC_RELEASE);
+            stream->write_function(stream, "+OK Success\n");
+        }
+        if (context) {
+            shimaore_context_put(context);
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (!strcasecmp(action, "arm")) {
+        uint32_t history_ms = SHIMAORE_PREROLL_DEFAULT_MS;
+
+        for (int i = 1; i < argc; i++) {
+            if (strncmp(argv[i], "history_ms=", 11)) {
+                return SWITCH_STATUS_FALSE;
+            }
+            history_ms = atoi(argv[i] + 11);
+        }
+        if (history_ms == 0 || history_ms > SHIMAORE_PREROLL_MAXIMUM_MS) {
+            return SWITCH_STATUS_FALSE;
+        }
+        if (shimaore_unicast_arm(session, history_ms, stream) == SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "+OK Success\n");
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    if (!strcasecmp(action, "update")) {
+        if (!(context = shimaore_context_find(switch_core_session_get_uuid(session)))) {
+            stream->write_function(stream, "-ERR Unicast not activated\n");
+            return SWITCH_STATUS_SUCCESS;
+        }
+        status = shimaore_unicast_update(context, argc-1, argv+1, stream);
+        shimaore_context_put(context);
+        return status;
+    }
+
+    if (!strcasecmp(action, "start")) {
+        shimaore_options_t options;
+
+        switch (shimaore_options_parse(&options, argc-1, argv+1, switch_core_session_get_pool(session), stream)) {
+            case SWITCH_STATUS_SUCCESS:
+                break;
+            case SWITCH_STATUS_FALSE:
+                return SWITCH_STATUS_FALSE;
+            default:
+                return SWITCH_STATUS_SUCCESS;
+        }
+        if (shimaore_unicast_start(session, &options, stream) == SWITCH_STATUS_SUCCESS) {
+            stream->write_function(stream, "+OK Success\n");
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    return SWITCH_STATUS_FALSE;
+}
+
+/*** Conference taps ***/
+
+/* `shimaore_unicast conference:<name> start ...` taps the mix of a conference once, instead of
+ * each of its members. mod_conference is asked to record the conference to `shimaore://<name>`,
+ * a file format provided below: its recording thread then writes the mixed audio to the tap,
+ * one frame per conference interval. The tap is known as `conference:<name>` wherever a channel
+ * UUID would otherwise appear (status, statistics, events).
+ */
+#define SHIMAORE_CONFERENCE_PREFIX "conference:"
+
+typedef struct shimaore_conference_s {
+    /* Holds the options of the tap; destroyed when the file is closed */
+    switch_memory_pool_t *pool;
+    char *name;
+    shimaore_options_t options;
+    /* Set once mod_conference opened the file */
+    switch_bool_t opened;
+    shimaore_context_t *context;
+} shimaore_conference_t;
+
+static const char *shimaore_file_extensions[] = { "shimaore", NULL };
+
+/* Recording thread of the conference */
+static switch_status_t shimaore_file_open(switch_file_handle_t *handle, const char *path) {
+    shimaore_conference_t *conference;
+    shimaore_context_t *context;
+    shimaore_config_t *config;
+    switch_stream_handle_t stream = { 0 };
+
+    if (!switch_test_flag(handle, SWITCH_FILE_FLAG_WRITE) || switch_test_flag(handle, SWITCH_FILE_FLAG_READ)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "shimaore://%s can only be written to\n", path);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    switch_mutex_lock(globals.mutex);
+    if ((conference = (shimaore_conference_t *) switch_core_hash_find(globals.conferences, path)) && !conference->opened) {
+        conference->opened = SWITCH_TRUE;
+    } else {
+        conference = NULL;
+    }
+    switch_mutex_unlock(globals.mutex);
+    if (!conference) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "shimaore://%s: no pending `shimaore_unicast %s%s start`\n",
+                          path, SHIMAORE_CONFERENCE_PREFIX, path);
+        return SWITCH_STATUS_FALSE;
+    }
+
+    if (!(context = shimaore_context_acquire(conference->options.local_ip, conference->options.local_port,
+                                             conference->options.port_range_min, conference->options.port_range_max))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "shimaore://%s: failure allocating context\n", path);
+        goto fail;
+    }
+    switch_snprintf(context->uuid, sizeof(context->uuid), "%s%s", SHIMAORE_CONFERENCE_PREFIX, conference->name);
+    context->uuid_hash = shimaore_hash(context->uuid);
+    context->engine = shimaore_engine_for(context);
+    context->buncher_position = 0;
+    context->buncher_frame_count = 0;
+    context->paused = 0;
+    context->was_paused = SWITCH_FALSE;
+    /* Known with the first write */
+    context->frame_bytes = 0;
+
+    SWITCH_STANDARD_STREAM(stream);
+    if (shimaore_context_open(context, &conference->options, handle->samplerate, handle->channels,
+                              &config, NULL, &stream) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "shimaore://%s: %s", path, (char *) stream.data);
+        switch_safe_free(stream.data);
+        shimaore_destination_detach(context);
+        shimaore_context_release(context);
+        goto fail;
+    }
+    switch_safe_free(stream.data);
+    context->config = config;
+    context->published_config = config;
+
+    shimaore_context_register(context);
+    switch_mutex_lock(globals.mutex);
+    conference->context = context;
+    switch_mutex_unlock(globals.mutex);
+    handle->private_info = conference;
+
+    SHIMAORE_PROBE3(tap_start, context->uuid, context->rtp_ssrc, context->destination ? context->destination->name : "");
+    shimaore_nack_listen(context);
+    shimaore_send_start(context);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s: tapping the mix at %u Hz\n", context->uuid, handle->samplerate);
+    return SWITCH_STATUS_SUCCESS;
+
+ fail:
+    switch_mutex_lock(globals.mutex);
+    switch_core_hash_delete(globals.conferences, conference->name);
+    switch_mutex_unlock(globals.mutex);
+    switch_core_destroy_memory_pool(&conference->pool);
+    return SWITCH_STATUS_FALSE;
+}
+
+/* Recording thread: `*len` samples per channel of signed linear audio, the conference's frame */
+static switch_status_t shimaore_file_write(switch_file_handle_t *handle, void *data, switch_size_t *len) {
+    shimaore_conference_t *conference = (shimaore_conference_t *) handle->private_info;
+    shimaore_context_t *context = conference->context;
+    uint32_t bytes = (uint32_t) (*len * handle->channels * 2);
+    shimaore_config_t *config;
+
+    if (globals.engine_follow_cpu && !context->engine_pinned) {
+        shimaore_engine_follow_cpu(context);
+    }
+
+    /* Even while paused, so that the next `update` may reclaim the configuration this one replaced */
+    if ((config = __atomic_load_n(&context->published_config, __ATOMIC_ACQUIRE)) != context->config) {
+        shimaore_config_apply(context, config);
+    }
+
+    if (__atomic_load_n(&context->paused, __ATOMIC_ACQUIRE)) {
+        if (!context->was_paused) {
+            /* Deliver what was captured before the pause */
+            if (context->buncher_position > 0) {
+                shimaore_send(context);
+            }
+            context->was_paused = SWITCH_TRUE;
+        }
+        /* Let time pass for the consumer */
+        context->rtp_timestamp += bytes;
+        return SWITCH_STATUS_SUCCESS;
+    }
+    context->was_paused = SWITCH_FALSE;
+
+    /* First frame, or the conference interval changed: send what we have, grow if needed */
+    if (bytes != context->frame_bytes || context->buncher_capacity - context->buncher_position < bytes) {
+        if (context->buncher_position > 0) {
+            shimaore_send(context);
+        }
+        context->frame_bytes = bytes;
+        if (context->fec != SHIMAORE_FEC_OFF) {
+            switch_stream_handle_t stream = { 0 };
+
+            SWITCH_STANDARD_STREAM(stream);
+            if (shimaore_fec_check(context, context->fec, context->config->buncher_maximum, &stream) != SWITCH_STATUS_SUCCESS) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "shimaore://%s: %s", conference->name,
+                                  (char *) stream.data);
+                /* Not a single group or redundant block would make it: no FEC rather than a useless one */
+                context->fec = SHIMAORE_FEC_OFF;
+            }
+            switch_safe_free(stream.data);
+        }
+        if (context->buncher_capacity < bytes &&
+            shimaore_buncher_reserve(context, context->config->buncher_maximum, bytes) != SWITCH_STATUS_SUCCESS) {
+            return SWITCH_STATUS_SUCCESS;
+        }
+    }
+
+    memcpy(context->buncher_buffer + context->buncher_position, data, bytes);
+    shimaore_buncher_commit(context, bytes);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Recording thread: the conference ended or `conference <name> norecord` was issued */
+static switch_status_t shimaore_file_close(switch_file_handle_t *handle) {
+    shimaore_conference_t *conference = (shimaore_conference_t *) handle->private_info;
+    shimaore_context_t *context = conference->context;
+
+    /* From now on the API no longer reaches the context or the pool */
+    switch_mutex_lock(globals.mutex);
+    switch_core_hash_delete(globals.conferences, conference->name);
+    switch_mutex_unlock(globals.mutex);
+
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%s: close: attempted %ld, successful %ld\n", context->uuid,
+                      context->sent_attempted, context->sent_successful);
+    shimaore_context_close(context);
+    /* The released context does not refer to the configurations */
+    switch_core_destroy_memory_pool(&conference->pool);
+    handle->private_info = NULL;
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t shimaore_file_read(switch_file_handle_t *handle, void *data, switch_size_t *len) {
+    return SWITCH_STATUS_FALSE;
+}
+
+/* Ask mod_conference to record (or stop recording) the conference to our file */
+static switch_status_t shimaore_conference_record(const char *name, const char *action, switch_stream_handle_t *stream) {
+    switch_stream_handle_t result = { 0 };
+    char *command = switch_mprintf("%s %s shimaore://%s", name, action, name);
+    switch_status_t status = SWITCH_STATUS_FALSE;
+
+    SWITCH_STANDARD_STREAM(result);
+    if (command && switch_api_execute("conference", command, NULL, &result) == SWITCH_STATUS_SUCCESS &&
+        result.data && strncmp((char *) result.data, "-ERR", 4)) {
+        status = SWITCH_STATUS_SUCCESS;
+    } else {
+        stream->write_function(stream, "-ERR conference %s: %s", command ? command : name,
+                               result.data ? (char *) result.data : "failed\n");
+    }
+    switch_safe_free(result.data);
+    switch_safe_free(command);
+    return status;
+}
+
+static switch_status_t shimaore_conference_start(const char *name, int argc, char **argv, switch_stream_handle_t *stream) {
+    shimaore_conference_t *conference;
+    switch_memory_pool_t *pool = NULL;
+    switch_status_t status;
+
+    if (strlen(SHIMAORE_CONFERENCE_PREFIX) + strlen(name) > SWITCH_UUID_FORMATTED_LENGTH) {
+        stream->write_function(stream, "-ERR Conference name too long!\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    switch_core_new_memory_pool(&pool);
+    conference = (shimaore_conference_t *) switch_core_alloc(pool, sizeof(*conference));
+    conference->pool = pool;
+    conference->name = switch_core_strdup(pool, name);
+    if ((status = shimaore_options_parse(&conference->options, argc, argv, pool, stream)) != SWITCH_STATUS_SUCCESS) {
+        switch_core_destroy_memory_pool(&pool);
+        return status == SWITCH_STATUS_FALSE ? SWITCH_STATUS_FALSE : SWITCH_STATUS_SUCCESS;
+    }
+
+    switch_mutex_lock(globals.mutex);
+    if (switch_core_hash_find(globals.conferences, name)) {
+        switch_mutex_unlock(globals.mutex);
+        switch_core_destroy_memory_pool(&pool);
+        stream->write_function(stream, "-ERR Unicast already activated\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+    switch_core_hash_insert(globals.conferences, conference->name, conference);
+    switch_mutex_unlock(globals.mutex);
+
+    /* The recording thread opens the file on its own time */
+    if (shimaore_conference_record(name, "record", stream) != SWITCH_STATUS_SUCCESS) {
+        switch_mutex_lock(globals.mutex);
+        /* Unless opened anyway: the recording thread owns it then (and removes it should the open fail) */
+        if (switch_core_hash_find(globals.conferences, name) == conference && !conference->opened) {
+            switch_core_hash_delete(globals.conferences, name);
+        } else {
+            pool = NULL;
+        }
+        switch_mutex_unlock(globals.mutex);
+        if (pool) {
+            switch_core_destroy_memory_pool(&pool);
+        }
+        return SWITCH_STATUS_SUCCESS;
+    }
+    stream->write_function(stream, "+OK Success\n");
+    return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_status_t shimaore_conference_stop(const char *name, switch_stream_handle_t *stream) {
+    shimaore_conference_t *conference;
+    switch_bool_t opened = SWITCH_FALSE;
+
+    switch_mutex_lock(globals.mutex);
+    if ((conference = (shimaore_conference_t *) switch_core_hash_find(globals.conferences, name)) &&
+        !(opened = conference->opened)) {
+        /* mod_conference never got to open it (e.g. the conference ended first) */
+        switch_core_hash_delete(globals.conferences, name);
     }
+    switch_mutex_unlock(globals.mutex);
 
-    return SWITCH_TRUE;
+    if (!conference) {
+        stream->write_function(stream, "+OK Not activated\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!opened) {
+        switch_core_destroy_memory_pool(&conference->pool);
+    } else if (shimaore_conference_record(name, "norecord", stream) != SWITCH_STATUS_SUCCESS) {
+        return SWITCH_STATUS_SUCCESS;
+    }
+    stream->write_function(stream, "+OK Success\n");
+    return SWITCH_STATUS_SUCCESS;
 }
 
-inline uint8_t hexdigit(char c) {
-  const char hex[] = "0123456789abcdef";
-  const char *p = strchr(hex,c);
-  if (p == NULL) return 0;
-  return p-hex;
-}
+/* Same actions as shimaore_unicast_execute, except `arm`. Returns SWITCH_STATUS_FALSE when the
+ * usage should be shown.
+ */
+static switch_status_t shimaore_conference_execute(const char *name, int argc, char **argv, switch_stream_handle_t *stream) {
+    char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+    shimaore_context_t *context;
+    const char *action = argv[0];
+    switch_status_t status = SWITCH_STATUS_SUCCESS;
 
-uint8_t hex(const char* str) {
-  return hexdigit(str[0]) << 4 | hexdigit(str[1]);
+    if (argc < 1 || zstr(action) || zstr(name)) {
+        return SWITCH_STATUS_FALSE;
+    }
+    if (!strcasecmp(action, "start")) {
+        return shimaore_conference_start(name, argc-1, argv+1, stream);
+    }
+    if (!strcasecmp(action, "stop")) {
+        return shimaore_conference_stop(name, stream);
+    }
+    if (strcasecmp(action, "status") && strcasecmp(action, "pause") && strcasecmp(action, "resume") && strcasecmp(action, "update")) {
+        return SWITCH_STATUS_FALSE;
+    }
+
+    /* Registered under the conference's name while the file is open; the reference outlives a close */
+    switch_snprintf(uuid, sizeof(uuid), "%s%s", SHIMAORE_CONFERENCE_PREFIX, name);
+    if (!(context = shimaore_context_find(uuid))) {
+        stream->write_function(stream, !strcasecmp(action, "update") ? "-ERR Unicast not activated\n" : "+OK Not activated\n");
+        return SWITCH_STATUS_SUCCESS;
+    }
+    if (!strcasecmp(action, "update")) {
+        status = shimaore_unicast_update(context, argc-1, argv+1, stream);
+    } else if (!strcasecmp(action, "status")) {
+        shimaore_unicast_status(context, stream);
+    } else {
+        __atomic_store_n(&context->paused, !strcasecmp(action, "pause"), __ATOMIC_RELEASE);
+        stream->write_function(stream, "+OK Success\n");
+    }
+    shimaore_context_put(context);
+    return status;
 }
 
 /* API Interface Function */
-#define SHIMAORE_UNICAST_API_SYNTAX "<uuid> [start|stop] [remote_port=<port>] [remote_ip=<ip>] [local_ip=<ip>] [local_port=<port>] [frames_per_packet=<count>] [rtp_ssrc=<number>]"
+#define SHIMAORE_UNICAST_API_SYNTAX "<uuid>|conference:<name> [start|stop|update|pause|resume|arm|status] [history_ms=<ms>] [preroll_ms=<ms>] [remote_port=<port>] [remote_ip=<ip>] [remote=<ip>:<port>[,<ip>:<port>...]] [balance=hash|least] [local_ip=<ip>] [local_port=<port>] [local_port_range=<min>-<max>] [frames_per_packet=<count>] [rtp_ssrc=<number>] [framing=plain|rtp|features|lossless] [features_bands=<count>] [rtcp=off|mux|port] [abs_capture_time=<id>] [levels=off|on|<id>] [latency=off|on|kernel] [nack=off|on|<bunches>] [fec=off|red|parity:<k>]"
 SWITCH_STANDARD_API(shimaore_unicast_api_function)
 {
     switch_core_session_t *rsession = NULL;
-    switch_channel_t *channel = NULL;
-    shimaore_context_t *context;
     char *mycmd = NULL;
     int argc = 0;
     char *argv[25] = { 0 };
     char *uuid = NULL;
     char *action = NULL;
-    const char *function = "shimaore_unicast";
 
     if (zstr(cmd)) {
         goto usage;
@@ -312,6 +4679,13 @@ SWITCH_STANDARD_API(shimaore_unicast_api_function)
 
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "uuid = %s, action = %s\n", uuid, action);
 
+    if (!strncmp(uuid, SHIMAORE_CONFERENCE_PREFIX, strlen(SHIMAORE_CONFERENCE_PREFIX))) {
+        if (shimaore_conference_execute(uuid + strlen(SHIMAORE_CONFERENCE_PREFIX), argc-1, argv+1, stream) == SWITCH_STATUS_SUCCESS) {
+            goto done;
+        }
+        goto usage;
+    }
+
     rsession = switch_core_session_locate(uuid);
     if (!rsession) {
         stream->write_function(stream, "-ERR Cannot locate session!\n");
@@ -319,215 +4693,576 @@ SWITCH_STANDARD_API(shimaore_unicast_api_function)
         goto done;
     }
 
-    channel = switch_core_session_get_channel(rsession);
-    if (!channel) {
-        stream->write_function(stream, "-ERR Cannot locate channel!\n");
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "uuid = %s, action = %s, cannot locate channel\n", uuid, action);
+    if (shimaore_unicast_execute(rsession, argc-1, argv+1, stream) == SWITCH_STATUS_SUCCESS) {
         goto done;
     }
 
-    if (!zstr(action) && !strcasecmp(action, "stop")) {
-        switch_media_bug_t *bug;
+ usage:
+    stream->write_function(stream, "-USAGE: %s\n", SHIMAORE_UNICAST_API_SYNTAX);
 
-        if ((bug = (switch_media_bug_t *) switch_channel_get_private(channel, SHIMAORE_UNICAST_BUG))) {
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "uuid = %s, action = %s, media bug found\n", uuid, action);
-            switch_channel_set_private(channel, SHIMAORE_UNICAST_BUG, NULL);
-            switch_core_media_bug_remove(rsession, &bug);
-            stream->write_function(stream, "+OK Success\n");
-        } else {
-            stream->write_function(stream, "+OK Not activated\n");
-        }
-        goto done;
+ done:
+    if (rsession) {
+        switch_core_session_rwunlock(rsession);
     }
 
-    if (zstr(action) || strcasecmp(action, "start")) {
+    switch_safe_free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/* Dialplan application: same actions as the API, on the current channel */
+#define SHIMAORE_UNICAST_APP_SYNTAX "[start|stop|update|pause|resume|arm|status] [key=value...]"
+SWITCH_STANDARD_APP(shimaore_unicast_app_function)
+{
+    switch_stream_handle_t stream = { 0 };
+    char *mydata = NULL;
+    int argc = 0;
+    char *argv[25] = { 0 };
+
+    SWITCH_STANDARD_STREAM(stream);
+
+    if (zstr(data) || !(mydata = switch_core_session_strdup(session, data))) {
         goto usage;
     }
 
-    {
-        switch_media_bug_t *bug;
+    argc = switch_separate_string(mydata, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
 
-        if ((bug = (switch_media_bug_t *) switch_channel_get_private(channel, SHIMAORE_UNICAST_BUG))) {
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "uuid = %s, action = %s, already started\n", uuid, action);
-            stream->write_function(stream, "-ERR Unicast already activated\n");
-            goto done;
+    if (shimaore_unicast_execute(session, argc, argv, &stream) == SWITCH_STATUS_SUCCESS) {
+        goto done;
+    }
+
+ usage:
+    stream.write_function(&stream, "-USAGE: %s\n", SHIMAORE_UNICAST_APP_SYNTAX);
+
+ done:
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "shimaore_unicast: %s", (char *) stream.data);
+    switch_safe_free(stream.data);
+}
+
+/*** Bulk API ***/
+
+/* Split a comma-separated list in place; the returned array is to be freed by the caller */
+static char **shimaore_split_list(char *list, int *count) {
+    int slots = 1;
+    char **items;
+
+    for (const char *p = list; *p; p++) {
+        if (*p == ',') {
+            slots++;
+        }
+    }
+    switch_zmalloc(items, slots * sizeof(char *));
+    *count = switch_separate_string(list, ',', items, slots);
+    return items;
+}
+
+/* Snapshot of the UUIDs of all running taps; the returned array is to be freed by the caller */
+static char **shimaore_tap_uuids(int *count) {
+    switch_hash_index_t *hi;
+    char **uuids = NULL;
+    int slots = 0;
+
+    *count = 0;
+    switch_mutex_lock(globals.mutex);
+    for (hi = switch_core_hash_first(globals.taps); hi; hi = switch_core_hash_next(&hi)) {
+        slots++;
+    }
+    if (slots > 0) {
+        /* One allocation for the pointers and the strings */
+        char *strings;
+
+        switch_zmalloc(uuids, slots * (sizeof(char *) + SWITCH_UUID_FORMATTED_LENGTH + 1));
+        strings = (char *) (uuids + slots);
+        for (hi = switch_core_hash_first(globals.taps); hi; hi = switch_core_hash_next(&hi)) {
+            const void *key;
+            void *val;
+
+            switch_core_hash_this(hi, &key, NULL, &val);
+            uuids[*count] = strings + *count * (SWITCH_UUID_FORMATTED_LENGTH + 1);
+            switch_copy_string(uuids[*count], (const char *) key, SWITCH_UUID_FORMATTED_LENGTH + 1);
+            (*count)++;
         }
     }
+    switch_mutex_unlock(globals.mutex);
+    return uuids;
+}
 
-    if (argc < 3) {
+#define SHIMAORE_UNICAST_BULK_API_SYNTAX "start <uuid>[,<uuid>...] <option>=<value>... | stop all|<uuid>[,<uuid>...]|<variable>=<value>"
+SWITCH_STANDARD_API(shimaore_unicast_bulk_api_function)
+{
+    switch_memory_pool_t *pool = NULL;
+    char *mycmd = NULL;
+    int argc = 0;
+    char *argv[25] = { 0 };
+    char **uuids = NULL;
+    int count = 0;
+    int succeeded = 0;
+    switch_time_t started = switch_time_ref();
+    switch_time_t elapsed;
+
+    if (zstr(cmd) || !(mycmd = strdup(cmd))) {
         goto usage;
     }
 
-    context = (shimaore_context_t *) switch_core_session_alloc(rsession, sizeof(*context));
-    assert(context != NULL);
-    context->buncher_position = 0;
-    context->buncher_frame_count = 0;
-    context->buncher_maximum = BUNCHER_MAXIMUM_PACKET_COUNT;
-    context->framing = SHIMAORE_FRAMING_PLAIN;
-    context->rtp_ssrc = 0;
-    context->rtp_sequence_number = rand();
-    context->rtp_timestamp = rand();
-    context->meta_length= 0;
+    argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
 
-    char localhost[] = "127.0.0.1";
-    char *local_ip = localhost;
-    char *remote_ip = localhost;
-    int local_port = 5876;
-    int remote_port = 0;
+    if (argc < 2) {
+        goto usage;
+    }
 
-    for (uint i = 2; i < argc; i++) {
-        char *key = argv[i];
-        char *sign = strchr(argv[i],'=');
-        if (sign == NULL) {
-            goto usage;
-        }
-        char *value = sign+1;
-        if (*value == '\0') {
+    if (!strcasecmp(argv[0], "start")) {
+        shimaore_options_t options;
+
+        if (argc < 3) {
             goto usage;
         }
-        *sign = '\0';
-        if (!strcmp(key,"remote_ip")) {
-            remote_ip = value;
-            continue;
+        /* The template is parsed once; each tap copies what it needs into its own session */
+        switch_core_new_memory_pool(&pool);
+        switch (shimaore_options_parse(&options, argc-2, argv+2, pool, stream)) {
+            case SWITCH_STATUS_SUCCESS:
+                break;
+            case SWITCH_STATUS_FALSE:
+                goto usage;
+            default:
+                goto done;
         }
-        if (!strcmp(key,"remote_port")) {
-            remote_port = atoi(value);
-            continue;
+
+        uuids = shimaore_split_list(argv[1], &count);
+        for (int i = 0; i < count; i++) {
+            switch_core_session_t *rsession;
+
+            if (!(rsession = switch_core_session_locate(uuids[i]))) {
+                stream->write_function(stream, "-ERR %s Cannot locate session!\n", uuids[i]);
+                continue;
+            }
+            if (shimaore_unicast_start(rsession, &options, stream) == SWITCH_STATUS_SUCCESS) {
+                succeeded++;
+            }
+            switch_core_session_rwunlock(rsession);
         }
-        if (!strcmp(key,"local_ip")) {
-            local_ip = value;
-            continue;
+
+        elapsed = switch_time_ref() - started;
+        stream->write_function(stream, "+OK started %d/%d taps in %ldus (%.0f taps/s)\n", succeeded, count, (long) elapsed,
+                               elapsed > 0 ? succeeded * 1000000.0 / elapsed : 0.0);
+        goto done;
+    }
+
+    if (!strcasecmp(argv[0], "stop")) {
+        char *variable = NULL;
+        char *value = NULL;
+
+        if (!strcasecmp(argv[1], "all")) {
+            uuids = shimaore_tap_uuids(&count);
+        } else if ((value = strchr(argv[1], '='))) {
+            *value++ = '\0';
+            variable = argv[1];
+            uuids = shimaore_tap_uuids(&count);
+        } else {
+            uuids = shimaore_split_list(argv[1], &count);
         }
-        if (!strcmp(key,"local_port")) {
-            local_port = atoi(value);
-            continue;
+
+        for (int i = 0; i < count; i++) {
+            switch_core_session_t *rsession;
+
+            if (!(rsession = switch_core_session_locate(uuids[i]))) {
+                continue;
+            }
+            if (variable) {
+                const char *current = switch_channel_get_variable(switch_core_session_get_channel(rsession), variable);
+
+                if (!current || strcmp(current, value)) {
+                    switch_core_session_rwunlock(rsession);
+                    continue;
+                }
+            }
+            if (shimaore_unicast_stop(rsession) == SWITCH_STATUS_SUCCESS) {
+                succeeded++;
+            }
+            switch_core_session_rwunlock(rsession);
         }
-        if (!strcmp(key,"frames_per_packet")) {
-            context->buncher_maximum = atoi(value);
-            continue;
+
+        elapsed = switch_time_ref() - started;
+        stream->write_function(stream, "+OK stopped %d taps in %ldus\n", succeeded, (long) elapsed);
+        goto done;
+    }
+
+ usage:
+    stream->write_function(stream, "-USAGE: %s\n", SHIMAORE_UNICAST_BULK_API_SYNTAX);
+
+ done:
+    if (pool) {
+        switch_core_destroy_memory_pool(&pool);
+    }
+
+    switch_safe_free(uuids);
+    switch_safe_free(mycmd);
+    return SWITCH_STATUS_SUCCESS;
+}
+
+/*** Statistics ***/
+
+/* Smallest block an APR pool takes from its allocator; each context has its own pool */
+#define SHIMAORE_POOL_MINIMUM_BYTES 8192
+
+static void shimaore_stats_memory(switch_stream_handle_t *stream) {
+    uint32_t taps;
+    uint32_t pooled;
+    uint64_t slab_bytes = 0;
+    uint64_t slab_reserved = 0;
+    uint64_t per_tap;
+
+    switch_mutex_lock(globals.mutex);
+    taps = switch_core_hash_count(globals.taps);
+    pooled = globals.free_context_count;
+    switch_mutex_unlock(globals.mutex);
+
+    stream->write_function(stream, "taps: %u running, %u pooled contexts\n", taps, pooled);
+    stream->write_function(stream, "context: %u bytes + %u bytes pool block\n",
+                           (uint32_t) sizeof(shimaore_context_t), SHIMAORE_POOL_MINIMUM_BYTES);
+    stream->write_function(stream, "config: %u bytes + remote_ip + meta (slab, counted below)\n", (uint32_t) sizeof(shimaore_config_t));
+    stream->write_function(stream, "slab:%s\n", globals.slab_hugepages ? " hugepages" : "");
+    for (int i = 0; i < SHIMAORE_SLAB_CLASSES; i++) {
+        shimaore_slab_class_t *slab = &globals.slab[i];
+        uint32_t object_size = 1 << (SHIMAORE_SLAB_MINIMUM_SHIFT + i);
+
+        switch_mutex_lock(slab->mutex);
+        if (slab->arenas > 0) {
+            stream->write_function(stream, "  %6u bytes: %u in use, %u free, %u arenas\n", object_size, slab->in_use, slab->free_count, slab->arenas);
         }
-        if (!strcmp(key,"rtp_ssrc")) {
-            context->framing = SHIMAORE_FRAMING_RTP_L16;
-            context->rtp_ssrc = atoi(value);
+        slab_bytes += (uint64_t) slab->in_use * object_size;
+        slab_reserved += (uint64_t) slab->arenas * SHIMAORE_SLAB_ARENA_SIZE;
+        switch_mutex_unlock(slab->mutex);
+    }
+    stream->write_function(stream, "  %lu bytes in use, %lu bytes reserved\n", (unsigned long) slab_bytes, (unsigned long) slab_reserved);
+
+    per_tap = sizeof(shimaore_context_t) + SHIMAORE_POOL_MINIMUM_BYTES + (taps ? slab_bytes / taps : 0);
+    stream->write_function(stream, "per tap: %lu bytes, %.1f MB at 10000 taps\n", (unsigned long) per_tap, per_tap * 10000.0 / (1024 * 1024));
+}
+
+static void shimaore_stats_engine(switch_stream_handle_t *stream) {
+    if (globals.engine_count == 0) {
+        stream->write_function(stream, "send engine: direct\n");
+        return;
+    }
+    stream->write_function(stream, "send engine: %s%s, %u shards of %u slots of %u bytes, taps by %s\n",
+                           shimaore_engine_names[globals.engine.mode],
+                           globals.engine.mode == SHIMAORE_ENGINE_IO_URING && globals.engine.sqpoll ? " (SQPOLL)" :
+                           globals.engine.mode == SHIMAORE_ENGINE_TICK && globals.engine.tick_shared ? " (shared socket)" : "",
+                           globals.engine_count, globals.engine.slot_count, globals.engine.slot_size,
+                           globals.engine_follow_cpu ? "cpu" : "uuid");
+    for (uint32_t i = 0; i < globals.engine_count; i++) {
+        shimaore_engine_t *engine = &globals.engines[i];
+        uint64_t queued = __atomic_load_n(&engine->queued, __ATOMIC_RELAXED);
+        uint64_t completed = __atomic_load_n(&engine->completed, __ATOMIC_RELAXED);
+        uint64_t failed = __atomic_load_n(&engine->failed, __ATOMIC_RELAXED);
+        switch_time_t uptime = switch_micro_time_now() - engine->started;
+
+        if (!engine->running) {
+            stream->write_function(stream, "shard %u: not running, sending directly\n", i);
             continue;
         }
-        if (!strcmp(key,"meta")) {
-            context->meta_length = strlen(value)/2;
-            for (int i = 0; i < context->meta_length; i ++) {
-              context->meta[i] = hex(value+i*2);
-            }
-            continue;
+        stream->write_function(stream, "shard %u (cpu %d): %u taps, busy %.1f%%, queued %lu, completed %lu, failed %lu, pending %lu, sent directly %lu, dropped %lu\n",
+                               i, engine->cpu, __atomic_load_n(&engine->taps, __ATOMIC_RELAXED),
+                               uptime > 0 ? 100.0 * __atomic_load_n(&engine->busy_us, __ATOMIC_RELAXED) / uptime : 0.0,
+                               (unsigned long) queued, (unsigned long) completed, (unsigned long) failed,
+                               (unsigned long) (queued - completed - failed),
+                               (unsigned long) __atomic_load_n(&engine->fallbacks, __ATOMIC_RELAXED),
+                               (unsigned long) __atomic_load_n(&engine->dropped, __ATOMIC_RELAXED));
+        if (engine->mode == SHIMAORE_ENGINE_TICK) {
+            stream->write_function(stream, "  %u ms ticks %lu, sendmmsg calls %lu, GSO messages %lu%s\n", engine->tick_ms,
+                                   (unsigned long) engine->ticks, (unsigned long) engine->tick_syscalls, (unsigned long) engine->tick_gso,
+                                   engine->gso ? "" : " (no UDP GSO)");
         }
-        goto usage;
     }
+}
 
-    if (remote_port <= 0) {
-        goto usage;
-    }
-    if (local_port <= 0) {
-        goto usage;
+#define SHIMAORE_UNICAST_STATS_API_SYNTAX "[memory|engine]"
+SWITCH_STANDARD_API(shimaore_unicast_stats_api_function)
+{
+    if (zstr(cmd) || !strcasecmp(cmd, "memory")) {
+        shimaore_stats_memory(stream);
+        return SWITCH_STATUS_SUCCESS;
     }
-    if (context->buncher_maximum <= 0 || context->buncher_maximum > BUNCHER_MAXIMUM_PACKET_COUNT) {
-        goto usage;
+    if (!strcasecmp(cmd, "engine")) {
+        shimaore_stats_engine(stream);
+        return SWITCH_STATUS_SUCCESS;
     }
+    stream->write_function(stream, "-USAGE: %s\n", SHIMAORE_UNICAST_STATS_API_SYNTAX);
+    return SWITCH_STATUS_SUCCESS;
+}
 
-    /** Create socket */
-    {
-        switch_sockaddr_t *local_addr;
-        switch_sockaddr_t *remote_addr;
+/*** Auto-start ***/
 
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(rsession), SWITCH_LOG_DEBUG, "connect %s:%d->%s:%d\n",
-                          local_ip, local_port, remote_ip, remote_port);
+/* Channel variables holding `start` options:
+ * - `shimaore_unicast_auto` starts a tap on the channel when it is answered
+ *   (export it to have it inherited by the B-leg, with the same options);
+ * - `shimaore_unicast_bleg_auto`, set on the A-leg, starts a tap on the B-leg when it is
+ *   bridged, so that it may use different options (e.g. its own rtp_ssrc).
+ * `shimaore_unicast_auto_arm` holds `arm` options instead (e.g. `history_ms=5000`): the channel
+ * is armed when answered, before any `shimaore_unicast_auto`, so that pre-roll is always available.
+ */
+#define SHIMAORE_UNICAST_AUTO_VARIABLE "shimaore_unicast_auto"
+#define SHIMAORE_UNICAST_BLEG_AUTO_VARIABLE "shimaore_unicast_bleg_auto"
+#define SHIMAORE_UNICAST_AUTO_ARM_VARIABLE "shimaore_unicast_auto_arm"
 
-        if (switch_sockaddr_info_get(&local_addr,
-                                     local_ip, SWITCH_UNSPEC, local_port, 0,
-                                     switch_core_session_get_pool(rsession)) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure for local!\n");
-            goto done;
-        }
+static void shimaore_unicast_auto_start(switch_core_session_t *session, const char *action, const char *value) {
+    switch_stream_handle_t stream = { 0 };
+    char *mydata;
+    int argc = 0;
+    char *argv[25] = { 0 };
 
-        if (switch_sockaddr_info_get(&remote_addr,
-                                     remote_ip, SWITCH_UNSPEC, remote_port, 0,
-                                     switch_core_session_get_pool(rsession)) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure for remote!\n");
-            goto done;
-        }
+    SWITCH_STANDARD_STREAM(stream);
 
-        if (switch_socket_create(&context->socket, AF_INET, SOCK_DGRAM, 0, switch_core_session_get_pool(rsession)) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure creating socket!\n");
-            goto done;
-        }
+    mydata = switch_core_session_sprintf(session, "%s %s", action, value);
+    argc = switch_separate_string(mydata, ' ', argv, (sizeof(argv) / sizeof(argv[0])));
 
-        if (switch_socket_opt_set(context->socket, SWITCH_SO_REUSEADDR, 1) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure setting socket re-use!\n");
-            goto done;
-        }
+    if (shimaore_unicast_execute(session, argc, argv, &stream) != SWITCH_STATUS_SUCCESS) {
+        stream.write_function(&stream, "-ERR Invalid options: %s\n", value);
+    }
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "auto-%s: %s", action, (char *) stream.data);
+    switch_safe_free(stream.data);
+}
 
-        if (switch_socket_opt_set(context->socket, SWITCH_SO_NONBLOCK, 1) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure setting socket non-blocking!\n");
-            goto done;
-        }
+static void shimaore_event_handler(switch_event_t *event)
+{
+    switch_core_session_t *session = NULL;
+    const char *value;
 
-        if (switch_socket_bind(context->socket, local_addr) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure binding socket!\n");
-            goto done;
-        }
+    switch (event->event_id) {
+    case SWITCH_EVENT_CHANNEL_ANSWER:
+        {
+            const char *uuid = switch_event_get_header(event, "Unique-ID");
 
-        if (switch_socket_connect(context->socket, remote_addr) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure connecting socket!\n");
-            goto done;
+            if (zstr(uuid) || !(session = switch_core_session_locate(uuid))) {
+                return;
+            }
+            if ((value = switch_channel_get_variable(switch_core_session_get_channel(session), SHIMAORE_UNICAST_AUTO_ARM_VARIABLE)) && !zstr(value)) {
+                shimaore_unicast_auto_start(session, "arm", value);
+            }
+            if ((value = switch_channel_get_variable(switch_core_session_get_channel(session), SHIMAORE_UNICAST_AUTO_VARIABLE)) && !zstr(value)) {
+                shimaore_unicast_auto_start(session, "start", value);
+            }
+            switch_core_session_rwunlock(session);
         }
+        break;
+    case SWITCH_EVENT_CHANNEL_BRIDGE:
+        {
+            const char *a_uuid = switch_event_get_header(event, "Bridge-A-Unique-ID");
+            const char *b_uuid = switch_event_get_header(event, "Bridge-B-Unique-ID");
+            switch_core_session_t *b_session;
 
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(rsession), SWITCH_LOG_INFO, "Created unicast connection %s:%d->%s:%d\n",
-                          local_ip, local_port, remote_ip, remote_port);
+            if (zstr(a_uuid) || zstr(b_uuid) || !(session = switch_core_session_locate(a_uuid))) {
+                return;
+            }
+            if ((value = switch_channel_get_variable(switch_core_session_get_channel(session), SHIMAORE_UNICAST_BLEG_AUTO_VARIABLE)) && !zstr(value)) {
+                if ((b_session = switch_core_session_locate(b_uuid))) {
+                    shimaore_unicast_auto_start(b_session, "start", value);
+                    switch_core_session_rwunlock(b_session);
+                }
+            }
+            switch_core_session_rwunlock(session);
+        }
+        break;
+    default:
+        break;
     }
+}
 
-    /** Create media bug */
-    {
-        switch_media_bug_flag_t flags = SMBF_READ_STREAM;
-        switch_media_bug_t *bug;
-        switch_status_t status;
+///////
 
-        if ((status = switch_core_media_bug_add(rsession, function, NULL,
-                                                shimaore_unicast_bug_callback, context, 0, flags, &bug)) != SWITCH_STATUS_SUCCESS) {
-            stream->write_function(stream, "-ERR Failure!\n");
-            switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(rsession), SWITCH_LOG_INFO, "Creating media bug failed");
-            goto done;
-        }
+static switch_status_t load_config(void)
+{
+    const char *cf = "shimaore.conf";
+    switch_xml_t cfg, xml, settings, param;
 
-        switch_channel_set_private(channel, SHIMAORE_UNICAST_BUG, bug);
-        stream->write_function(stream, "+OK Success\n");
-        switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(rsession), SWITCH_LOG_INFO, "Created media bug");
-        goto done;
+    if (!(xml = switch_xml_open_cfg(cf, &cfg, NULL))) {
+        /* Every setting has a default; the configuration file is optional */
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "No %s, using defaults\n", cf);
+        return SWITCH_STATUS_SUCCESS;
     }
 
+    if ((settings = switch_xml_child(cfg, "settings"))) {
+        for (param = switch_xml_child(settings, "param"); param; param = param->next) {
+            const char *var = switch_xml_attr_soft(param, "name");
+            const char *val = switch_xml_attr_soft(param, "value");
 
- usage:
-    stream->write_function(stream, "-USAGE: %s\n", SHIMAORE_UNICAST_API_SYNTAX);
+            if (!strcasecmp(var, "rtcp-interval")) {
+                int ms = atoi(val);
+                if (ms < 100) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                } else {
+                    globals.rtcp_interval_ms = ms;
+                }
+            } else if (!strcasecmp(var, "send-engine")) {
+                if (!strcasecmp(val, "io_uring")) {
+                    globals.engine.mode = SHIMAORE_ENGINE_IO_URING;
+                } else if (!strcasecmp(val, "tick")) {
+                    globals.engine.mode = SHIMAORE_ENGINE_TICK;
+                } else if (!strcasecmp(val, "direct")) {
+                    globals.engine.mode = SHIMAORE_ENGINE_DIRECT;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                }
+            } else if (!strcasecmp(var, "flush-tick-ms")) {
+                int ms = atoi(val);
+                if (ms < 1 || ms > 1000) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                } else {
+                    globals.engine.tick_ms = ms;
+                }
+            } else if (!strcasecmp(var, "tick-shared-socket")) {
+                globals.engine.tick_shared = switch_true(val);
+            } else if (!strcasecmp(var, "send-engine-workers")) {
+                int count = atoi(val);
+                if (count < 1 || count > SHIMAORE_ENGINE_SHARDS_MAXIMUM) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                } else {
+                    globals.engine_count = count;
+                }
+            } else if (!strcasecmp(var, "send-engine-cpus")) {
+                char *cpus = switch_core_strdup(globals.pool, val);
+                char *cpu;
+                char *state = NULL;
 
- done:
-    if (rsession) {
-        switch_core_session_rwunlock(rsession);
+                globals.engine_cpu_count = 0;
+                for (cpu = strtok_r(cpus, ",", &state); cpu && globals.engine_cpu_count < SHIMAORE_ENGINE_SHARDS_MAXIMUM;
+                     cpu = strtok_r(NULL, ",", &state)) {
+                    globals.engine_cpus[globals.engine_cpu_count++] = atoi(cpu);
+                }
+            } else if (!strcasecmp(var, "send-engine-shard")) {
+                if (!strcasecmp(val, "cpu")) {
+                    globals.engine_follow_cpu = SWITCH_TRUE;
+                } else if (!strcasecmp(val, "uuid")) {
+                    globals.engine_follow_cpu = SWITCH_FALSE;
+                } else {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                }
+            } else if (!strcasecmp(var, "io-uring-sqpoll")) {
+                globals.engine.sqpoll = switch_true(val);
+            } else if (!strcasecmp(var, "io-uring-buffers")) {
+                int count = atoi(val);
+                if (count < 16 || count > 65536) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                } else {
+                    globals.engine.slot_count = count;
+                }
+            } else if (!strcasecmp(var, "io-uring-slot-size")) {
+                int size = atoi(val);
+                /* A registered buffer is limited to 1 GB */
+                if (size < 512 || size > 65536) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                } else {
+                    globals.engine.slot_size = size;
+                }
+            } else if (!strcasecmp(var, "zerocopy-threshold")) {
+                int bytes = atoi(val);
+                if (bytes < 0) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                } else {
+                    globals.zerocopy_threshold = bytes;
+                }
+            } else if (!strcasecmp(var, "slab-hugepages")) {
+                globals.slab_hugepages = switch_true(val);
+            } else if (!strcasecmp(var, "local-port-range")) {
+                if (shimaore_port_range_parse(val, &globals.port_range_min, &globals.port_range_max) != SWITCH_STATUS_SUCCESS) {
+                    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s: %s\n", var, val);
+                }
+            } else {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown parameter %s\n", var);
+            }
+        }
     }
 
-    switch_safe_free(mycmd);
+    switch_xml_free(xml);
     return SWITCH_STATUS_SUCCESS;
 }
 
-///////
-
 
 /* Macro expands to: switch_status_t mod_signalwire_load(switch_loadable_module_interface_t **module_interface, switch_memory_pool_t *pool) */
 SWITCH_MODULE_LOAD_FUNCTION(mod_shimaore_load)
 {
     switch_api_interface_t *api_interface = NULL;
+    switch_application_interface_t *app_interface = NULL;
+    switch_file_interface_t *file_interface = NULL;
+
+    memset(&globals, 0, sizeof(globals));
+    globals.pool = pool;
+    switch_mutex_init(&globals.mutex, SWITCH_MUTEX_NESTED, globals.pool);
+    switch_core_hash_init(&globals.destinations);
+    switch_core_hash_init(&globals.taps);
+    switch_core_hash_init(&globals.conferences);
+    for (int i = 0; i < SHIMAORE_SLAB_CLASSES; i++) {
+        switch_mutex_init(&globals.slab[i].mutex, SWITCH_MUTEX_NESTED, globals.pool);
+    }
+
+    globals.rtcp_interval_ms = SHIMAORE_RTCP_DEFAULT_INTERVAL_MS;
+    switch_mutex_init(&globals.nack_mutex, SWITCH_MUTEX_NESTED, globals.pool);
+    if ((globals.nack_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Cannot create the NACK poller, nack= is ignored: %s\n", strerror(errno));
+    }
+    globals.engine.slot_count = SHIMAORE_ENGINE_DEFAULT_SLOTS;
+    globals.engine.slot_size = SHIMAORE_ENGINE_DEFAULT_SLOT_SIZE;
+    globals.engine.tick_ms = SHIMAORE_ENGINE_DEFAULT_TICK_MS;
+    globals.engine.tick_fd = -1;
+    globals.engine_count = 1;
+
+    if (switch_event_reserve_subclass(SHIMAORE_STATS_EVENT) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't register subclass %s!\n", SHIMAORE_STATS_EVENT);
+        return SWITCH_STATUS_TERM;
+    }
+
+    load_config();
+
+    if (globals.engine.mode != SHIMAORE_ENGINE_DIRECT) {
+        shimaore_engines_start();
+    } else {
+        globals.engine_count = 0;
+    }
+
+    globals.running = SWITCH_TRUE;
+    {
+        switch_threadattr_t *thd_attr = NULL;
+
+        switch_threadattr_create(&thd_attr, globals.pool);
+        switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+        switch_thread_create(&globals.rtcp_thread, thd_attr, shimaore_rtcp_thread, NULL, globals.pool);
+        if (globals.nack_epoll_fd >= 0) {
+            switch_thread_create(&globals.nack_thread, thd_attr, shimaore_nack_thread, NULL, globals.pool);
+        }
+    }
 
     /* connect my internal structure to the blank pointer passed to me */
     *module_interface = switch_loadable_module_create_module_interface(pool, modname);
 
     SWITCH_ADD_API(api_interface, "shimaore_unicast", "unicast bug", shimaore_unicast_api_function, SHIMAORE_UNICAST_API_SYNTAX);
 
-    switch_console_set_complete("add shimaore_unicast ::console::list_uuid ::[start|stop] remote_port= remote_ip= local_ip= local_port= frames_per_packet= rtp_ssrc=");
+    SWITCH_ADD_API(api_interface, "shimaore_unicast_bulk", "unicast bug, many sessions at once", shimaore_unicast_bulk_api_function, SHIMAORE_UNICAST_BULK_API_SYNTAX);
+
+    SWITCH_ADD_API(api_interface, "shimaore_unicast_stats", "unicast bug statistics", shimaore_unicast_stats_api_function, SHIMAORE_UNICAST_STATS_API_SYNTAX);
+
+    /* Conference taps: written to by mod_conference's recording thread */
+    file_interface = (switch_file_interface_t *) switch_loadable_module_create_interface(*module_interface, SWITCH_FILE_INTERFACE);
+    file_interface->interface_name = modname;
+    file_interface->extens = (char **) shimaore_file_extensions;
+    file_interface->file_open = shimaore_file_open;
+    file_interface->file_close = shimaore_file_close;
+    file_interface->file_read = shimaore_file_read;
+    file_interface->file_write = shimaore_file_write;
+
+    SWITCH_ADD_APP(app_interface, "shimaore_unicast", "unicast bug", "Stream the channel's read audio over UDP",
+                   shimaore_unicast_app_function, SHIMAORE_UNICAST_APP_SYNTAX, SAF_NONE);
+
+    if (switch_event_bind_removable(modname, SWITCH_EVENT_CHANNEL_ANSWER, SWITCH_EVENT_SUBCLASS_ANY,
+                                    shimaore_event_handler, NULL, &globals.answer_node) != SWITCH_STATUS_SUCCESS ||
+        switch_event_bind_removable(modname, SWITCH_EVENT_CHANNEL_BRIDGE, SWITCH_EVENT_SUBCLASS_ANY,
+                                    shimaore_event_handler, NULL, &globals.bridge_node) != SWITCH_STATUS_SUCCESS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Couldn't bind events, auto-start is disabled\n");
+    }
+
+    switch_console_set_complete("add shimaore_unicast ::console::list_uuid ::[start|stop|update|pause|resume|arm|status] history_ms= preroll_ms= remote_port= remote_ip= remote= balance= local_ip= local_port= local_port_range= frames_per_packet= rtp_ssrc= framing= features_bands= rtcp= abs_capture_time= levels= latency= nack= fec=");
+    switch_console_set_complete("add shimaore_unicast_bulk start");
+    switch_console_set_complete("add shimaore_unicast_bulk stop all");
+    switch_console_set_complete("add shimaore_unicast_stats memory");
+    switch_console_set_complete("add shimaore_unicast_stats engine");
 
     /* indicate that the module should continue to be loaded */
     return SWITCH_STATUS_SUCCESS;
@@ -535,5 +5270,46 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_shimaore_load)
 
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_shimaore_shutdown)
 {
+    switch_status_t status;
+
+    switch_event_unbind(&globals.answer_node);
+    switch_event_unbind(&globals.bridge_node);
+
+    globals.running = SWITCH_FALSE;
+    if (globals.rtcp_thread) {
+        switch_thread_join(&status, globals.rtcp_thread);
+    }
+    if (globals.nack_thread) {
+        switch_thread_join(&status, globals.nack_thread);
+    }
+    if (globals.nack_epoll_fd >= 0) {
+        close(globals.nack_epoll_fd);
+        globals.nack_epoll_fd = -1;
+    }
+    /* Completions may release the last contexts of stopped taps */
+    for (uint32_t i = 0; i < globals.engine_count; i++) {
+        shimaore_engine_stop(&globals.engines[i]);
+    }
+    switch_event_free_subclass(SHIMAORE_STATS_EVENT);
+    switch_core_hash_destroy(&globals.destinations);
+    switch_core_hash_destroy(&globals.taps);
+    switch_core_hash_destroy(&globals.conferences);
+
+    while (globals.free_contexts) {
+        shimaore_context_t *context = globals.free_contexts;
+        switch_memory_pool_t *pool = context->pool;
+
+        globals.free_contexts = context->next_free;
+        switch_socket_close(context->socket);
+        if (context->rtcp_socket) {
+            switch_socket_close(context->rtcp_socket);
+        }
+        shimaore_port_release(context->allocated_port);
+        switch_core_destroy_memory_pool(&pool);
+    }
+    /* Last, as the pooled contexts above still had their buffers there */
+    for (shimaore_slab_arena_t *arena = globals.slab_arenas; arena; arena = arena->next) {
+        munmap(arena->base, SHIMAORE_SLAB_ARENA_SIZE);
+    }
     return SWITCH_STATUS_UNLOAD;
 }
@@ -0,0 +1,283 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+/* Log-mel features of mono L16 audio, in fixed point, for `framing=features`.
+ * Header-only and free of FreeSWITCH dependencies, like shimaore_framing.h.
+ *
+ * Frames are 25 ms windows every 10 ms: Hann window, radix-2 FFT, power spectrum, HTK-style
+ * triangular mel filterbank over 0 to rate / 2, then one byte per band: floor(4 log2(1 + E)),
+ * i.e. 0.75 dB steps, where E is the band's weighted power scaled by 2^15 (power of the DFT of
+ * the windowed Q15 samples, divided by the FFT size). Silence is 0.
+ *
+ * Payload (RTP payload type SHIMAORE_PT_FEATURES), all fields big-endian:
+ *   bands (8 bits), frames (8 bits), hop (16 bits, samples), window (16 bits, samples),
+ *   offset (16 bits, signed): start of the first frame's window, in samples, relative to the
+ *   packet's first audio sample; frames follow, `bands` bytes each, `hop` samples apart.
+ * The RTP timestamp and the RTCP octet counts still count audio bytes (two per sample), so the
+ * receiver places frames the same way as L16 audio; the sample rate is 100 times the hop.
+ */
+
+#ifndef SHIMAORE_FEATURES_H
+#define SHIMAORE_FEATURES_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "shimaore_framing.h"
+
+enum {
+    SHIMAORE_PT_FEATURES = 97,
+    SHIMAORE_FEATURES_HEADER_SIZE = 8,
+    SHIMAORE_FEATURES_BANDS_DEFAULT = 40,
+    SHIMAORE_FEATURES_BANDS_MAXIMUM = 64,
+    /* 25 ms at 48 kHz */
+    SHIMAORE_FEATURES_WINDOW_MAXIMUM = 1200,
+    SHIMAORE_FEATURES_FFT_MAXIMUM = 2048,
+    SHIMAORE_FEATURES_FRAMES_MAXIMUM = 255,
+};
+
+typedef struct shimaore_features_s {
+    uint32_t rate;
+    uint32_t bands;
+    uint32_t window;
+    uint32_t hop;
+    uint32_t fft_size;
+
+    /* Q15 */
+    int16_t hann[SHIMAORE_FEATURES_WINDOW_MAXIMUM];
+    uint16_t bit_reverse[SHIMAORE_FEATURES_FFT_MAXIMUM];
+    /* Q15 twiddles of every stage, one after the other: stage `h` (1, 2, 4 ... fft_size / 2
+     * butterflies per group) uses [h - 1, 2h - 1), so that its inner loop reads them in order.
+     */
+    int32_t twiddle_re[SHIMAORE_FEATURES_FFT_MAXIMUM];
+    int32_t twiddle_im[SHIMAORE_FEATURES_FFT_MAXIMUM];
+    /* Filterbank, per FFT bin: the bin gives (1 - w) of its power to band `bin_band` and w (Q15)
+     * to the next one; bands outside [0, bands) are skipped.
+     */
+    int8_t bin_band[SHIMAORE_FEATURES_FFT_MAXIMUM / 2 + 1];
+    uint16_t bin_weight[SHIMAORE_FEATURES_FFT_MAXIMUM / 2 + 1];
+
+    /* Samples of the window in progress, carried from one bunch to the next */
+    int16_t pending[SHIMAORE_FEATURES_WINDOW_MAXIMUM];
+    uint32_t pending_length;
+    /* RTP timestamp expected next; a gap (pause, loss of a bunch) restarts the window */
+    uint32_t next_timestamp;
+    int timestamp_valid;
+} shimaore_features_t;
+
+static inline double shimaore_features_mel(double frequency) {
+    return 2595.0 * log10(1.0 + frequency / 700.0);
+}
+
+/* Returns 0, or -1 when `rate` or `bands` is not supported */
+static inline int shimaore_features_init(shimaore_features_t *features, uint32_t rate, uint32_t bands) {
+    uint32_t shift = 0;
+    double mel_maximum;
+
+    if (bands == 0 || bands > SHIMAORE_FEATURES_BANDS_MAXIMUM || rate / 100 == 0 || rate / 40 > SHIMAORE_FEATURES_WINDOW_MAXIMUM) {
+        return -1;
+    }
+    memset(features, 0, sizeof(*features));
+    features->rate = rate;
+    features->bands = bands;
+    features->window = rate / 40;
+    features->hop = rate / 100;
+    while ((1u << shift) < features->window) {
+        shift++;
+    }
+    features->fft_size = 1u << shift;
+
+    for (uint32_t i = 0; i < features->window; i++) {
+        features->hann[i] = (int16_t) lrint(32767.0 * 0.5 * (1.0 - cos(2.0 * M_PI * i / features->window)));
+    }
+    for (uint32_t i = 0; i < features->fft_size; i++) {
+        uint32_t reversed = 0;
+
+        for (uint32_t b = 0; b < shift; b++) {
+            reversed |= ((i >> b) & 1) << (shift - 1 - b);
+        }
+        features->bit_reverse[i] = (uint16_t) reversed;
+    }
+    for (uint32_t h = 1; h < features->fft_size; h <<= 1) {
+        for (uint32_t j = 0; j < h; j++) {
+            features->twiddle_re[h - 1 + j] = (int32_t) lrint(32767.0 * cos(-M_PI * j / h));
+            features->twiddle_im[h - 1 + j] = (int32_t) lrint(32767.0 * sin(-M_PI * j / h));
+        }
+    }
+
+    /* Band j rises from position j to j + 1 and falls back to 0 at j + 2, positions being
+     * evenly spaced on the mel scale.
+     */
+    mel_maximum = shimaore_features_mel(rate / 2.0);
+    for (uint32_t k = 0; k <= features->fft_size / 2; k++) {
+        double position = shimaore_features_mel((double) k * rate / features->fft_size) / mel_maximum * (bands + 1);
+        double whole = floor(position);
+
+        features->bin_band[k] = (int8_t) (whole - 1);
+        features->bin_weight[k] = (uint16_t) lrint((position - whole) * 32767.0);
+    }
+    return 0;
+}
+
+/* In-place FFT of bit-reversed input, scaled by 1 / fft_size (each stage halves) so that values
+ * stay within 16 bits and products within 32. Split real and imaginary arrays and contiguous
+ * twiddles: the inner loop compiles to SIMD for stages of more than a few butterflies.
+ */
+static inline void shimaore_features_fft(const shimaore_features_t *features, int32_t *restrict re, int32_t *restrict im) {
+    uint32_t n = features->fft_size;
+
+    for (uint32_t h = 1; h < n; h <<= 1) {
+        const int32_t *w_re = features->twiddle_re + h - 1;
+        const int32_t *w_im = features->twiddle_im + h - 1;
+
+        for (uint32_t k = 0; k < n; k += 2 * h) {
+            int32_t *a_re = re + k, *a_im = im + k;
+            int32_t *b_re = re + k + h, *b_im = im + k + h;
+
+            for (uint32_t j = 0; j < h; j++) {
+                int32_t t_re = (b_re[j] * w_re[j] - b_im[j] * w_im[j] + 16384) >> 15;
+                int32_t t_im = (b_re[j] * w_im[j] + b_im[j] * w_re[j] + 16384) >> 15;
+
+                /* Rounded: truncation would add up to a noise floor over the stages */
+                b_re[j] = (a_re[j] - t_re + 1) >> 1;
+                b_im[j] = (a_im[j] - t_im + 1) >> 1;
+                a_re[j] = (a_re[j] + t_re + 1) >> 1;
+                a_im[j] = (a_im[j] + t_im + 1) >> 1;
+            }
+        }
+    }
+}
+
+/* floor(4 log2(x)), x > 0 */
+static inline uint32_t shimaore_features_log(uint64_t x) {
+    uint32_t n = 63 - __builtin_clzll(x);
+    uint64_t y = n >= 16 ? x >> (n - 16) : x << (16 - n);
+
+    /* 2^16 times 2^(1/4), 2^(1/2), 2^(3/4) */
+    return 4 * n + (y >= 77936) + (y >= 92682) + (y >= 110218);
+}
+
+/* One frame from `window` samples */
+static inline void shimaore_features_frame(const shimaore_features_t *features, const int16_t *samples, uint8_t *to) {
+    int32_t re[SHIMAORE_FEATURES_FFT_MAXIMUM];
+    int32_t im[SHIMAORE_FEATURES_FFT_MAXIMUM];
+    uint64_t energy[SHIMAORE_FEATURES_BANDS_MAXIMUM + 1] = { 0 };
+    uint32_t n = features->fft_size;
+    int32_t peak = 0;
+    uint32_t shift = 0;
+
+    for (uint32_t i = 0; i < features->window; i++) {
+        int32_t v = samples[i] < 0 ? -samples[i] : samples[i];
+
+        peak = v > peak ? v : peak;
+    }
+    /* Quiet frames are scaled up to use all 15 bits, and the power back down in the log */
+    while (peak && (peak << (shift + 1)) < 32768) {
+        shift++;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t r = features->bit_reverse[i];
+
+        re[r] = i < features->window ? ((samples[i] << shift) * features->hann[i] + 16384) >> 15 : 0;
+        im[r] = 0;
+    }
+    shimaore_features_fft(features, re, im);
+
+    /* The DC bin only feeds the first band's lower edge, where its weight is zero */
+    for (uint32_t k = 1; k <= n / 2; k++) {
+        uint64_t power = (uint64_t) ((int64_t) re[k] * re[k] + (int64_t) im[k] * im[k]);
+        int band = features->bin_band[k];
+        uint32_t weight = features->bin_weight[k];
+
+        if (band >= 0 && band < (int) features->bands) {
+            energy[band] += power * (32768 - weight);
+        }
+        if (band + 1 >= 0 && band + 1 < (int) features->bands) {
+            energy[band + 1] += power * weight;
+        }
+    }
+    for (uint32_t b = 0; b < features->bands; b++) {
+        /* 4 log2(1 + E / 2^2shift) = 4 log2(2^2shift + E) - 8 shift */
+        uint32_t value = shimaore_features_log(energy[b] + (1ull << (2 * shift))) - 8 * shift;
+
+        to[b] = value > 255 ? 255 : (uint8_t) value;
+    }
+}
+
+/* Payload size for `samples` more samples at most */
+static inline uint32_t shimaore_features_size(const shimaore_features_t *features, uint32_t samples) {
+    uint32_t frames = (features->window - 1 + samples) / features->hop;
+
+    if (frames > SHIMAORE_FEATURES_FRAMES_MAXIMUM) {
+        frames = SHIMAORE_FEATURES_FRAMES_MAXIMUM;
+    }
+    return SHIMAORE_FEATURES_HEADER_SIZE + frames * features->bands;
+}
+
+/* Feed the `count` native-order samples of the packet with RTP timestamp `timestamp` and write
+ * the payload at `to`; frames that do not fit in `capacity` are dropped. Returns its length.
+ */
+static inline uint32_t shimaore_features_encode(shimaore_features_t *features, uint32_t timestamp, const int16_t *samples,
+                                                uint32_t count, uint8_t *to, uint32_t capacity) {
+    uint32_t frames = 0;
+    uint32_t maximum;
+
+    if (capacity < SHIMAORE_FEATURES_HEADER_SIZE) {
+        return 0;
+    }
+    maximum = (capacity - SHIMAORE_FEATURES_HEADER_SIZE) / features->bands;
+    if (maximum > SHIMAORE_FEATURES_FRAMES_MAXIMUM) {
+        maximum = SHIMAORE_FEATURES_FRAMES_MAXIMUM;
+    }
+    if (!features->timestamp_valid || timestamp != features->next_timestamp) {
+        features->pending_length = 0;
+        features->timestamp_valid = 1;
+    }
+    features->next_timestamp = timestamp + 2 * count;
+
+    to[0] = (uint8_t) features->bands;
+    shimaore_store_be16(to+2, (uint16_t) features->hop);
+    shimaore_store_be16(to+4, (uint16_t) features->window);
+    shimaore_store_be16(to+6, (uint16_t) -(int16_t) features->pending_length);
+
+    while (count > 0) {
+        uint32_t take = features->window - features->pending_length;
+
+        if (take > count) {
+            take = count;
+        }
+        memcpy(features->pending + features->pending_length, samples, take * sizeof(*samples));
+        features->pending_length += take;
+        samples += take;
+        count -= take;
+        if (features->pending_length < features->window) {
+            break;
+        }
+        if (frames < maximum) {
+            shimaore_features_frame(features, features->pending, to + SHIMAORE_FEATURES_HEADER_SIZE + frames * features->bands);
+            frames++;
+        }
+        features->pending_length -= features->hop;
+        memmove(features->pending, features->pending + features->hop, features->pending_length * sizeof(*samples));
+    }
+    to[1] = (uint8_t) frames;
+    return SHIMAORE_FEATURES_HEADER_SIZE + frames * features->bands;
+}
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+/* Wire format of mod_shimaore's streams, shared by the module and the tools in tools/.
+ * Header-only and free of FreeSWITCH dependencies.
+ *
+ * Framings:
+ * - plain: each UDP payload is raw L16 audio in the sender's native byte order;
+ * - RTP: L16 (network byte order, RFC 3551) with payload type 96, optionally preceded by an
+ *   RFC 8285 one-byte header extension carrying abs-capture-time and/or the bunch's levels.
+ * In both framings, when metadata is configured, a start packet (RTP header, payload type 124,
+ * metadata as payload) precedes the audio and is repeated every SHIMAORE_META_RESEND_INTERVAL
+ * bunches in RTP framing; a stop packet (payload type 125, no payload) ends the stream.
+ * RTCP sender reports (payload type 200) may be sent on the same socket or to port + 1.
+ * With `fec=red`, RTP bunches carry the previous one too (RFC 2198, payload type 99); with
+ * `fec=parity:<k>`, every k bunches are followed by their XOR (payload type 100, see
+ * shimaore_parity_write), in the sequence number that the media thread left free for it.
+ */
+
+#ifndef SHIMAORE_FRAMING_H
+#define SHIMAORE_FRAMING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+enum {
+    SHIMAORE_RTP_HEADER_SIZE = 12,
+    /* Header with the abs-capture-time (1 + 8 bytes) and levels (1 + 4 bytes) elements, padded */
+    SHIMAORE_RTP_HEADER_MAXIMUM = SHIMAORE_RTP_HEADER_SIZE + 4 + 20,
+    SHIMAORE_LEVELS_SIZE = 4,
+    /* RFC 6464: -127 dBov and below */
+    SHIMAORE_LEVEL_SILENCE = 127,
+    /* RFC 8285 section 4.2 */
+    SHIMAORE_RTP_EXTENSION_ONE_BYTE = 0xBEDE,
+    SHIMAORE_RTP_EXTENSION_ID_MAXIMUM = 14,
+    /* Dynamic payload types */
+    SHIMAORE_PT_L16 = 96,
+    SHIMAORE_PT_START = 124,
+    SHIMAORE_PT_STOP = 125,
+    /* RFC 3550 section 6.4.1, no report blocks */
+    SHIMAORE_PT_SR = 200,
+    SHIMAORE_RTCP_SR_SIZE = 28,
+    /* RFC 4585 transport layer feedback, from consumers back to the tap (see shimaore_nack_write) */
+    SHIMAORE_PT_RTPFB = 205,
+    SHIMAORE_NACK_HEADER_SIZE = 12,
+    /* RFC 4585 section 6.2.1 Generic NACK: a sequence number and a bitmask of the 16 following */
+    SHIMAORE_NACK_FMT_GENERIC = 1,
+    /* Ours, not assigned by IANA: a sequence number and the count of those following */
+    SHIMAORE_NACK_FMT_RANGES = 20,
+    /* RFC 2198 redundant audio: a 4-byte header per redundant block, 1 byte for the primary */
+    SHIMAORE_PT_RED = 99,
+    SHIMAORE_RED_HEADER_SIZE = 4,
+    SHIMAORE_RED_BLOCK_MAXIMUM = 1023,
+    SHIMAORE_RED_OFFSET_MAXIMUM = 16383,
+    /* XOR of a group of bunches */
+    SHIMAORE_PT_PARITY = 100,
+    SHIMAORE_PARITY_HEADER_SIZE = 8,
+    SHIMAORE_PARITY_GROUP_MAXIMUM = 16,
+    /* Metadata is re-sent every so often in case the start packet got lost */
+    SHIMAORE_META_RESEND_INTERVAL = 16,
+};
+
+static inline void shimaore_store_be16(uint8_t *p, uint16_t v) {
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void shimaore_store_be32(uint8_t *p, uint32_t v) {
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+/* 64-bit NTP format (RFC 5905) of `t` microseconds since the Unix epoch */
+static inline void shimaore_store_ntp(uint8_t *p, int64_t t) {
+    shimaore_store_be32(p, (uint32_t) (t / 1000000 + 2208988800ULL));
+    shimaore_store_be32(p+4, (uint32_t) (((uint64_t) (t % 1000000) << 32) / 1000000));
+}
+
+/* The fixed part of a stream's RTP header, computed once: version 2, no padding, no CSRC,
+ * no marker, L16 payload type and the SSRC. Only the sequence number, the timestamp and the
+ * capture time change per packet.
+ */
+typedef struct shimaore_rtp_template_s {
+    uint8_t header[SHIMAORE_RTP_HEADER_MAXIMUM];
+    uint32_t length;
+    /* Where the abs-capture-time element's timestamp goes, 0 when not sent */
+    uint32_t capture_time_offset;
+    /* Where the levels element's data goes, 0 when not sent */
+    uint32_t levels_offset;
+} shimaore_rtp_template_t;
+
+/* With `capture_time_id` (1 to 14), the header carries the short form of abs-capture-time:
+ * the 64-bit NTP capture time of the packet's first sample.
+ * With `levels_id` (1 to 14), it carries the bunch's levels in 4 bytes: the RMS level in the
+ * RFC 6464 format (voice activity bit, always 0, then -dBov from 0 to 127), the peak in -dBov,
+ * and the count of clipped samples (full scale), 16 bits.
+ */
+static inline void shimaore_rtp_template_init(shimaore_rtp_template_t *template, uint32_t ssrc, uint8_t capture_time_id,
+                                              uint8_t levels_id) {
+    uint8_t *header = template->header;
+
+    memset(template, 0, sizeof(*template));
+    header[0] = 2 << 6;
+    header[1] = SHIMAORE_PT_L16;
+    shimaore_store_be32(header+8, ssrc);
+    template->length = SHIMAORE_RTP_HEADER_SIZE;
+
+    if (capture_time_id || levels_id) {
+        uint8_t *extension = header + SHIMAORE_RTP_HEADER_SIZE;
+        uint32_t length = 0;
+
+        header[0] |= 0x10;
+        shimaore_store_be16(extension, SHIMAORE_RTP_EXTENSION_ONE_BYTE);
+        if (capture_time_id) {
+            extension[4 + length] = capture_time_id << 4 | (8 - 1);
+            template->capture_time_offset = SHIMAORE_RTP_HEADER_SIZE + 4 + length + 1;
+            length += 1 + 8;
+        }
+        if (levels_id) {
+            extension[4 + length] = levels_id << 4 | (SHIMAORE_LEVELS_SIZE - 1);
+            template->levels_offset = SHIMAORE_RTP_HEADER_SIZE + 4 + length + 1;
+            length += 1 + SHIMAORE_LEVELS_SIZE;
+        }
+        /* Padded with zeroes to 32-bit words */
+        length = (length + 3) / 4;
+        shimaore_store_be16(extension+2, (uint16_t) length);
+        template->length = SHIMAORE_RTP_HEADER_SIZE + 4 + 4 * length;
+    }
+}
+
+/* Write `template->length` bytes of header at `to` */
+static inline void shimaore_rtp_template_write(const shimaore_rtp_template_t *template, uint8_t *to,
+                                               uint16_t sequence_number, uint32_t timestamp, int64_t capture_time) {
+    memcpy(to, template->header, template->length);
+    shimaore_store_be16(to+2, sequence_number);
+    shimaore_store_be32(to+4, timestamp);
+    if (template->capture_time_offset) {
+        shimaore_store_ntp(to + template->capture_time_offset, capture_time);
+    }
+}
+
+/* The levels element of a header written by shimaore_rtp_template_write */
+static inline void shimaore_rtp_levels_write(const shimaore_rtp_template_t *template, uint8_t *to,
+                                             uint8_t rms, uint8_t peak, uint16_t clipped) {
+    if (template->levels_offset) {
+        to[template->levels_offset] = rms & 0x7f;
+        to[template->levels_offset + 1] = peak;
+        shimaore_store_be16(to + template->levels_offset + 2, clipped);
+    }
+}
+
+/* Start and stop packets: the plain 12-byte header with a signalling payload type */
+static inline void shimaore_rtp_control_write(const shimaore_rtp_template_t *template, uint8_t *to,
+                                              uint16_t sequence_number, uint32_t timestamp, uint8_t payload_type) {
+    memcpy(to, template->header, SHIMAORE_RTP_HEADER_SIZE);
+    /* Header extensions only describe audio */
+    to[0] &= ~0x10;
+    to[1] = payload_type;
+    shimaore_store_be16(to+2, sequence_number);
+    shimaore_store_be32(to+4, timestamp);
+}
+
+/* Host to network order, in place; a no-op on big-endian hosts */
+static inline void shimaore_l16_to_network(uint8_t *data, uint32_t len) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint16_t *samples = (uint16_t *) data;
+
+    for (uint32_t i = 0; i < len / 2; i++) {
+        samples[i] = __builtin_bswap16(samples[i]);
+    }
+#endif
+}
+
+/* RFC 3550 section 6.4.1 sender report without report blocks; `sr` holds SHIMAORE_RTCP_SR_SIZE bytes */
+static inline void shimaore_rtcp_sr_write(uint8_t *sr, uint32_t ssrc, int64_t now, uint32_t timestamp,
+                                          uint32_t packets, uint32_t octets) {
+    sr[0] = 2 << 6;
+    sr[1] = SHIMAORE_PT_SR;
+    shimaore_store_be16(sr+2, SHIMAORE_RTCP_SR_SIZE / 4 - 1);
+    shimaore_store_be32(sr+4, ssrc);
+    shimaore_store_ntp(sr+8, now);
+    shimaore_store_be32(sr+16, timestamp);
+    shimaore_store_be32(sr+20, packets);
+    shimaore_store_be32(sr+24, octets);
+}
+
+/* NACK for `ranges` runs of lost packets of the stream `media_ssrc`: `count[i]` (1 to 65536)
+ * sequence numbers from `first[i]`. Sent to the tap's source address, when the tap was started
+ * with `nack=`. RFC 4585 transport layer feedback with FMT SHIMAORE_NACK_FMT_RANGES, one FCI per
+ * run: first sequence number (16 bits), count - 1 (16 bits). Generic NACKs are accepted too.
+ * `to` holds SHIMAORE_NACK_HEADER_SIZE + 4 * ranges bytes; returns the length.
+ */
+static inline uint32_t shimaore_nack_write(uint8_t *to, uint32_t sender_ssrc, uint32_t media_ssrc,
+                                           const uint16_t *first, const uint32_t *count, uint32_t ranges) {
+    to[0] = 2 << 6 | SHIMAORE_NACK_FMT_RANGES;
+    to[1] = SHIMAORE_PT_RTPFB;
+    shimaore_store_be16(to+2, (uint16_t) (SHIMAORE_NACK_HEADER_SIZE / 4 - 1 + ranges));
+    shimaore_store_be32(to+4, sender_ssrc);
+    shimaore_store_be32(to+8, media_ssrc);
+    for (uint32_t i = 0; i < ranges; i++) {
+        shimaore_store_be16(to + SHIMAORE_NACK_HEADER_SIZE + 4 * i, first[i]);
+        shimaore_store_be16(to + SHIMAORE_NACK_HEADER_SIZE + 4 * i + 2, (uint16_t) (count[i] - 1));
+    }
+    return SHIMAORE_NACK_HEADER_SIZE + 4 * ranges;
+}
+
+/* `to` ^= `from`, a machine word at a time; the compiler widens the loop to vector registers */
+static inline void shimaore_xor(uint8_t *to, const uint8_t *from, uint32_t len) {
+    uint32_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+
+        memcpy(&a, to + i, 8);
+        memcpy(&b, from + i, 8);
+        a ^= b;
+        memcpy(to + i, &a, 8);
+    }
+    for (; i < len; i++) {
+        to[i] ^= from[i];
+    }
+}
+
+/* Payload of a parity packet, after a 12-byte RTP header (see shimaore_rtp_control_write):
+ * the first sequence number of the group (16 bits), a mask of the group's members from it
+ * (16 bits), the XOR of their lengths (16 bits) and 16 zero bits, then the XOR of the whole
+ * packets, headers included, each padded with zeroes to the longest. With all members but one,
+ * the XOR of the parity and of the others gives back the missing packet, sequence number and all.
+ */
+static inline void shimaore_parity_write(uint8_t *to, uint16_t first, uint16_t mask, uint16_t length_xor) {
+    shimaore_store_be16(to, first);
+    shimaore_store_be16(to+2, mask);
+    shimaore_store_be16(to+4, length_xor);
+    shimaore_store_be16(to+6, 0);
+}
+
+#endif
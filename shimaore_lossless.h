@@ -0,0 +1,368 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+/* Lossless coding of L16 bunches, for `framing=lossless`: encoder for the module, decoder for
+ * receivers. Header-only and free of FreeSWITCH dependencies, like shimaore_framing.h.
+ *
+ * Each packet is coded on its own, so that a lost packet costs only its own audio. Per channel,
+ * the audio goes through the fixed polynomial predictor of order 0 to 4 (as in FLAC) that leaves
+ * the smallest residuals, and the residuals are Rice coded with a parameter per partition of
+ * SHIMAORE_LOSSLESS_PARTITION residuals.
+ *
+ * Payload (RTP payload type SHIMAORE_PT_LOSSLESS), all fields big-endian:
+ *   channels (8 bits), reserved (8 bits, 0), samples per channel (16 bits);
+ *   then each channel, starting on a byte boundary: order (8 bits), the first `order` samples
+ *   (16 bits each), and for each partition: Rice parameter k (5 bits) then one code per residual.
+ *   A residual r is mapped to u = 2r (r >= 0) or -2r - 1 (r < 0); its code is q = u >> k zero bits,
+ *   a one bit and the k low bits of u, or, when q >= SHIMAORE_LOSSLESS_ESCAPE,
+ *   SHIMAORE_LOSSLESS_ESCAPE zero bits and u in 20 bits.
+ * Packets whose coding is not smaller than the audio go out as L16 (SHIMAORE_PT_L16) instead.
+ * The RTP timestamp and the RTCP octet counts count audio bytes, as with L16.
+ */
+
+#ifndef SHIMAORE_LOSSLESS_H
+#define SHIMAORE_LOSSLESS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "shimaore_framing.h"
+
+enum {
+    SHIMAORE_PT_LOSSLESS = 98,
+    SHIMAORE_LOSSLESS_HEADER_SIZE = 4,
+    SHIMAORE_LOSSLESS_ORDER_MAXIMUM = 4,
+    SHIMAORE_LOSSLESS_PARTITION = 64,
+    SHIMAORE_LOSSLESS_ESCAPE = 16,
+    /* An order 4 residual of 16-bit samples is within +/-2^19, so u takes 20 bits */
+    SHIMAORE_LOSSLESS_RAW_BITS = 20,
+    SHIMAORE_LOSSLESS_CHANNELS_MAXIMUM = 8,
+    /* Largest bunch of audio coded, in bytes */
+    SHIMAORE_LOSSLESS_AUDIO_MAXIMUM = 65536,
+};
+
+typedef struct shimaore_lossless_writer_s {
+    uint8_t *to;
+    uint32_t position;
+    uint32_t capacity;
+    uint64_t bits;
+    uint32_t count;
+} shimaore_lossless_writer_t;
+
+/* `n` <= 48 bits; past the capacity bytes are counted but not written */
+static inline void shimaore_lossless_put(shimaore_lossless_writer_t *writer, uint64_t value, uint32_t n) {
+    writer->bits = (writer->bits << n) | value;
+    writer->count += n;
+    while (writer->count >= 8) {
+        writer->count -= 8;
+        if (writer->position < writer->capacity) {
+            writer->to[writer->position] = (uint8_t) (writer->bits >> writer->count);
+        }
+        writer->position++;
+    }
+}
+
+static inline void shimaore_lossless_align(shimaore_lossless_writer_t *writer) {
+    if (writer->count > 0) {
+        shimaore_lossless_put(writer, 0, 8 - writer->count);
+    }
+}
+
+/* Sample `i` of a channel whose samples are `stride` apart */
+#define SHIMAORE_LOSSLESS_X(i) ((int32_t) samples[(i) * stride])
+
+/* Sums of absolute residuals of the orders 0 to 4 over samples [4, n), in blocks small enough
+ * for 32-bit sums, so that the inner loop vectorizes; returns the order with the smallest.
+ */
+static inline uint32_t shimaore_lossless_order(const int16_t *samples, uint32_t stride, uint32_t n) {
+    uint64_t totals[SHIMAORE_LOSSLESS_ORDER_MAXIMUM + 1] = { 0 };
+    uint32_t order = 0;
+
+    if (n <= SHIMAORE_LOSSLESS_ORDER_MAXIMUM) {
+        return 0;
+    }
+    for (uint32_t from = SHIMAORE_LOSSLESS_ORDER_MAXIMUM; from < n; from += 256) {
+        uint32_t to = from + 256 < n ? from + 256 : n;
+        uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0, s4 = 0;
+
+        for (uint32_t i = from; i < to; i++) {
+            int32_t a = SHIMAORE_LOSSLESS_X(i), b = SHIMAORE_LOSSLESS_X(i - 1), c = SHIMAORE_LOSSLESS_X(i - 2);
+            int32_t d = SHIMAORE_LOSSLESS_X(i - 3), e = SHIMAORE_LOSSLESS_X(i - 4);
+            int32_t r0 = a, r1 = a - b, r2 = a - 2 * b + c, r3 = a - 3 * b + 3 * c - d, r4 = a - 4 * b + 6 * c - 4 * d + e;
+
+            s0 += r0 < 0 ? -r0 : r0;
+            s1 += r1 < 0 ? -r1 : r1;
+            s2 += r2 < 0 ? -r2 : r2;
+            s3 += r3 < 0 ? -r3 : r3;
+            s4 += r4 < 0 ? -r4 : r4;
+        }
+        totals[0] += s0;
+        totals[1] += s1;
+        totals[2] += s2;
+        totals[3] += s3;
+        totals[4] += s4;
+    }
+    for (uint32_t i = 1; i <= SHIMAORE_LOSSLESS_ORDER_MAXIMUM; i++) {
+        if (totals[i] < totals[order]) {
+            order = i;
+        }
+    }
+    return order;
+}
+
+/* Mapped residuals u of samples [from, from + count), from >= order */
+static inline void shimaore_lossless_residuals(const int16_t *samples, uint32_t stride, uint32_t order, uint32_t from,
+                                               uint32_t count, uint32_t *u) {
+    int32_t r[SHIMAORE_LOSSLESS_PARTITION];
+
+    switch (order) {
+    case 0:
+        for (uint32_t j = 0, i = from; j < count; j++, i++) {
+            r[j] = SHIMAORE_LOSSLESS_X(i);
+        }
+        break;
+    case 1:
+        for (uint32_t j = 0, i = from; j < count; j++, i++) {
+            r[j] = SHIMAORE_LOSSLESS_X(i) - SHIMAORE_LOSSLESS_X(i - 1);
+        }
+        break;
+    case 2:
+        for (uint32_t j = 0, i = from; j < count; j++, i++) {
+            r[j] = SHIMAORE_LOSSLESS_X(i) - 2 * SHIMAORE_LOSSLESS_X(i - 1) + SHIMAORE_LOSSLESS_X(i - 2);
+        }
+        break;
+    case 3:
+        for (uint32_t j = 0, i = from; j < count; j++, i++) {
+            r[j] = SHIMAORE_LOSSLESS_X(i) - 3 * SHIMAORE_LOSSLESS_X(i - 1) + 3 * SHIMAORE_LOSSLESS_X(i - 2) - SHIMAORE_LOSSLESS_X(i - 3);
+        }
+        break;
+    default:
+        for (uint32_t j = 0, i = from; j < count; j++, i++) {
+            r[j] = SHIMAORE_LOSSLESS_X(i) - 4 * SHIMAORE_LOSSLESS_X(i - 1) + 6 * SHIMAORE_LOSSLESS_X(i - 2) -
+                4 * SHIMAORE_LOSSLESS_X(i - 3) + SHIMAORE_LOSSLESS_X(i - 4);
+        }
+        break;
+    }
+    for (uint32_t j = 0; j < count; j++) {
+        u[j] = ((uint32_t) r[j] << 1) ^ (uint32_t) (r[j] >> 31);
+    }
+}
+
+#undef SHIMAORE_LOSSLESS_X
+
+/* Rice parameter for `count` values adding up to `sum`: about log2 of their mean */
+static inline uint32_t shimaore_lossless_parameter(uint64_t sum, uint32_t count) {
+    uint32_t k = 0;
+
+    while (k < SHIMAORE_LOSSLESS_RAW_BITS - 1 && ((uint64_t) count << (k + 1)) <= sum) {
+        k++;
+    }
+    return k;
+}
+
+/* Code `count` interleaved native-order samples of `channels` channels at `to`. Returns the
+ * payload length, or 0 when it would not be smaller than the audio or would not fit in `capacity`.
+ */
+static inline uint32_t shimaore_lossless_encode(const int16_t *samples, uint32_t count, uint32_t channels,
+                                                uint8_t *to, uint32_t capacity) {
+    shimaore_lossless_writer_t writer = { to, SHIMAORE_LOSSLESS_HEADER_SIZE, capacity, 0, 0 };
+    uint32_t n = channels ? count / channels : 0;
+    uint32_t limit = 2 * count - 1;
+
+    if (n == 0 || n > UINT16_MAX || channels > SHIMAORE_LOSSLESS_CHANNELS_MAXIMUM || n * channels != count ||
+        2 * count > SHIMAORE_LOSSLESS_AUDIO_MAXIMUM || capacity < SHIMAORE_LOSSLESS_HEADER_SIZE) {
+        return 0;
+    }
+    if (limit > capacity) {
+        limit = capacity;
+    }
+    to[0] = (uint8_t) channels;
+    to[1] = 0;
+    shimaore_store_be16(to+2, (uint16_t) n);
+
+    for (uint32_t channel = 0; channel < channels; channel++) {
+        const int16_t *x = samples + channel;
+        uint32_t order = shimaore_lossless_order(x, channels, n);
+
+        shimaore_lossless_put(&writer, order, 8);
+        for (uint32_t i = 0; i < order; i++) {
+            shimaore_lossless_put(&writer, (uint16_t) x[i * channels], 16);
+        }
+        for (uint32_t from = order; from < n; from += SHIMAORE_LOSSLESS_PARTITION) {
+            uint32_t u[SHIMAORE_LOSSLESS_PARTITION];
+            uint32_t partition = n - from < SHIMAORE_LOSSLESS_PARTITION ? n - from : SHIMAORE_LOSSLESS_PARTITION;
+            uint64_t sum = 0;
+            uint32_t k;
+
+            shimaore_lossless_residuals(x, channels, order, from, partition, u);
+            for (uint32_t j = 0; j < partition; j++) {
+                sum += u[j];
+            }
+            k = shimaore_lossless_parameter(sum, partition);
+            shimaore_lossless_put(&writer, k, 5);
+            for (uint32_t j = 0; j < partition; j++) {
+                uint32_t q = u[j] >> k;
+
+                if (q < SHIMAORE_LOSSLESS_ESCAPE) {
+                    /* q zeros, a one, k bits: at most 16 + 19 bits */
+                    shimaore_lossless_put(&writer, (1u << k) | (u[j] & ((1u << k) - 1)), q + 1 + k);
+                } else {
+                    shimaore_lossless_put(&writer, u[j], SHIMAORE_LOSSLESS_ESCAPE + SHIMAORE_LOSSLESS_RAW_BITS);
+                }
+            }
+            if (writer.position > limit) {
+                return 0;
+            }
+        }
+        shimaore_lossless_align(&writer);
+    }
+    return writer.position > limit ? 0 : writer.position;
+}
+
+typedef struct shimaore_lossless_reader_s {
+    const uint8_t *from;
+    uint32_t position;
+    uint32_t length;
+    /* Most significant bits first */
+    uint64_t bits;
+    uint32_t count;
+} shimaore_lossless_reader_t;
+
+static inline void shimaore_lossless_fill(shimaore_lossless_reader_t *reader) {
+    while (reader->count <= 56 && reader->position < reader->length) {
+        reader->bits |= (uint64_t) reader->from[reader->position++] << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+/* `n` <= 32 bits; -1 past the end */
+static inline int64_t shimaore_lossless_get(shimaore_lossless_reader_t *reader, uint32_t n) {
+    uint64_t value;
+
+    shimaore_lossless_fill(reader);
+    if (reader->count < n) {
+        return -1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    value = reader->bits >> (64 - n);
+    reader->bits <<= n;
+    reader->count -= n;
+    return (int64_t) value;
+}
+
+/* Decode a payload into L16 in network order at `to`. Returns the audio length in bytes, or -1
+ * if the payload is invalid or the audio does not fit in `capacity`.
+ */
+static inline int32_t shimaore_lossless_decode(const uint8_t *payload, uint32_t length, uint8_t *to, uint32_t capacity) {
+    shimaore_lossless_reader_t reader = { payload, SHIMAORE_LOSSLESS_HEADER_SIZE, length, 0, 0 };
+    uint32_t channels;
+    uint32_t n;
+
+    if (length < SHIMAORE_LOSSLESS_HEADER_SIZE) {
+        return -1;
+    }
+    channels = payload[0];
+    n = (uint32_t) payload[2] << 8 | payload[3];
+    if (channels == 0 || channels > SHIMAORE_LOSSLESS_CHANNELS_MAXIMUM || 2 * n * channels > capacity) {
+        return -1;
+    }
+
+    for (uint32_t channel = 0; channel < channels; channel++) {
+        uint8_t *out = to + 2 * channel;
+        uint32_t stride = 2 * channels;
+        /* Previous samples, most recent first */
+        int32_t h[SHIMAORE_LOSSLESS_ORDER_MAXIMUM] = { 0 };
+        int64_t order = shimaore_lossless_get(&reader, 8);
+        uint32_t i = 0;
+
+        if (order < 0 || order > SHIMAORE_LOSSLESS_ORDER_MAXIMUM || order > n) {
+            return -1;
+        }
+        for (; i < order; i++) {
+            int64_t value = shimaore_lossless_get(&reader, 16);
+
+            if (value < 0) {
+                return -1;
+            }
+            shimaore_store_be16(out + i * stride, (uint16_t) value);
+            memmove(h + 1, h, sizeof(h) - sizeof(*h));
+            h[0] = (int16_t) value;
+        }
+        while (i < n) {
+            int64_t k = shimaore_lossless_get(&reader, 5);
+            uint32_t end = n - i < SHIMAORE_LOSSLESS_PARTITION ? n : i + SHIMAORE_LOSSLESS_PARTITION;
+
+            if (k < 0 || k >= SHIMAORE_LOSSLESS_RAW_BITS) {
+                return -1;
+            }
+            for (; i < end; i++) {
+                uint32_t zeros;
+                int64_t u;
+                int32_t r, x;
+
+                shimaore_lossless_fill(&reader);
+                zeros = reader.bits ? (uint32_t) __builtin_clzll(reader.bits) : 64;
+                if (zeros >= SHIMAORE_LOSSLESS_ESCAPE) {
+                    if (reader.count < SHIMAORE_LOSSLESS_ESCAPE) {
+                        return -1;
+                    }
+                    reader.bits <<= SHIMAORE_LOSSLESS_ESCAPE;
+                    reader.count -= SHIMAORE_LOSSLESS_ESCAPE;
+                    u = shimaore_lossless_get(&reader, SHIMAORE_LOSSLESS_RAW_BITS);
+                } else {
+                    if (reader.count <= zeros) {
+                        return -1;
+                    }
+                    reader.bits <<= zeros + 1;
+                    reader.count -= zeros + 1;
+                    u = shimaore_lossless_get(&reader, (uint32_t) k);
+                    if (u >= 0) {
+                        u |= (int64_t) zeros << k;
+                    }
+                }
+                if (u < 0) {
+                    return -1;
+                }
+                r = (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+                switch (order) {
+                case 0: x = r; break;
+                case 1: x = r + h[0]; break;
+                case 2: x = r + 2 * h[0] - h[1]; break;
+                case 3: x = r + 3 * h[0] - 3 * h[1] + h[2]; break;
+                default: x = r + 4 * h[0] - 6 * h[1] + 4 * h[2] - h[3]; break;
+                }
+                if (x < INT16_MIN || x > INT16_MAX) {
+                    return -1;
+                }
+                shimaore_store_be16(out + i * stride, (uint16_t) x);
+                h[3] = h[2];
+                h[2] = h[1];
+                h[1] = h[0];
+                h[0] = x;
+            }
+        }
+        /* Next channel on a byte boundary */
+        reader.bits <<= reader.count % 8;
+        reader.count -= reader.count % 8;
+    }
+    return (int32_t) (2 * n * channels);
+}
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+/* Encoder benchmark for the framings that the send engine encodes (lossless, features): codes
+ * the same audio, bunch after bunch, on one thread and reports MB/s of audio per core, i.e. how
+ * much of a shard's time the taps of a box will take. Lossless bunches are first checked to
+ * decode bit-exact, and the payload size is reported against L16.
+ *
+ *   shimaore_bench -F lossless -b 320 recording.wav    (16-bit PCM WAV, mono or stereo)
+ *   shimaore_bench -F features -r 16000 -s 5           (synthetic speech-like audio)
+ *
+ * Build with the same flags as the module (-O2 -ftree-vectorize) for representative figures.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shimaore_features.h"
+#include "shimaore_lossless.h"
+
+static struct {
+    int features;
+    uint32_t rate;
+    uint32_t channels;
+    uint32_t bunch_bytes;
+    double seconds;
+} options;
+
+static int16_t *audio;
+static uint32_t audio_samples;
+
+static uint32_t load_le16(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8;
+}
+
+static uint32_t load_le32(const uint8_t *p) {
+    return load_le16(p) | load_le16(p + 2) << 16;
+}
+
+/* 16-bit PCM only; sets the rate and channels */
+static int read_wav(const char *path) {
+    FILE *file = fopen(path, "rb");
+    uint8_t header[12], chunk[8], format[16];
+    int have_format = 0;
+
+    if (!file || fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+        goto fail;
+    }
+    while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+        uint32_t size = load_le32(chunk + 4);
+
+        if (!memcmp(chunk, "fmt ", 4) && size >= sizeof(format)) {
+            if (fread(format, 1, sizeof(format), file) != sizeof(format) || load_le16(format) != 1 ||
+                load_le16(format + 14) != 16) {
+                goto fail;
+            }
+            options.channels = load_le16(format + 2);
+            options.rate = load_le32(format + 4);
+            have_format = 1;
+            fseek(file, (size - sizeof(format) + 1) & ~1u, SEEK_CUR);
+        } else if (!memcmp(chunk, "data", 4) && have_format) {
+            audio_samples = size / 2;
+            if (!(audio = malloc((size_t) audio_samples * 2)) ||
+                fread(audio, 2, audio_samples, file) != audio_samples) {
+                goto fail;
+            }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            for (uint32_t i = 0; i < audio_samples; i++) {
+                audio[i] = (int16_t) __builtin_bswap16((uint16_t) audio[i]);
+            }
+#endif
+            fclose(file);
+            return 0;
+        } else {
+            fseek(file, (size + 1) & ~1u, SEEK_CUR);
+        }
+    }
+ fail:
+    if (file) {
+        fclose(file);
+    }
+    return -1;
+}
+
+/* Ten seconds of something like speech over a line: pitch pulses or noise through two formant
+ * resonators, four syllables a second, pauses, and a faint noise floor.
+ */
+static void synthesize(void) {
+    double y1[2] = { 0 }, y2[2] = { 0 };
+    double phase = 0;
+
+    audio_samples = 10 * options.rate * options.channels;
+    audio = malloc((size_t) audio_samples * 2);
+    srand(1);
+    for (uint32_t i = 0; i < audio_samples / options.channels; i++) {
+        double t = (double) i / options.rate;
+        double syllable = fmod(t * 4, 1.0);
+        int voiced = (int) (t * 4) % 5 != 4;
+        int silent = (int) (t / 1.7) % 3 == 2;
+        double envelope = silent ? 0 : sin(M_PI * syllable) * (0.3 + 0.2 * sin(t));
+        double pitch = 110 + 40 * sin(2 * M_PI * 0.5 * t);
+        double excitation;
+        double formants[2] = { 500 + 300 * sin(2 * M_PI * 3 * t), 1500 + 500 * cos(2 * M_PI * 2 * t) };
+        double value = 0;
+
+        phase += pitch / options.rate;
+        if (voiced) {
+            excitation = phase >= 1 ? 1.0 : 0.0;
+        } else {
+            excitation = ((double) rand() / RAND_MAX - 0.5) * 0.3;
+        }
+        if (phase >= 1) {
+            phase -= 1;
+        }
+        for (int f = 0; f < 2; f++) {
+            double r = 0.97;
+            double theta = 2 * M_PI * formants[f] / options.rate;
+            double y = excitation + 2 * r * cos(theta) * y1[f] - r * r * y2[f];
+
+            y2[f] = y1[f];
+            y1[f] = y;
+            value += y;
+        }
+        value = value * envelope * 1500 + ((double) rand() / RAND_MAX - 0.5) * 16;
+        if (value > 32767) {
+            value = 32767;
+        } else if (value < -32768) {
+            value = -32768;
+        }
+        for (uint32_t c = 0; c < options.channels; c++) {
+            audio[i * options.channels + c] = (int16_t) lrint(value);
+        }
+    }
+}
+
+static double thread_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, uint64_t bytes, double elapsed) {
+    double per_second = options.rate * options.channels * 2.0;
+
+    printf("%s: %u Hz, %u channel%s, %u-byte bunches: %.1f MB/s of audio per core (%.0fx real time)\n", name,
+           options.rate, options.channels, options.channels > 1 ? "s" : "", options.bunch_bytes, bytes / elapsed / 1e6,
+           bytes / elapsed / per_second);
+}
+
+static int bench_lossless(void) {
+    uint32_t bunch = options.bunch_bytes / 2;
+    uint32_t bunches = audio_samples / bunch;
+    uint8_t *payload = malloc(options.bunch_bytes);
+    uint8_t *decoded = malloc(options.bunch_bytes);
+    uint64_t encoded = 0, bytes = 0;
+    uint32_t incompressible = 0;
+    double started, elapsed;
+
+    /* Correctness and size, once over the audio */
+    for (uint32_t b = 0; b < bunches; b++) {
+        const int16_t *samples = audio + (size_t) b * bunch;
+        uint32_t length = shimaore_lossless_encode(samples, bunch, options.channels, payload, options.bunch_bytes);
+
+        if (length == 0) {
+            incompressible++;
+            encoded += options.bunch_bytes;
+            continue;
+        }
+        if (shimaore_lossless_decode(payload, length, decoded, options.bunch_bytes) != (int32_t) options.bunch_bytes) {
+            fprintf(stderr, "bunch %u does not decode\n", b);
+            return 1;
+        }
+        for (uint32_t i = 0; i < bunch; i++) {
+            if ((int16_t) (decoded[2 * i] << 8 | decoded[2 * i + 1]) != samples[i]) {
+                fprintf(stderr, "bunch %u: sample %u differs\n", b, i);
+                return 1;
+            }
+        }
+        encoded += length;
+    }
+
+    started = thread_seconds();
+    do {
+        for (uint32_t b = 0; b < bunches; b++) {
+            shimaore_lossless_encode(audio + (size_t) b * bunch, bunch, options.channels, payload, options.bunch_bytes);
+        }
+        bytes += (uint64_t) bunches * options.bunch_bytes;
+    } while ((elapsed = thread_seconds() - started) < options.seconds);
+
+    report("lossless", bytes, elapsed);
+    printf("payload: %.1f%% of L16, %u of %u bunches sent as L16, all decoded bit-exact\n",
+           100.0 * encoded / ((uint64_t) bunches * options.bunch_bytes), incompressible, bunches);
+
+    started = thread_seconds();
+    bytes = 0;
+    do {
+        for (uint32_t b = 0; b < bunches; b++) {
+            uint32_t length = shimaore_lossless_encode(audio + (size_t) b * bunch, bunch, options.channels, payload,
+                                                       options.bunch_bytes);
+            if (length > 0) {
+                shimaore_lossless_decode(payload, length, decoded, options.bunch_bytes);
+            }
+        }
+        bytes += (uint64_t) bunches * options.bunch_bytes;
+    } while ((elapsed = thread_seconds() - started) < options.seconds);
+    report("lossless encode+decode", bytes, elapsed);
+
+    free(payload);
+    free(decoded);
+    return 0;
+}
+
+static int bench_features(void) {
+    static shimaore_features_t features;
+    uint32_t bunch = options.bunch_bytes / 2;
+    uint32_t bunches = audio_samples / bunch;
+    uint32_t capacity;
+    uint8_t *payload;
+    uint32_t timestamp = 0;
+    uint64_t bytes = 0;
+    double started, elapsed;
+
+    if (options.channels != 1 || shimaore_features_init(&features, options.rate, SHIMAORE_FEATURES_BANDS_DEFAULT) < 0) {
+        fprintf(stderr, "features need mono audio at 100 Hz to 48 kHz\n");
+        return 1;
+    }
+    capacity = shimaore_features_size(&features, bunch);
+    payload = malloc(capacity);
+
+    started = thread_seconds();
+    do {
+        for (uint32_t b = 0; b < bunches; b++) {
+            shimaore_features_encode(&features, timestamp, audio + (size_t) b * bunch, bunch, payload, capacity);
+            timestamp += options.bunch_bytes;
+        }
+        bytes += (uint64_t) bunches * options.bunch_bytes;
+    } while ((elapsed = thread_seconds() - started) < options.seconds);
+
+    report("features", bytes, elapsed);
+    free(payload);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-F lossless|features] [-r rate] [-c channels] [-b bunch_bytes] [-s seconds] [file.wav]\n"
+            "  -r, -c  synthetic audio only; a WAV file brings its own\n"
+            "  -b      bunch size in bytes (default: 20 ms)\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int option;
+
+    options.rate = 8000;
+    options.channels = 1;
+    options.seconds = 3;
+
+    while ((option = getopt(argc, argv, "F:r:c:b:s:")) != -1) {
+        switch (option) {
+        case 'F':
+            if (!strcmp(optarg, "features")) {
+                options.features = 1;
+            } else if (strcmp(optarg, "lossless")) {
+                usage(argv[0]);
+            }
+            break;
+        case 'r': options.rate = atoi(optarg); break;
+        case 'c': options.channels = atoi(optarg); break;
+        case 'b': options.bunch_bytes = atoi(optarg); break;
+        case 's': options.seconds = atof(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        if (read_wav(argv[optind]) < 0) {
+            fprintf(stderr, "%s: not a 16-bit PCM WAV file\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        if (options.rate == 0 || options.channels == 0 || options.channels > SHIMAORE_LOSSLESS_CHANNELS_MAXIMUM) {
+            usage(argv[0]);
+        }
+        synthesize();
+    }
+    if (options.bunch_bytes == 0) {
+        options.bunch_bytes = options.rate / 50 * options.channels * 2;
+    }
+    if (options.bunch_bytes % (2 * options.channels) || options.bunch_bytes > SHIMAORE_LOSSLESS_AUDIO_MAXIMUM ||
+        audio_samples < options.bunch_bytes / 2) {
+        fprintf(stderr, "bunches must hold whole frames, up to %u bytes, and no more than the audio\n",
+                SHIMAORE_LOSSLESS_AUDIO_MAXIMUM);
+        return 1;
+    }
+
+    return options.features ? bench_features() : bench_lossless();
+}
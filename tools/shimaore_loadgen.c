@@ -0,0 +1,597 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+/* Load generator: emulates N concurrent taps the way the module sends them (one connected UDP
+ * socket per tap, bunches of frames_per_packet frames framed by shimaore_framing.h in the buffer
+ * headroom, start/stop packets when metadata is configured), against a sink, and reports the
+ * cost of doing so. Use it to find how many taps a box sustains before deploying.
+ *
+ *   shimaore_loadgen -n 5000 -r 8000 -p 20 -f 10 -F rtp -w 4 -d 30 -s
+ *
+ * Each worker thread owns a share of the taps and wakes up every ptime, like the media threads
+ * would, "reads" one frame per tap and sends the bunches that are complete. Taps are staggered so
+ * that their bunches do not all complete on the same tick. A worker that cannot keep up with
+ * ptime reports late ticks: the box is past its limit.
+ *
+ * With -z, bunches of at least that many bytes are sent with MSG_ZEROCOPY as the module does with
+ * `zerocopy-threshold`; compare the cpu line against a run without it, at the bunch sizes of
+ * interest (-r, -f), towards the real network path: loopback always copies.
+ *
+ * Only the module's direct send path is emulated: one send() per bunch from the worker, as with
+ * `send-engine=direct`. The send engines (io_uring, tick with sendmmsg/GSO, shards) are not, so
+ * the figures are for the direct path and say nothing about a box running an engine.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/errqueue.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "shimaore_framing.h"
+
+/* Same as the module: room for the headers in front of each bunch */
+#define HEADROOM 64
+/* Log-linear histogram of microseconds, 8 sub-buckets per power of two, up to 2^26 */
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_MAXIMUM_BITS 26
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAXIMUM_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+#define SINK_BATCH 64
+#define SINK_PACKET_MAXIMUM 65536
+/* As SHIMAORE_ZEROCOPY_BUFFERS in the module */
+#define ZEROCOPY_BUFFERS 8
+
+typedef struct {
+    int fd;
+    shimaore_rtp_template_t template;
+    uint16_t sequence_number;
+    uint32_t timestamp;
+    uint32_t frame_count;
+    uint32_t position;
+    uint8_t *buffer;
+    /* Bunches this tap tried to send, as the context's sent_attempted: paces the meta resend */
+    uint64_t attempted;
+
+    /* MSG_ZEROCOPY: buffers (headroom included) the kernel may still hold, by send id */
+    uint8_t *zerocopy_buffers[ZEROCOPY_BUFFERS];
+    uint32_t zerocopy_ids[ZEROCOPY_BUFFERS];
+    int zerocopy_busy[ZEROCOPY_BUFFERS];
+    uint32_t zerocopy_pending;
+    uint32_t zerocopy_next_id;
+    int zerocopy_disabled;
+} tap_t;
+
+typedef struct {
+    pthread_t thread;
+    tap_t *taps;
+    uint32_t count;
+
+    uint64_t sent;
+    uint64_t failed;
+    uint64_t octets;
+    uint64_t zerocopy_sent;
+    uint64_t zerocopy_copied;
+    uint64_t zerocopy_fallbacks;
+    uint64_t late_ticks;
+    int64_t late_maximum_us;
+    uint64_t cpu_ns;
+    uint32_t latency[HISTOGRAM_BUCKETS];
+    uint32_t latency_maximum;
+} worker_t;
+
+static struct {
+    uint32_t taps;
+    uint32_t rate;
+    uint32_t ptime_ms;
+    uint32_t frames_per_packet;
+    int rtp;
+    uint8_t meta[16];
+    uint32_t meta_length;
+    uint32_t duration_s;
+    uint32_t workers;
+    int sink;
+    uint32_t zerocopy_threshold;
+    struct sockaddr_storage target;
+    socklen_t target_length;
+
+    uint32_t frame_bytes;
+    uint8_t *frame;
+    volatile int running;
+
+    uint64_t received;
+    uint64_t received_octets;
+} options;
+
+static int64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t histogram_bucket(uint64_t value) {
+    uint32_t shift;
+
+    if (value >= ((uint64_t) 1 << HISTOGRAM_MAXIMUM_BITS)) {
+        value = ((uint64_t) 1 << HISTOGRAM_MAXIMUM_BITS) - 1;
+    }
+    if (value < (1 << HISTOGRAM_SUB_BITS)) {
+        return (uint32_t) value;
+    }
+    shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) | ((value >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+static uint64_t histogram_value(uint32_t bucket) {
+    uint32_t sub = 1 << HISTOGRAM_SUB_BITS;
+
+    if (bucket < sub) {
+        return bucket;
+    }
+    return (uint64_t) (sub + bucket % sub) << (bucket / sub - 1);
+}
+
+/* Lower bound of the bucket holding the `permille` quantile */
+static uint64_t histogram_percentile(const uint32_t *counts, uint64_t total, uint32_t permille) {
+    uint64_t rank = (total * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank && seen > 0) {
+            return histogram_value(i);
+        }
+    }
+    return 0;
+}
+
+static void send_control(tap_t *tap, uint8_t payload_type) {
+    uint8_t header[SHIMAORE_RTP_HEADER_SIZE];
+    struct iovec iov[2];
+
+    shimaore_rtp_control_write(&tap->template, header, tap->sequence_number, tap->timestamp, payload_type);
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = options.meta;
+    iov[1].iov_len = payload_type == SHIMAORE_PT_START ? options.meta_length : 0;
+    writev(tap->fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+}
+
+/* As shimaore_errqueue_drain in the module, for zero-copy completions */
+static void zerocopy_drain(worker_t *worker, tap_t *tap) {
+    for (int i = 0; i < ZEROCOPY_BUFFERS; i++) {
+        char control[128];
+        struct msghdr msg = { 0 };
+        struct cmsghdr *cmsg;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(tap->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err *error = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) ||
+                error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            for (int b = 0; b < ZEROCOPY_BUFFERS; b++) {
+                if (tap->zerocopy_busy[b] && tap->zerocopy_ids[b] - error->ee_info <= error->ee_data - error->ee_info) {
+                    tap->zerocopy_busy[b] = 0;
+                    tap->zerocopy_pending--;
+                }
+            }
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                worker->zerocopy_copied += error->ee_data - error->ee_info + 1;
+                tap->zerocopy_disabled = 1;
+            }
+        }
+    }
+}
+
+/* As shimaore_zerocopy_send in the module: send, then swap the pinned buffer for an idle one */
+static ssize_t zerocopy_send(worker_t *worker, tap_t *tap, const uint8_t *packet, size_t size) {
+    ssize_t sent;
+    int spare = -1;
+    uint8_t *buffer;
+
+    if (tap->zerocopy_pending) {
+        zerocopy_drain(worker, tap);
+    }
+    for (int b = 0; b < ZEROCOPY_BUFFERS && spare < 0; b++) {
+        if (!tap->zerocopy_busy[b]) {
+            spare = b;
+        }
+    }
+    if (spare < 0) {
+        worker->zerocopy_fallbacks++;
+        return send(tap->fd, packet, size, 0);
+    }
+    if ((sent = send(tap->fd, packet, size, MSG_ZEROCOPY)) < 0) {
+        if (errno != ENOBUFS) {
+            return sent;
+        }
+        worker->zerocopy_fallbacks++;
+        return send(tap->fd, packet, size, 0);
+    }
+    buffer = tap->buffer - HEADROOM;
+    tap->buffer = tap->zerocopy_buffers[spare] + HEADROOM;
+    tap->zerocopy_buffers[spare] = buffer;
+    tap->zerocopy_ids[spare] = tap->zerocopy_next_id++;
+    tap->zerocopy_busy[spare] = 1;
+    tap->zerocopy_pending++;
+    worker->zerocopy_sent++;
+    return sent;
+}
+
+/* As shimaore_send in the module */
+static void send_bunch(worker_t *worker, tap_t *tap) {
+    uint32_t len = tap->position;
+    uint8_t *packet = tap->buffer;
+    size_t size = len;
+    int64_t before, after;
+    ssize_t sent;
+
+    tap->sequence_number++;
+    if (options.rtp) {
+        packet -= tap->template.length;
+        size += tap->template.length;
+        shimaore_rtp_template_write(&tap->template, packet, tap->sequence_number, tap->timestamp, now_ns(CLOCK_REALTIME) / 1000);
+        shimaore_l16_to_network(tap->buffer, len);
+    }
+
+    before = now_ns(CLOCK_MONOTONIC);
+    if (options.zerocopy_threshold && len >= options.zerocopy_threshold && !tap->zerocopy_disabled) {
+        sent = zerocopy_send(worker, tap, packet, size);
+    } else {
+        sent = send(tap->fd, packet, size, 0);
+    }
+    after = now_ns(CLOCK_MONOTONIC);
+
+    worker->latency[histogram_bucket((after - before) / 1000)]++;
+    if ((after - before) / 1000 > worker->latency_maximum) {
+        worker->latency_maximum = (after - before) / 1000;
+    }
+    if (sent < 0) {
+        worker->failed++;
+    } else {
+        worker->sent++;
+        worker->octets += len;
+    }
+
+    tap->attempted++;
+    tap->timestamp += len;
+    if (options.rtp && options.meta_length > 0 && tap->attempted % SHIMAORE_META_RESEND_INTERVAL == 0) {
+        send_control(tap, SHIMAORE_PT_START);
+    }
+    tap->position = 0;
+    tap->frame_count = 0;
+}
+
+static void *worker_run(void *arg) {
+    worker_t *worker = (worker_t *) arg;
+    int64_t period = (int64_t) options.ptime_ms * 1000000;
+    int64_t next = now_ns(CLOCK_MONOTONIC);
+    int64_t end = next + (int64_t) options.duration_s * 1000000000;
+
+    for (uint32_t i = 0; i < worker->count; i++) {
+        if (options.meta_length > 0) {
+            send_control(&worker->taps[i], SHIMAORE_PT_START);
+        }
+    }
+
+    while (next < end) {
+        struct timespec deadline;
+        int64_t late;
+
+        for (uint32_t i = 0; i < worker->count; i++) {
+            tap_t *tap = &worker->taps[i];
+
+            /* What switch_core_media_bug_read does for us in the module */
+            memcpy(tap->buffer + tap->position, options.frame, options.frame_bytes);
+            tap->position += options.frame_bytes;
+            if (++tap->frame_count >= options.frames_per_packet) {
+                send_bunch(worker, tap);
+            }
+        }
+
+        next += period;
+        late = now_ns(CLOCK_MONOTONIC) - next;
+        if (late > 0) {
+            worker->late_ticks++;
+            if (late / 1000 > worker->late_maximum_us) {
+                worker->late_maximum_us = late / 1000;
+            }
+            continue;
+        }
+        deadline.tv_sec = next / 1000000000;
+        deadline.tv_nsec = next % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+    }
+
+    for (uint32_t i = 0; i < worker->count; i++) {
+        if (options.meta_length > 0) {
+            send_control(&worker->taps[i], SHIMAORE_PT_STOP);
+        }
+    }
+    worker->cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    return NULL;
+}
+
+/* Built-in sink: counts what arrives on the target port */
+static void *sink_run(void *arg) {
+    int fd = *(int *) arg;
+    struct mmsghdr messages[SINK_BATCH];
+    struct iovec iov[SINK_BATCH];
+    uint8_t *buffers = malloc((size_t) SINK_BATCH * SINK_PACKET_MAXIMUM);
+
+    for (int i = 0; i < SINK_BATCH; i++) {
+        iov[i].iov_base = buffers + (size_t) i * SINK_PACKET_MAXIMUM;
+        iov[i].iov_len = SINK_PACKET_MAXIMUM;
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (options.running) {
+        int count = recvmmsg(fd, messages, SINK_BATCH, MSG_WAITFORONE, NULL);
+
+        for (int i = 0; i < count; i++) {
+            const uint8_t *packet = iov[i].iov_base;
+            uint32_t len = messages[i].msg_len;
+
+            if (options.rtp) {
+                /* Audio only; start/stop packets are not counted */
+                if (len < SHIMAORE_RTP_HEADER_SIZE || (packet[1] & 0x7f) != SHIMAORE_PT_L16) {
+                    continue;
+                }
+                len -= SHIMAORE_RTP_HEADER_SIZE + ((packet[0] & 0x10) ? 16 : 0);
+            } else if (options.meta_length > 0 && len >= SHIMAORE_RTP_HEADER_SIZE &&
+                       ((packet[1] & 0x7f) == SHIMAORE_PT_START || (packet[1] & 0x7f) == SHIMAORE_PT_STOP) &&
+                       len != options.frame_bytes * options.frames_per_packet) {
+                continue;
+            }
+            options.received++;
+            options.received_octets += len;
+        }
+    }
+    free(buffers);
+    return NULL;
+}
+
+static int parse_target(const char *value) {
+    char host[256];
+    const char *colon = strrchr(value, ':');
+    struct addrinfo hints = { 0 }, *result;
+
+    if (!colon || colon - value >= (int) sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, value, colon - value);
+    host[colon - value] = '\0';
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) {
+        return -1;
+    }
+    memcpy(&options.target, result->ai_addr, result->ai_addrlen);
+    options.target_length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-n taps] [-r rate] [-p ptime_ms] [-f frames_per_packet] [-F plain|rtp] [-x abs_capture_time_id]\n"
+            "          [-m] [-w workers] [-d duration_s] [-t ip:port] [-s] [-z zerocopy_threshold]\n"
+            "  -m  send start/stop packets with 16 bytes of metadata\n"
+            "  -z  send bunches of at least that many bytes with MSG_ZEROCOPY\n"
+            "  -s  run a sink on the target port and report loss\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    worker_t *workers;
+    tap_t *taps;
+    pthread_t sink_thread;
+    int sink_fd = -1;
+    int option;
+    uint8_t capture_time_id = 0;
+    uint64_t sent = 0, failed = 0, octets = 0, late = 0, cpu_ns = 0, total;
+    uint64_t zerocopy_sent = 0, zerocopy_copied = 0, zerocopy_fallbacks = 0;
+    int64_t late_maximum = 0;
+    uint32_t latency[HISTOGRAM_BUCKETS] = { 0 };
+    uint32_t latency_maximum = 0;
+    uint32_t samples;
+
+    options.taps = 1000;
+    options.rate = 8000;
+    options.ptime_ms = 20;
+    options.frames_per_packet = 10;
+    options.rtp = 1;
+    options.duration_s = 10;
+    options.workers = 1;
+    parse_target("127.0.0.1:7000");
+
+    while ((option = getopt(argc, argv, "n:r:p:f:F:x:mw:d:t:sz:")) != -1) {
+        switch (option) {
+        case 'n': options.taps = atoi(optarg); break;
+        case 'r': options.rate = atoi(optarg); break;
+        case 'p': options.ptime_ms = atoi(optarg); break;
+        case 'f': options.frames_per_packet = atoi(optarg); break;
+        case 'F':
+            if (!strcmp(optarg, "rtp")) {
+                options.rtp = 1;
+            } else if (!strcmp(optarg, "plain")) {
+                options.rtp = 0;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'x': capture_time_id = atoi(optarg); break;
+        case 'm':
+            options.meta_length = sizeof(options.meta);
+            memset(options.meta, 0x5a, sizeof(options.meta));
+            break;
+        case 'w': options.workers = atoi(optarg); break;
+        case 'd': options.duration_s = atoi(optarg); break;
+        case 't':
+            if (parse_target(optarg) < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 's': options.sink = 1; break;
+        case 'z': options.zerocopy_threshold = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (options.taps == 0 || options.rate == 0 || options.ptime_ms == 0 || options.frames_per_packet == 0 ||
+        options.workers == 0 || options.workers > options.taps || capture_time_id > SHIMAORE_RTP_EXTENSION_ID_MAXIMUM) {
+        usage(argv[0]);
+    }
+
+    /* A 440 Hz tone, so that a sink writing audio has something to listen to */
+    samples = options.rate * options.ptime_ms / 1000;
+    options.frame_bytes = samples * 2;
+    options.frame = malloc(options.frame_bytes);
+    for (uint32_t i = 0; i < samples; i++) {
+        int16_t sample = (int16_t) (8000 * sin(2 * M_PI * 440 * i / options.rate));
+        memcpy(options.frame + 2 * i, &sample, 2);
+    }
+
+    options.running = 1;
+    if (options.sink) {
+        int size = 64 * 1024 * 1024;
+        struct timeval timeout = { 0, 100000 };
+
+        sink_fd = socket(options.target.ss_family, SOCK_DGRAM, 0);
+        setsockopt(sink_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(sink_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (bind(sink_fd, (struct sockaddr *) &options.target, options.target_length) < 0) {
+            perror("sink bind");
+            return 1;
+        }
+        pthread_create(&sink_thread, NULL, sink_run, &sink_fd);
+    }
+
+    taps = calloc(options.taps, sizeof(*taps));
+    for (uint32_t i = 0; i < options.taps; i++) {
+        tap_t *tap = &taps[i];
+
+        if ((tap->fd = socket(options.target.ss_family, SOCK_DGRAM, 0)) < 0 ||
+            connect(tap->fd, (struct sockaddr *) &options.target, options.target_length) < 0) {
+            perror("tap socket");
+            return 1;
+        }
+        tap->buffer = (uint8_t *) malloc(HEADROOM + options.frame_bytes * options.frames_per_packet) + HEADROOM;
+        if (options.zerocopy_threshold) {
+            int on = 1;
+
+            if (setsockopt(tap->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+                perror("SO_ZEROCOPY");
+                return 1;
+            }
+            for (int b = 0; b < ZEROCOPY_BUFFERS; b++) {
+                tap->zerocopy_buffers[b] = malloc(HEADROOM + options.frame_bytes * options.frames_per_packet);
+            }
+        }
+        shimaore_rtp_template_init(&tap->template, i + 1, capture_time_id, 0);
+        tap->sequence_number = rand();
+        tap->timestamp = rand();
+        /* Stagger the bunches */
+        tap->frame_count = i % options.frames_per_packet;
+        for (uint32_t f = 0; f < tap->frame_count; f++) {
+            memcpy(tap->buffer + tap->position, options.frame, options.frame_bytes);
+            tap->position += options.frame_bytes;
+        }
+    }
+
+    workers = calloc(options.workers, sizeof(*workers));
+    for (uint32_t w = 0, first = 0; w < options.workers; w++) {
+        uint32_t count = options.taps / options.workers + (w < options.taps % options.workers);
+
+        workers[w].taps = taps + first;
+        workers[w].count = count;
+        first += count;
+        pthread_create(&workers[w].thread, NULL, worker_run, &workers[w]);
+    }
+
+    for (uint32_t w = 0; w < options.workers; w++) {
+        pthread_join(workers[w].thread, NULL);
+        sent += workers[w].sent;
+        failed += workers[w].failed;
+        octets += workers[w].octets;
+        zerocopy_sent += workers[w].zerocopy_sent;
+        zerocopy_copied += workers[w].zerocopy_copied;
+        zerocopy_fallbacks += workers[w].zerocopy_fallbacks;
+        late += workers[w].late_ticks;
+        cpu_ns += workers[w].cpu_ns;
+        if (workers[w].late_maximum_us > late_maximum) {
+            late_maximum = workers[w].late_maximum_us;
+        }
+        if (workers[w].latency_maximum > latency_maximum) {
+            latency_maximum = workers[w].latency_maximum;
+        }
+        for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            latency[i] += workers[w].latency[i];
+        }
+    }
+
+    if (options.sink) {
+        /* Let the sink catch up with the socket buffer */
+        usleep(300000);
+        options.running = 0;
+        pthread_join(sink_thread, NULL);
+    }
+
+    total = sent + failed;
+    printf("%u taps, %u Hz, %u ms ptime, %u frames/packet, %s framing, %u workers, %u s\n",
+           options.taps, options.rate, options.ptime_ms, options.frames_per_packet, options.rtp ? "rtp" : "plain",
+           options.workers, options.duration_s);
+    printf("sent: %lu packets (%.0f/s), %.2f MB/s payload, %lu failed\n", (unsigned long) sent,
+           (double) sent / options.duration_s, (double) octets / options.duration_s / 1e6, (unsigned long) failed);
+    if (options.zerocopy_threshold) {
+        printf("zerocopy: %lu sent, %lu copied by the kernel, %lu fallbacks\n", (unsigned long) zerocopy_sent,
+               (unsigned long) zerocopy_copied, (unsigned long) zerocopy_fallbacks);
+    }
+    if (options.sink) {
+        printf("received: %lu packets, %lu octets, loss %.3f%%\n", (unsigned long) options.received,
+               (unsigned long) options.received_octets, sent ? 100.0 * (double) (sent - (options.received < sent ? options.received : sent)) / sent : 0.0);
+    }
+    printf("send latency (us): p50 %lu, p90 %lu, p99 %lu, p99.9 %lu, max %u\n",
+           (unsigned long) histogram_percentile(latency, total, 500), (unsigned long) histogram_percentile(latency, total, 900),
+           (unsigned long) histogram_percentile(latency, total, 990), (unsigned long) histogram_percentile(latency, total, 999),
+           latency_maximum);
+    printf("cpu: %.1f%% of a core, %.2f us per tap-second\n", 100.0 * cpu_ns / 1e9 / options.duration_s,
+           (double) cpu_ns / 1000 / options.taps / options.duration_s);
+    printf("late ticks: %lu (worst %.1f ms)%s\n", (unsigned long) late, late_maximum / 1000.0,
+           late ? ", workers cannot keep up" : "");
+    return late || failed ? 1 : 0;
+}
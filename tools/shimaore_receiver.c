@@ -0,0 +1,748 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "shimaore_receiver.h"
+
+enum {
+    RECEIVER_BATCH = 64,
+    /* Largest UDP payload */
+    RECEIVER_PACKET_MAXIMUM = 65536,
+    RECEIVER_BUCKETS = 4096,
+    /* RFC 3550 appendix A.1 */
+    RECEIVER_MAX_DROPOUT = 3000,
+    RECEIVER_MAX_MISORDER = 100,
+    /* Larger gaps are not worth a NACK: the module keeps at most that many packets */
+    RECEIVER_NACK_MAXIMUM = 1024,
+    /* Two parity groups' worth */
+    RECEIVER_FEC_PACKETS = 2 * SHIMAORE_PARITY_GROUP_MAXIMUM,
+};
+
+typedef struct receiver_kept_s {
+    uint8_t *data;
+    uint32_t length;
+    uint32_t capacity;
+    uint16_t sequence_number;
+} receiver_kept_t;
+
+typedef struct shimaore_stream_fec_s {
+    receiver_kept_t packets[RECEIVER_FEC_PACKETS];
+} shimaore_stream_fec_t;
+
+struct shimaore_receiver_s {
+    int fd;
+    shimaore_receiver_config_t config;
+    shimaore_stream_t *buckets[RECEIVER_BUCKETS];
+    shimaore_receiver_stats_t stats;
+    int64_t last_expiry_ms;
+
+    uint8_t *buffers;
+    /* Audio of the lossless packet being dispatched */
+    uint8_t decoded[SHIMAORE_LOSSLESS_AUDIO_MAXIMUM];
+    /* Packet rebuilt from a parity packet */
+    uint8_t recovered[RECEIVER_PACKET_MAXIMUM];
+    struct iovec iov[RECEIVER_BATCH];
+    struct sockaddr_storage sources[RECEIVER_BATCH];
+    struct mmsghdr messages[RECEIVER_BATCH];
+#ifdef HAVE_LIBURING
+    int use_uring;
+    struct io_uring ring;
+#endif
+};
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint16_t load_be16(const uint8_t *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+/*** Parsing ***/
+
+/* RFC 8285 one-byte elements; only abs-capture-time and the levels are looked at */
+static void parse_extension(uint8_t capture_time_id, uint8_t levels_id, const uint8_t *p, uint32_t len, shimaore_packet_t *packet) {
+    uint32_t i = 0;
+
+    while (i < len) {
+        uint8_t id = p[i] >> 4;
+        uint32_t size = (p[i] & 0x0f) + 1;
+
+        if (id == 0) {
+            /* Padding */
+            i++;
+            continue;
+        }
+        if (id == 15 || i + 1 + size > len) {
+            return;
+        }
+        if (id == capture_time_id && size >= 8) {
+            uint32_t seconds = load_be32(p + i + 1);
+            uint32_t fraction = load_be32(p + i + 5);
+
+            packet->capture_time = ((int64_t) seconds - 2208988800LL) * 1000000 + (int64_t) (((uint64_t) fraction * 1000000) >> 32);
+        }
+        if (id == levels_id && size >= SHIMAORE_LEVELS_SIZE) {
+            packet->has_levels = 1;
+            packet->level_rms = p[i + 1] & 0x7f;
+            packet->level_peak = p[i + 2];
+            packet->clipped = load_be16(p + i + 3);
+        }
+        i += 1 + size;
+    }
+}
+
+int shimaore_packet_parse(shimaore_receiver_framing_t framing, uint8_t capture_time_id, uint8_t levels_id, int plain_control,
+                          const uint8_t *data, uint32_t len, shimaore_packet_t *packet) {
+    uint32_t header;
+    uint8_t payload_type;
+
+    memset(packet, 0, sizeof(*packet));
+
+    if (len >= SHIMAORE_RTP_HEADER_SIZE && data[0] >> 6 == 2) {
+        payload_type = data[1] & 0x7f;
+    } else {
+        payload_type = 0;
+    }
+
+    if (framing == SHIMAORE_RECEIVER_PLAIN &&
+        !(plain_control && (payload_type == SHIMAORE_PT_START || payload_type == SHIMAORE_PT_STOP))) {
+        packet->payload_type = SHIMAORE_PT_L16;
+        packet->payload = data;
+        packet->payload_length = len & ~1u;
+        return 0;
+    }
+
+    if (payload_type != SHIMAORE_PT_L16 && payload_type != SHIMAORE_PT_FEATURES && payload_type != SHIMAORE_PT_LOSSLESS &&
+        payload_type != SHIMAORE_PT_RED && payload_type != SHIMAORE_PT_PARITY &&
+        payload_type != SHIMAORE_PT_START && payload_type != SHIMAORE_PT_STOP) {
+        return -1;
+    }
+
+    packet->payload_type = payload_type;
+    packet->sequence_number = load_be16(data + 2);
+    packet->timestamp = load_be32(data + 4);
+    packet->ssrc = load_be32(data + 8);
+    packet->network_order = 1;
+
+    header = SHIMAORE_RTP_HEADER_SIZE + 4 * (data[0] & 0x0f);
+    if (data[0] & 0x10) {
+        uint32_t extension_length;
+
+        if (len < header + 4) {
+            return -1;
+        }
+        extension_length = 4 * load_be16(data + header + 2);
+        if (len < header + 4 + extension_length) {
+            return -1;
+        }
+        if ((capture_time_id || levels_id) && load_be16(data + header) == SHIMAORE_RTP_EXTENSION_ONE_BYTE) {
+            parse_extension(capture_time_id, levels_id, data + header + 4, extension_length, packet);
+        }
+        header += 4 + extension_length;
+    }
+    if (data[0] & 0x20) {
+        /* Padding */
+        if (len <= header || data[len - 1] > len - header) {
+            return -1;
+        }
+        len -= data[len - 1];
+    }
+    if (len < header) {
+        return -1;
+    }
+
+    packet->payload = data + header;
+    packet->payload_length = len - header;
+    if (payload_type == SHIMAORE_PT_L16) {
+        packet->payload_length &= ~1u;
+    }
+    return 0;
+}
+
+/*** Streams ***/
+
+static uint32_t stream_hash(uint32_t ssrc, const struct sockaddr_storage *source, socklen_t length) {
+    const uint8_t *p = (const uint8_t *) source;
+    uint32_t h = 2166136261u ^ ssrc;
+
+    for (socklen_t i = 0; i < length; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h % RECEIVER_BUCKETS;
+}
+
+static shimaore_stream_t *stream_get(shimaore_receiver_t *receiver, uint32_t ssrc, const struct sockaddr_storage *source, socklen_t length) {
+    uint32_t bucket = stream_hash(ssrc, source, length);
+    shimaore_stream_t *stream;
+
+    for (stream = receiver->buckets[bucket]; stream; stream = stream->next) {
+        if (stream->ssrc == ssrc && stream->source_length == length && !memcmp(&stream->source, source, length)) {
+            return stream;
+        }
+    }
+
+    if (!(stream = calloc(1, sizeof(*stream)))) {
+        return NULL;
+    }
+    stream->ssrc = ssrc;
+    memcpy(&stream->source, source, length);
+    stream->source_length = length;
+    stream->next = receiver->buckets[bucket];
+    receiver->buckets[bucket] = stream;
+    receiver->stats.streams++;
+    if (receiver->config.callbacks.on_start) {
+        receiver->config.callbacks.on_start(receiver->config.callbacks.arg, stream);
+    }
+    return stream;
+}
+
+int64_t shimaore_stream_lost(const shimaore_stream_t *stream) {
+    uint64_t extended_max = (uint64_t) stream->cycles + stream->max_sequence;
+
+    if (!stream->sequence_valid) {
+        return 0;
+    }
+    return (int64_t) (extended_max - stream->base_sequence + 1) - (int64_t) stream->packets;
+}
+
+static void stream_end(shimaore_receiver_t *receiver, shimaore_stream_t *stream, shimaore_stream_end_t reason) {
+    shimaore_stream_t **link = &receiver->buckets[stream_hash(stream->ssrc, &stream->source, stream->source_length)];
+    int64_t lost = shimaore_stream_lost(stream);
+
+    if (receiver->config.callbacks.on_end) {
+        receiver->config.callbacks.on_end(receiver->config.callbacks.arg, stream, reason);
+    }
+    receiver->stats.lost += lost > 0 ? lost : 0;
+    receiver->stats.reordered += stream->reordered;
+    receiver->stats.recovered += stream->recovered;
+
+    while (*link != stream) {
+        link = &(*link)->next;
+    }
+    *link = stream->next;
+    if (stream->fec) {
+        for (int i = 0; i < RECEIVER_FEC_PACKETS; i++) {
+            free(stream->fec->packets[i].data);
+        }
+        free(stream->fec);
+    }
+    free(stream->meta);
+    free(stream);
+}
+
+/* RFC 3550 appendix A.1, without the probation period: the module's streams start clean.
+ * Returns the number of packets skipped just before this one.
+ */
+static uint16_t stream_sequence(shimaore_stream_t *stream, uint16_t sequence) {
+    uint16_t delta;
+
+    if (!stream->sequence_valid) {
+        stream->sequence_valid = 1;
+        stream->base_sequence = sequence;
+        stream->max_sequence = sequence;
+        return 0;
+    }
+    delta = sequence - stream->max_sequence;
+    if (delta < RECEIVER_MAX_DROPOUT) {
+        if (sequence < stream->max_sequence) {
+            stream->cycles += 1 << 16;
+        }
+        stream->max_sequence = sequence;
+        return delta > 0 ? delta - 1 : 0;
+    } else if (delta <= 65535 - RECEIVER_MAX_MISORDER) {
+        /* A large jump: restart the count as if the stream had just begun */
+        stream->base_sequence = sequence;
+        stream->max_sequence = sequence;
+        stream->cycles = 0;
+        stream->packets = 0;
+    } else {
+        stream->reordered++;
+    }
+    return 0;
+}
+
+/* Ask the stream's source for the `count` packets from `first` */
+static void stream_nack(shimaore_receiver_t *receiver, shimaore_stream_t *stream, uint16_t first, uint32_t count) {
+    uint8_t nack[SHIMAORE_NACK_HEADER_SIZE + 4];
+    uint32_t len = shimaore_nack_write(nack, 0, stream->ssrc, &first, &count, 1);
+
+    if (sendto(receiver->fd, nack, len, MSG_DONTWAIT, (const struct sockaddr *) &stream->source, stream->source_length) == (ssize_t) len) {
+        receiver->stats.nacked += count;
+    }
+}
+
+/* Byte offset of an audio packet in the stream, -1 if it precedes the first packet */
+static int64_t stream_offset(shimaore_stream_t *stream, const shimaore_packet_t *packet) {
+    int32_t delta;
+    int64_t offset;
+
+    if (!packet->network_order) {
+        offset = stream->plain_offset;
+        stream->plain_offset += packet->payload_length;
+        return offset;
+    }
+    if (!stream->timestamp_valid) {
+        stream->timestamp_valid = 1;
+        stream->first_timestamp = packet->timestamp;
+        stream->last_timestamp = packet->timestamp;
+        stream->last_offset = 0;
+        return 0;
+    }
+    /* The module's timestamps count bytes; extend them through wrap-arounds */
+    delta = (int32_t) (packet->timestamp - stream->last_timestamp);
+    offset = stream->last_offset + delta;
+    if (delta > 0) {
+        stream->last_timestamp = packet->timestamp;
+        stream->last_offset = offset;
+    }
+    return offset;
+}
+
+/* Audio, or feature frames: decoded if need be and handed over */
+static void stream_audio(shimaore_receiver_t *receiver, shimaore_stream_t *stream, shimaore_packet_t *packet) {
+    int64_t offset;
+
+    /* Handed over as the L16 it codes */
+    if (packet->payload_type == SHIMAORE_PT_LOSSLESS) {
+        int32_t length = shimaore_lossless_decode(packet->payload, packet->payload_length, receiver->decoded, sizeof(receiver->decoded));
+
+        if (length < 0) {
+            receiver->stats.invalid++;
+            return;
+        }
+        packet->payload_type = SHIMAORE_PT_L16;
+        packet->payload = receiver->decoded;
+        packet->payload_length = (uint32_t) length;
+    }
+    stream->packets++;
+    stream->octets += packet->payload_length;
+    if ((offset = stream_offset(stream, packet)) >= 0 && receiver->config.callbacks.on_audio) {
+        receiver->config.callbacks.on_audio(receiver->config.callbacks.arg, stream, packet, (uint64_t) offset);
+    }
+}
+
+/* RFC 2198: the primary block in `packet`, the redundant one (if any) in `redundant`. The module
+ * sends at most one redundant block, for the previous sequence number. Returns 1 with a redundant
+ * block, 0 without, -1 when the payload is not valid.
+ */
+static int red_split(shimaore_packet_t *packet, shimaore_packet_t *redundant) {
+    const uint8_t *p = packet->payload;
+    uint32_t len = packet->payload_length;
+    uint32_t offset, length;
+
+    if (len < 1) {
+        return -1;
+    }
+    if (!(p[0] & 0x80)) {
+        packet->payload_type = p[0] & 0x7f;
+        packet->payload = p + 1;
+        packet->payload_length = len - 1;
+        return 0;
+    }
+    if (len < SHIMAORE_RED_HEADER_SIZE + 1 || p[SHIMAORE_RED_HEADER_SIZE] & 0x80) {
+        return -1;
+    }
+    offset = (uint32_t) p[1] << 6 | p[2] >> 2;
+    length = (uint32_t) (p[2] & 0x03) << 8 | p[3];
+    if (SHIMAORE_RED_HEADER_SIZE + 1 + length > len) {
+        return -1;
+    }
+    *redundant = *packet;
+    redundant->payload_type = p[0] & 0x7f;
+    redundant->sequence_number = packet->sequence_number - 1;
+    redundant->timestamp = packet->timestamp - offset;
+    redundant->payload = p + SHIMAORE_RED_HEADER_SIZE + 1;
+    redundant->payload_length = length;
+    packet->payload_type = p[SHIMAORE_RED_HEADER_SIZE] & 0x7f;
+    packet->payload = redundant->payload + length;
+    packet->payload_length = len - SHIMAORE_RED_HEADER_SIZE - 1 - length;
+    return 1;
+}
+
+/* Keep the packet for the parity packets to come */
+static void fec_keep(shimaore_stream_fec_t *fec, uint16_t sequence_number, const uint8_t *data, uint32_t len) {
+    receiver_kept_t *kept = &fec->packets[sequence_number % RECEIVER_FEC_PACKETS];
+
+    if (kept->capacity < len) {
+        uint8_t *grown = realloc(kept->data, len);
+
+        if (!grown) {
+            kept->length = 0;
+            return;
+        }
+        kept->data = grown;
+        kept->capacity = len;
+    }
+    memcpy(kept->data, data, len);
+    kept->length = len;
+    kept->sequence_number = sequence_number;
+}
+
+/* Whether the packet is kept: received, or rebuilt from parity */
+static int fec_kept(const shimaore_stream_fec_t *fec, uint16_t sequence_number) {
+    const receiver_kept_t *kept = &fec->packets[sequence_number % RECEIVER_FEC_PACKETS];
+
+    return kept->length && kept->sequence_number == sequence_number;
+}
+
+/* A parity packet: when exactly one member of its group is missing, rebuild it and hand it over */
+static void stream_parity(shimaore_receiver_t *receiver, shimaore_stream_t *stream, const shimaore_packet_t *parity) {
+    const uint8_t *body = parity->payload + SHIMAORE_PARITY_HEADER_SIZE;
+    uint32_t body_length;
+    uint16_t first, mask, length;
+    int missing = -1;
+    shimaore_packet_t packet;
+
+    if (!stream->fec) {
+        stream->fec = calloc(1, sizeof(*stream->fec));
+        return;
+    }
+    if (parity->payload_length < SHIMAORE_PARITY_HEADER_SIZE) {
+        receiver->stats.invalid++;
+        return;
+    }
+    first = load_be16(parity->payload);
+    mask = load_be16(parity->payload + 2);
+    length = load_be16(parity->payload + 4);
+    body_length = parity->payload_length - SHIMAORE_PARITY_HEADER_SIZE;
+
+    for (int i = 0; i < SHIMAORE_PARITY_GROUP_MAXIMUM; i++) {
+        uint16_t sequence_number = first + i;
+
+        if ((mask & 1u << i) && !fec_kept(stream->fec, sequence_number)) {
+            if (missing >= 0) {
+                return;
+            }
+            missing = i;
+        }
+    }
+    if (missing < 0 || body_length > sizeof(receiver->recovered)) {
+        return;
+    }
+
+    memcpy(receiver->recovered, body, body_length);
+    for (int i = 0; i < SHIMAORE_PARITY_GROUP_MAXIMUM; i++) {
+        uint16_t sequence_number = first + i;
+
+        if ((mask & 1u << i) && i != missing) {
+            receiver_kept_t *kept = &stream->fec->packets[sequence_number % RECEIVER_FEC_PACKETS];
+
+            if (kept->length > body_length) {
+                return;
+            }
+            shimaore_xor(receiver->recovered, kept->data, kept->length);
+            length ^= kept->length;
+        }
+    }
+    if (length > body_length ||
+        shimaore_packet_parse(SHIMAORE_RECEIVER_RTP, receiver->config.capture_time_id, receiver->config.levels_id, 0,
+                              receiver->recovered, length, &packet) < 0 ||
+        packet.ssrc != stream->ssrc || packet.sequence_number != (uint16_t) (first + missing) ||
+        packet.payload_type == SHIMAORE_PT_RED || packet.payload_type == SHIMAORE_PT_PARITY) {
+        return;
+    }
+    fec_keep(stream->fec, packet.sequence_number, receiver->recovered, length);
+    stream->recovered++;
+    stream_audio(receiver, stream, &packet);
+}
+
+static void dispatch(shimaore_receiver_t *receiver, const uint8_t *data, uint32_t len,
+                     const struct sockaddr_storage *source, socklen_t source_length, int64_t now) {
+    shimaore_packet_t packet;
+    shimaore_stream_t *stream;
+
+    receiver->stats.packets++;
+    receiver->stats.octets += len;
+
+    if (shimaore_packet_parse(receiver->config.framing, receiver->config.capture_time_id, receiver->config.levels_id, receiver->config.plain_control,
+                              data, len, &packet) < 0) {
+        receiver->stats.invalid++;
+        return;
+    }
+    /* In plain framing start/stop packets carry the SSRC; audio does not */
+    if (!(stream = stream_get(receiver, receiver->config.framing == SHIMAORE_RECEIVER_RTP ? packet.ssrc : 0, source, source_length))) {
+        return;
+    }
+    stream->last_seen_ms = now;
+
+    switch (packet.payload_type) {
+    case SHIMAORE_PT_START:
+        if (packet.payload_length > 0 &&
+            (packet.payload_length != stream->meta_length || memcmp(packet.payload, stream->meta, packet.payload_length))) {
+            uint8_t *meta = malloc(packet.payload_length);
+
+            if (meta) {
+                memcpy(meta, packet.payload, packet.payload_length);
+                free(stream->meta);
+                stream->meta = meta;
+                stream->meta_length = packet.payload_length;
+                if (receiver->config.callbacks.on_meta) {
+                    receiver->config.callbacks.on_meta(receiver->config.callbacks.arg, stream);
+                }
+            }
+        }
+        break;
+    case SHIMAORE_PT_STOP:
+        stream_end(receiver, stream, SHIMAORE_STREAM_STOPPED);
+        break;
+    case SHIMAORE_PT_PARITY:
+        /* In the sequence, so that its number is not taken for a loss */
+        stream_sequence(stream, packet.sequence_number);
+        stream->packets++;
+        stream_parity(receiver, stream, &packet);
+        break;
+    default:
+        {
+            shimaore_packet_t redundant;
+            int has_redundant = 0;
+            uint16_t missing = 0;
+
+            if (packet.payload_type == SHIMAORE_PT_RED && (has_redundant = red_split(&packet, &redundant)) < 0) {
+                receiver->stats.invalid++;
+                break;
+            }
+            if (packet.network_order) {
+                /* Already handed over: rebuilt from parity before it came in late, or duplicated */
+                if (stream->fec && fec_kept(stream->fec, packet.sequence_number)) {
+                    break;
+                }
+                missing = stream_sequence(stream, packet.sequence_number);
+                if (stream->fec) {
+                    fec_keep(stream->fec, packet.sequence_number, data, len);
+                }
+            }
+            /* The previous packet is the last one of the gap */
+            if (has_redundant && missing > 0) {
+                missing--;
+                stream->recovered++;
+                stream_audio(receiver, stream, &redundant);
+            }
+            if (receiver->config.nack && missing > 0 && missing <= RECEIVER_NACK_MAXIMUM) {
+                stream_nack(receiver, stream, (uint16_t) (packet.sequence_number - missing - has_redundant), missing);
+            }
+            stream_audio(receiver, stream, &packet);
+        }
+        break;
+    }
+}
+
+static void expire(shimaore_receiver_t *receiver, int64_t now) {
+    if (receiver->config.idle_timeout_ms == 0 || now - receiver->last_expiry_ms < 1000) {
+        return;
+    }
+    receiver->last_expiry_ms = now;
+    for (uint32_t i = 0; i < RECEIVER_BUCKETS; i++) {
+        shimaore_stream_t *stream = receiver->buckets[i];
+
+        while (stream) {
+            shimaore_stream_t *next = stream->next;
+
+            if (now - stream->last_seen_ms > receiver->config.idle_timeout_ms) {
+                stream_end(receiver, stream, SHIMAORE_STREAM_TIMED_OUT);
+            }
+            stream = next;
+        }
+    }
+}
+
+/*** Receiving ***/
+
+#ifdef HAVE_LIBURING
+static void uring_arm(shimaore_receiver_t *receiver, int i) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&receiver->ring);
+
+    receiver->messages[i].msg_hdr.msg_namelen = sizeof(receiver->sources[i]);
+    io_uring_prep_recvmsg(sqe, receiver->fd, &receiver->messages[i].msg_hdr, 0);
+    io_uring_sqe_set_data(sqe, (void *) (intptr_t) i);
+}
+
+/* One recvmsg per buffer kept in flight; each completion is dispatched and re-armed */
+static int uring_run_once(shimaore_receiver_t *receiver, int timeout_ms) {
+    struct io_uring_cqe *cqe;
+    struct __kernel_timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000 };
+    int64_t now;
+    int count = 0;
+    unsigned seen = 0;
+    unsigned head;
+
+    if (io_uring_wait_cqe_timeout(&receiver->ring, &cqe, &timeout) < 0) {
+        return 0;
+    }
+    now = monotonic_ms();
+    io_uring_for_each_cqe(&receiver->ring, head, cqe) {
+        int i = (int) (intptr_t) io_uring_cqe_get_data(cqe);
+
+        seen++;
+        if (cqe->res >= 0) {
+            dispatch(receiver, receiver->iov[i].iov_base, cqe->res, &receiver->sources[i],
+                     receiver->messages[i].msg_hdr.msg_namelen, now);
+            count++;
+        }
+        uring_arm(receiver, i);
+    }
+    io_uring_cq_advance(&receiver->ring, seen);
+    io_uring_submit(&receiver->ring);
+    return count;
+}
+#endif
+
+shimaore_receiver_t *shimaore_receiver_new(const shimaore_receiver_config_t *config) {
+    shimaore_receiver_t *receiver;
+    struct addrinfo hints = { 0 }, *address;
+    char port[16];
+    int on = 1;
+
+    if (!(receiver = calloc(1, sizeof(*receiver)))) {
+        return NULL;
+    }
+    receiver->config = *config;
+    receiver->fd = -1;
+
+    snprintf(port, sizeof(port), "%d", config->port);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(config->ip, port, &hints, &address) != 0) {
+        goto fail;
+    }
+    receiver->fd = socket(address->ai_family, SOCK_DGRAM, 0);
+    if (receiver->fd >= 0) {
+        if (config->reuse_port) {
+            setsockopt(receiver->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        }
+        if (config->receive_buffer > 0) {
+            setsockopt(receiver->fd, SOL_SOCKET, SO_RCVBUF, &config->receive_buffer, sizeof(config->receive_buffer));
+        }
+        if (bind(receiver->fd, address->ai_addr, address->ai_addrlen) < 0) {
+            close(receiver->fd);
+            receiver->fd = -1;
+        }
+    }
+    freeaddrinfo(address);
+    if (receiver->fd < 0) {
+        goto fail;
+    }
+
+    if (!(receiver->buffers = malloc((size_t) RECEIVER_BATCH * RECEIVER_PACKET_MAXIMUM))) {
+        goto fail;
+    }
+    for (int i = 0; i < RECEIVER_BATCH; i++) {
+        receiver->iov[i].iov_base = receiver->buffers + (size_t) i * RECEIVER_PACKET_MAXIMUM;
+        receiver->iov[i].iov_len = RECEIVER_PACKET_MAXIMUM;
+        receiver->messages[i].msg_hdr.msg_iov = &receiver->iov[i];
+        receiver->messages[i].msg_hdr.msg_iovlen = 1;
+        receiver->messages[i].msg_hdr.msg_name = &receiver->sources[i];
+    }
+
+#ifdef HAVE_LIBURING
+    if (config->io_uring && io_uring_queue_init(RECEIVER_BATCH * 2, &receiver->ring, 0) == 0) {
+        receiver->use_uring = 1;
+        for (int i = 0; i < RECEIVER_BATCH; i++) {
+            uring_arm(receiver, i);
+        }
+        io_uring_submit(&receiver->ring);
+    }
+#endif
+    receiver->last_expiry_ms = monotonic_ms();
+    return receiver;
+
+ fail:
+    if (receiver->fd >= 0) {
+        close(receiver->fd);
+    }
+    free(receiver->buffers);
+    free(receiver);
+    return NULL;
+}
+
+int shimaore_receiver_run_once(shimaore_receiver_t *receiver, int timeout_ms) {
+    struct pollfd pfd = { receiver->fd, POLLIN, 0 };
+    int64_t now;
+    int count;
+
+#ifdef HAVE_LIBURING
+    if (receiver->use_uring) {
+        count = uring_run_once(receiver, timeout_ms);
+        expire(receiver, monotonic_ms());
+        return count;
+    }
+#endif
+
+    if ((count = poll(&pfd, 1, timeout_ms)) < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    if (count == 0) {
+        expire(receiver, monotonic_ms());
+        return 0;
+    }
+
+    for (int i = 0; i < RECEIVER_BATCH; i++) {
+        receiver->messages[i].msg_hdr.msg_namelen = sizeof(receiver->sources[i]);
+    }
+    if ((count = recvmmsg(receiver->fd, receiver->messages, RECEIVER_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    now = monotonic_ms();
+    for (int i = 0; i < count; i++) {
+        dispatch(receiver, receiver->iov[i].iov_base, receiver->messages[i].msg_len, &receiver->sources[i],
+                 receiver->messages[i].msg_hdr.msg_namelen, now);
+    }
+    expire(receiver, now);
+    return count;
+}
+
+void shimaore_receiver_stats(const shimaore_receiver_t *receiver, shimaore_receiver_stats_t *stats) {
+    *stats = receiver->stats;
+}
+
+void shimaore_receiver_free(shimaore_receiver_t *receiver) {
+    for (uint32_t i = 0; i < RECEIVER_BUCKETS; i++) {
+        while (receiver->buckets[i]) {
+            stream_end(receiver, receiver->buckets[i], SHIMAORE_STREAM_CLOSED);
+        }
+    }
+#ifdef HAVE_LIBURING
+    if (receiver->use_uring) {
+        io_uring_queue_exit(&receiver->ring);
+    }
+#endif
+    close(receiver->fd);
+    free(receiver->buffers);
+    free(receiver);
+}
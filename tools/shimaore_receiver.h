@@ -0,0 +1,178 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+/* Reference receiver for mod_shimaore streams (see shimaore_framing.h for the wire format).
+ *
+ * Packets are received in batches (recvmmsg, or io_uring when built with HAVE_LIBURING), their
+ * headers parsed in place, and dispatched per stream: one stream per SSRC and source address in
+ * RTP framing, per source address in plain framing. Audio is handed over with its byte offset in
+ * the stream, derived from the RTP timestamp, so that the application can place reordered
+ * packets and leave gaps (losses, pauses) as silence. Streams end on a stop packet or after
+ * `idle_timeout_ms` without packets. Bunches lost from streams with `fec=` are recovered from the
+ * redundancy or parity packets that follow them, and handed over late like reordered ones.
+ *
+ * Single-threaded: run one receiver per socket and thread; SO_REUSEPORT spreads the load.
+ */
+
+#ifndef SHIMAORE_RECEIVER_H
+#define SHIMAORE_RECEIVER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "shimaore_framing.h"
+#include "shimaore_features.h"
+#include "shimaore_lossless.h"
+
+typedef enum {
+    SHIMAORE_RECEIVER_PLAIN,
+    SHIMAORE_RECEIVER_RTP,
+} shimaore_receiver_framing_t;
+
+/* A parsed packet; `payload` points into the receive buffer and is only valid during the callback */
+typedef struct shimaore_packet_s {
+    /* SHIMAORE_PT_L16 for audio (also in plain framing, and once decoded, lossless framing),
+     * SHIMAORE_PT_FEATURES for feature frames (see shimaore_features.h; placed like audio),
+     * SHIMAORE_PT_START or SHIMAORE_PT_STOP
+     */
+    uint8_t payload_type;
+    uint16_t sequence_number;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    /* abs-capture-time in microseconds since the Unix epoch, 0 when absent */
+    int64_t capture_time;
+    /* Levels element (see shimaore_rtp_template_init): RMS and peak in -dBov, clipped samples */
+    int has_levels;
+    uint8_t level_rms;
+    uint8_t level_peak;
+    uint16_t clipped;
+    const uint8_t *payload;
+    uint32_t payload_length;
+    /* L16 in network byte order (RTP) rather than the sender's native order (plain) */
+    int network_order;
+} shimaore_packet_t;
+
+typedef struct shimaore_stream_s {
+    uint32_t ssrc;
+    struct sockaddr_storage source;
+    socklen_t source_length;
+
+    /* Latest metadata from a start packet, NULL if none was received */
+    uint8_t *meta;
+    uint16_t meta_length;
+
+    /* RFC 3550 appendix A.1 sequence number tracking */
+    uint16_t max_sequence;
+    uint32_t cycles;
+    uint32_t base_sequence;
+    int sequence_valid;
+
+    /* Byte offsets: RTP timestamps extended to 64 bits, relative to the first audio packet */
+    uint32_t first_timestamp;
+    uint32_t last_timestamp;
+    int64_t last_offset;
+    int timestamp_valid;
+    /* Plain framing: bytes received so far */
+    uint64_t plain_offset;
+
+    uint64_t packets;
+    uint64_t octets;
+    /* Packets older than the highest sequence number seen */
+    uint64_t reordered;
+    /* Rebuilt from redundancy or parity packets, and counted in `packets` */
+    uint64_t recovered;
+    int64_t last_seen_ms;
+    /* `fec=parity`: the latest packets, kept from the first parity packet on */
+    struct shimaore_stream_fec_s *fec;
+
+    /* For the application */
+    void *user;
+
+    struct shimaore_stream_s *next;
+} shimaore_stream_t;
+
+typedef enum {
+    SHIMAORE_STREAM_STOPPED,
+    SHIMAORE_STREAM_TIMED_OUT,
+    SHIMAORE_STREAM_CLOSED,
+} shimaore_stream_end_t;
+
+typedef struct shimaore_receiver_callbacks_s {
+    /* A new stream: first packet of any kind */
+    void (*on_start)(void *arg, shimaore_stream_t *stream);
+    /* A start packet carried new metadata (stream->meta) */
+    void (*on_meta)(void *arg, shimaore_stream_t *stream);
+    /* Audio, or feature frames, at byte `offset` of the stream; may be called out of order */
+    void (*on_audio)(void *arg, shimaore_stream_t *stream, const shimaore_packet_t *packet, uint64_t offset);
+    /* The stream is about to be freed */
+    void (*on_end)(void *arg, shimaore_stream_t *stream, shimaore_stream_end_t reason);
+    void *arg;
+} shimaore_receiver_callbacks_t;
+
+typedef struct shimaore_receiver_config_s {
+    const char *ip;
+    int port;
+    shimaore_receiver_framing_t framing;
+    /* Extension identifiers of abs-capture-time and of the levels, 0 to ignore them */
+    uint8_t capture_time_id;
+    uint8_t levels_id;
+    /* Plain framing: recognize start/stop packets (only sent when the tap has metadata) */
+    int plain_control;
+    int receive_buffer;
+    uint32_t idle_timeout_ms;
+    int reuse_port;
+    /* Use io_uring when built with HAVE_LIBURING; recvmmsg otherwise */
+    int io_uring;
+    /* Ask the source again for packets missing from a stream (taps started with `nack=`) */
+    int nack;
+    shimaore_receiver_callbacks_t callbacks;
+} shimaore_receiver_config_t;
+
+typedef struct shimaore_receiver_stats_s {
+    uint64_t packets;
+    uint64_t octets;
+    /* Not parseable in the configured framing */
+    uint64_t invalid;
+    uint64_t streams;
+    /* Sum over ended streams */
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t recovered;
+    /* Packets asked for again */
+    uint64_t nacked;
+} shimaore_receiver_stats_t;
+
+typedef struct shimaore_receiver_s shimaore_receiver_t;
+
+/* Zero-copy parse of one datagram. Returns 0, or -1 when the datagram is not valid. */
+int shimaore_packet_parse(shimaore_receiver_framing_t framing, uint8_t capture_time_id, uint8_t levels_id, int plain_control,
+                          const uint8_t *data, uint32_t len, shimaore_packet_t *packet);
+
+/* Packets missing in the stream so far, per RFC 3550 appendix A.3 */
+int64_t shimaore_stream_lost(const shimaore_stream_t *stream);
+
+shimaore_receiver_t *shimaore_receiver_new(const shimaore_receiver_config_t *config);
+/* Wait up to `timeout_ms` for packets, dispatch one batch and expire idle streams.
+ * Returns the number of packets, or -1 on error.
+ */
+int shimaore_receiver_run_once(shimaore_receiver_t *receiver, int timeout_ms);
+void shimaore_receiver_stats(const shimaore_receiver_t *receiver, shimaore_receiver_stats_t *stats);
+/* Ends the remaining streams (SHIMAORE_STREAM_CLOSED) */
+void shimaore_receiver_free(shimaore_receiver_t *receiver);
+
+#endif
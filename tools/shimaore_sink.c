@@ -0,0 +1,311 @@
+/*
+ * Version: MPL 1.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * This file is part of `mod_shimaore`
+ * (c) 2024-2025 Stéphane Alnet <stephane@shimaore.net>
+ *
+ */
+
+/* Sink for mod_shimaore streams, built on shimaore_receiver: writes one WAV file per stream and
+ * prints per-stream loss and reordering when it ends, plus totals every second.
+ *
+ *   shimaore_sink -l 0.0.0.0:7000 -F rtp -r 8000 -o /var/tmp/taps
+ *   shimaore_sink -l 127.0.0.1:7000 -n          (benchmark: no files)
+ *
+ * Files are sparse and memory-mapped: audio is copied straight to its place, computed from the
+ * RTP timestamp, so reordered packets land where they belong and losses or pauses read as silence.
+ * The stream's sample rate is not on the wire; give it with -r.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shimaore_receiver.h"
+
+#define WAV_HEADER_SIZE 44
+
+typedef struct {
+    int fd;
+    uint8_t *map;
+    uint64_t capacity;
+    /* Highest audio byte written */
+    uint64_t length;
+    char path[512];
+} wav_t;
+
+static struct {
+    const char *directory;
+    uint32_t rate;
+    uint32_t maximum_seconds;
+    int write_files;
+    int quiet;
+    volatile sig_atomic_t running;
+} options;
+
+static void store_le16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void store_le32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void wav_header(uint8_t *p, uint32_t rate, uint32_t length) {
+    memcpy(p, "RIFF", 4);
+    store_le32(p + 4, 36 + length);
+    memcpy(p + 8, "WAVEfmt ", 8);
+    store_le32(p + 16, 16);
+    /* PCM, mono, 16 bits */
+    store_le16(p + 20, 1);
+    store_le16(p + 22, 1);
+    store_le32(p + 24, rate);
+    store_le32(p + 28, rate * 2);
+    store_le16(p + 32, 2);
+    store_le16(p + 34, 16);
+    memcpy(p + 36, "data", 4);
+    store_le32(p + 40, length);
+}
+
+static void source_name(const shimaore_stream_t *stream, char *name, size_t size) {
+    char address[INET6_ADDRSTRLEN] = "unknown";
+    int port = 0;
+
+    if (stream->source.ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *) &stream->source;
+        inet_ntop(AF_INET, &in->sin_addr, address, sizeof(address));
+        port = ntohs(in->sin_port);
+    } else if (stream->source.ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) &stream->source;
+        inet_ntop(AF_INET6, &in6->sin6_addr, address, sizeof(address));
+        port = ntohs(in6->sin6_port);
+    }
+    snprintf(name, size, "%s:%d", address, port);
+}
+
+static void on_start(void *arg, shimaore_stream_t *stream) {
+    wav_t *wav;
+    char source[INET6_ADDRSTRLEN + 8];
+
+    if (!options.write_files || !(wav = calloc(1, sizeof(*wav)))) {
+        return;
+    }
+    source_name(stream, source, sizeof(source));
+    for (char *p = source; *p; p++) {
+        if (*p == ':') {
+            *p = '_';
+        }
+    }
+    snprintf(wav->path, sizeof(wav->path), "%s/%s-%u-%ld.wav", options.directory, source, stream->ssrc, (long) time(NULL));
+    wav->capacity = (uint64_t) options.maximum_seconds * options.rate * 2;
+
+    /* Sparse: only pages that receive audio take space */
+    if ((wav->fd = open(wav->path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 ||
+        ftruncate(wav->fd, WAV_HEADER_SIZE + wav->capacity) < 0 ||
+        (wav->map = mmap(NULL, WAV_HEADER_SIZE + wav->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, wav->fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", wav->path, strerror(errno));
+        if (wav->fd >= 0) {
+            close(wav->fd);
+        }
+        free(wav);
+        return;
+    }
+    stream->user = wav;
+}
+
+static void on_meta(void *arg, shimaore_stream_t *stream) {
+    if (!options.quiet) {
+        fprintf(stderr, "ssrc %u: %u bytes of metadata:", stream->ssrc, stream->meta_length);
+        for (uint32_t i = 0; i < stream->meta_length; i++) {
+            fprintf(stderr, "%02x", stream->meta[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static void on_audio(void *arg, shimaore_stream_t *stream, const shimaore_packet_t *packet, uint64_t offset) {
+    wav_t *wav = (wav_t *) stream->user;
+    uint32_t len = packet->payload_length;
+    uint8_t *to;
+
+    /* Feature streams are only counted */
+    if (!wav || offset >= wav->capacity || packet->payload_type != SHIMAORE_PT_L16) {
+        return;
+    }
+    if (offset + len > wav->capacity) {
+        len = wav->capacity - offset;
+    }
+    to = wav->map + WAV_HEADER_SIZE + offset;
+
+    /* WAV is little-endian */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (packet->network_order) {
+        for (uint32_t i = 0; i + 1 < len; i += 2) {
+            to[i] = packet->payload[i + 1];
+            to[i + 1] = packet->payload[i];
+        }
+    } else {
+        memcpy(to, packet->payload, len);
+    }
+#else
+    if (packet->network_order) {
+        memcpy(to, packet->payload, len);
+    } else {
+        for (uint32_t i = 0; i + 1 < len; i += 2) {
+            to[i] = packet->payload[i + 1];
+            to[i + 1] = packet->payload[i];
+        }
+    }
+#endif
+    if (offset + len > wav->length) {
+        wav->length = offset + len;
+    }
+}
+
+static void on_end(void *arg, shimaore_stream_t *stream, shimaore_stream_end_t reason) {
+    static const char *reasons[] = { "stopped", "timed out", "closed" };
+    wav_t *wav = (wav_t *) stream->user;
+    char source[INET6_ADDRSTRLEN + 8];
+
+    if (!options.quiet) {
+        source_name(stream, source, sizeof(source));
+        fprintf(stderr, "%s ssrc %u %s: %lu packets, %lu octets, %ld lost, %lu reordered, %lu recovered%s%s\n", source, stream->ssrc,
+                reasons[reason], (unsigned long) stream->packets, (unsigned long) stream->octets, (long) shimaore_stream_lost(stream),
+                (unsigned long) stream->reordered, (unsigned long) stream->recovered, wav ? " -> " : "", wav ? wav->path : "");
+    }
+    if (wav) {
+        wav_header(wav->map, options.rate, (uint32_t) wav->length);
+        munmap(wav->map, WAV_HEADER_SIZE + wav->capacity);
+        if (ftruncate(wav->fd, WAV_HEADER_SIZE + wav->length) < 0) {
+            fprintf(stderr, "%s: %s\n", wav->path, strerror(errno));
+        }
+        close(wav->fd);
+        free(wav);
+        stream->user = NULL;
+    }
+}
+
+static void on_signal(int signal) {
+    options.running = 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-l ip:port] [-F plain|rtp] [-r rate] [-o directory] [-m maximum_seconds] [-x abs_capture_time_id]\n"
+            "          [-t idle_timeout_ms] [-d duration_s] [-k] [-n] [-u] [-q]\n"
+            "  -k  send NACKs for missing packets (taps started with nack=)\n"
+            "  -n  do not write files (benchmark)\n"
+            "  -u  receive with io_uring (when built with HAVE_LIBURING)\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    shimaore_receiver_config_t config = { 0 };
+    shimaore_receiver_t *receiver;
+    shimaore_receiver_stats_t stats, previous = { 0 };
+    char listen[256] = "0.0.0.0:7000";
+    char *colon;
+    int option;
+    uint32_t duration = 0;
+    time_t started, last;
+
+    options.directory = ".";
+    options.rate = 8000;
+    options.maximum_seconds = 4 * 3600;
+    options.write_files = 1;
+    config.framing = SHIMAORE_RECEIVER_RTP;
+    config.plain_control = 1;
+    config.receive_buffer = 64 * 1024 * 1024;
+    config.idle_timeout_ms = 5000;
+
+    while ((option = getopt(argc, argv, "l:F:r:o:m:x:t:d:knuq")) != -1) {
+        switch (option) {
+        case 'l': snprintf(listen, sizeof(listen), "%s", optarg); break;
+        case 'F':
+            if (!strcmp(optarg, "rtp")) {
+                config.framing = SHIMAORE_RECEIVER_RTP;
+            } else if (!strcmp(optarg, "plain")) {
+                config.framing = SHIMAORE_RECEIVER_PLAIN;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'r': options.rate = atoi(optarg); break;
+        case 'o': options.directory = optarg; break;
+        case 'm': options.maximum_seconds = atoi(optarg); break;
+        case 'x': config.capture_time_id = atoi(optarg); break;
+        case 't': config.idle_timeout_ms = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'k': config.nack = 1; break;
+        case 'n': options.write_files = 0; break;
+        case 'u': config.io_uring = 1; break;
+        case 'q': options.quiet = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (!(colon = strrchr(listen, ':')) || options.rate == 0) {
+        usage(argv[0]);
+    }
+    *colon = '\0';
+    config.ip = listen;
+    config.port = atoi(colon + 1);
+    config.reuse_port = 1;
+    config.callbacks.on_start = on_start;
+    config.callbacks.on_meta = on_meta;
+    config.callbacks.on_audio = on_audio;
+    config.callbacks.on_end = on_end;
+
+    if (!(receiver = shimaore_receiver_new(&config))) {
+        fprintf(stderr, "cannot listen on %s:%d: %s\n", config.ip, config.port, strerror(errno));
+        return 1;
+    }
+
+    options.running = 1;
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    started = last = time(NULL);
+
+    while (options.running && (duration == 0 || time(NULL) - started < duration)) {
+        if (shimaore_receiver_run_once(receiver, 100) < 0) {
+            perror("receive");
+            break;
+        }
+        if (time(NULL) != last) {
+            last = time(NULL);
+            shimaore_receiver_stats(receiver, &stats);
+            if (!options.quiet) {
+                fprintf(stderr, "%lu packets/s, %.2f MB/s, %lu streams, %lu lost, %lu reordered, %lu recovered, %lu nacked, %lu invalid\n",
+                        (unsigned long) (stats.packets - previous.packets), (stats.octets - previous.octets) / 1e6,
+                        (unsigned long) stats.streams, (unsigned long) stats.lost, (unsigned long) stats.reordered,
+                        (unsigned long) stats.recovered, (unsigned long) stats.nacked, (unsigned long) stats.invalid);
+            }
+            previous = stats;
+        }
+    }
+
+    shimaore_receiver_free(receiver);
+    return 0;
+}